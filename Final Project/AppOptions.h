@@ -0,0 +1,197 @@
+#ifndef APP_OPTIONS_H
+#define APP_OPTIONS_H
+
+#include "Benchmark.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "ShadowFilter.h"
+#include "ShadowPass.h"
+#include "VertexFormat.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// Settings of a run, read from the command line (see main() for the flags). Parsing only fills these in;
+// main() hands them to the subsystems once it has a context.
+struct AppOptions {
+    // offline steps and standalone benchmarks, each of which runs instead of the scene
+    bool bake = false;
+    bool compressTextures = true;
+    bool compareTextures = false;
+    bool benchmarkShadows = false;
+    bool benchmarkShaders = false;
+    size_t benchmarkOrbitBodies = 0;
+    unsigned int benchmarkJobThreads = 0;
+    size_t benchmarkGpuCullingInstances = 0;
+
+    // the scene
+    size_t textureBudgetMB = 512;
+    VertexLayout vertexLayout = VertexFormat::defaultLayout();
+    size_t stressInstances = 0;
+    bool gpuCulling = false;
+    unsigned int jobWorkers = JobSystem::defaultWorkerCount();
+    bool programCache = true;
+    ShadowBackend shadowBackend = SHADOW_BACKEND_GEOMETRY_SHADER;
+    size_t lightCount = 0;
+    ShadowQuality shadowQuality = SHADOW_QUALITY_HIGH;
+    bool shadowEarlyOut = true;
+    float lodPixelError = 1.0f;
+    float shadowLodTexelError = 1.0f;
+
+    // in-loop benchmarks, which end the run when they are done
+    bool benchmarkLights = false;
+    bool benchmarkShadowFilter = false;
+
+    // profiling and the frame benchmark
+    bool profile = false;
+    bool profileOverlay = false;
+    std::string profileTracePath, profileCsvPath;
+    bool benchmark = false;
+    int benchmarkFrames = 600;
+    int benchmarkWarmupFrames = 60;
+    double benchmarkTimestep = 1.0 / 60.0;
+    std::string benchmarkReportPath = "benchmark.json";
+    CameraScript cameraScript = CameraScript::defaultPath();
+
+    // true if the run times its frames, so vsync must not cap them
+    bool measuresFrames() const
+    {
+        return stressInstances > 0 || benchmarkLights || benchmarkShadowFilter || benchmark;
+    }
+
+    // reads the flags; unknown flags are ignored and bad values are reported and left at their defaults
+    static AppOptions parse(int argc, char* argv[])
+    {
+        AppOptions options;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--bake")
+                options.bake = true;
+            else if (arg == "--uncompressed")
+                options.compressTextures = false;
+            else if (arg == "--compare-textures")
+                options.compareTextures = true;
+            else if (arg == "--texture-budget-mb" && hasValue)
+                parseValue<size_t>(arg, argv[++i], 0, std::numeric_limits<size_t>::max() >> 20, options.textureBudgetMB);
+            else if (arg == "--vertex-format" && hasValue)
+            {
+                if (!VertexFormat::parseLayout(argv[++i], options.vertexLayout))
+                    std::cerr << "Unknown vertex format " << argv[i] << ", expected float, half or snorm16" << std::endl;
+            }
+            else if (arg == "--stress-instances" && hasValue)
+                parseValue<size_t>(arg, argv[++i], 0, std::numeric_limits<size_t>::max(), options.stressInstances);
+            else if (arg == "--gpu-culling")
+                options.gpuCulling = true;
+            else if (arg == "--benchmark-gpu-culling" && hasValue)
+                parseValue<size_t>(arg, argv[++i], 0, std::numeric_limits<size_t>::max(), options.benchmarkGpuCullingInstances);
+            else if (arg == "--benchmark-orbits" && hasValue)
+                parseValue<size_t>(arg, argv[++i], 0, std::numeric_limits<size_t>::max(), options.benchmarkOrbitBodies);
+            else if (arg == "--job-workers" && hasValue)
+                parseValue<unsigned int>(arg, argv[++i], 0, MAX_JOB_THREADS, options.jobWorkers);
+            else if (arg == "--benchmark-jobs" && hasValue)
+                parseValue<unsigned int>(arg, argv[++i], 1, MAX_JOB_THREADS, options.benchmarkJobThreads);
+            else if (arg == "--no-program-cache")
+                options.programCache = false;
+            else if (arg == "--benchmark-shaders")
+                options.benchmarkShaders = true;
+            else if (arg == "--shadow-backend" && hasValue)
+            {
+                if (!ShadowPass::parseBackend(argv[++i], options.shadowBackend))
+                    std::cerr << "Unknown shadow back-end " << argv[i] << ", expected gs, layered or six-pass" << std::endl;
+            }
+            else if (arg == "--benchmark-shadows")
+                options.benchmarkShadows = true;
+            else if (arg == "--lights" && hasValue)
+                parseValue<size_t>(arg, argv[++i], 0, LightClusters::MAX_LIGHTS, options.lightCount);
+            else if (arg == "--benchmark-lights")
+                options.benchmarkLights = true;
+            else if (arg == "--shadow-taps" && hasValue)
+            {
+                if (!ShadowFilter::parseQuality(argv[++i], options.shadowQuality))
+                    std::cerr << "Unknown shadow tap count " << argv[i] << ", expected 1, 4, 8 or 20" << std::endl;
+            }
+            else if (arg == "--no-shadow-early-out")
+                options.shadowEarlyOut = false;
+            else if (arg == "--benchmark-shadow-filter")
+                options.benchmarkShadowFilter = true;
+            else if (arg == "--lod-error" && hasValue)
+                parseValue<float>(arg, argv[++i], 0.0f, std::numeric_limits<float>::max(), options.lodPixelError);
+            else if (arg == "--shadow-lod-error" && hasValue)
+                parseValue<float>(arg, argv[++i], 0.0f, std::numeric_limits<float>::max(), options.shadowLodTexelError);
+            else if (arg == "--no-lod")
+                options.lodPixelError = options.shadowLodTexelError = 0.0f;
+            else if (arg == "--profile")
+                options.profile = true;
+            else if (arg == "--profile-overlay")
+                options.profileOverlay = true;
+            else if (arg == "--profile-trace" && hasValue)
+                options.profileTracePath = argv[++i];
+            else if (arg == "--profile-csv" && hasValue)
+                options.profileCsvPath = argv[++i];
+            else if (arg == "--benchmark")
+                options.benchmark = true;
+            else if (arg == "--benchmark-frames" && hasValue)
+                parseValue<int>(arg, argv[++i], 1, std::numeric_limits<int>::max(), options.benchmarkFrames);
+            else if (arg == "--benchmark-warmup" && hasValue)
+                parseValue<int>(arg, argv[++i], 0, std::numeric_limits<int>::max(), options.benchmarkWarmupFrames);
+            else if (arg == "--benchmark-timestep" && hasValue)
+                parseValue<double>(arg, argv[++i], 0.0, 1.0, options.benchmarkTimestep);
+            else if (arg == "--benchmark-report" && hasValue)
+                options.benchmarkReportPath = argv[++i];
+            else if (arg == "--camera-script" && hasValue)
+            {
+                if (!options.cameraScript.load(argv[++i]))
+                    std::cerr << "Could not read the camera script " << argv[i] << ", using the default path" << std::endl;
+            }
+        }
+
+        // the light benchmark doubles up to 1024 lights unless told otherwise
+        if (options.benchmarkLights && options.lightCount == 0)
+            options.lightCount = 1024;
+        // any profiler output turns the profiler on, and the benchmark reports the profiler's pass timings
+        if (options.profileOverlay || !options.profileTracePath.empty() || !options.profileCsvPath.empty() || options.benchmark)
+            options.profile = true;
+        return options;
+    }
+
+private:
+    // more job threads than this is a typo, not a machine
+    static constexpr unsigned int MAX_JOB_THREADS = 256;
+
+    // Reads the value of a numeric flag into value if it is a number in [minValue, maxValue], otherwise reports
+    // it and leaves value alone. Whole numbers are never negative here, so a sign is rejected rather than
+    // wrapped around the way strtoull does with "-1".
+    template <typename T>
+    static void parseValue(const std::string& flag, const char* text, T minValue, T maxValue, T& value)
+    {
+        char* end = nullptr;
+        errno = 0;
+        bool inRange;
+        T parsed;
+        if constexpr (std::is_integral<T>::value)
+        {
+            unsigned long long number = std::strtoull(text, &end, 10);
+            inRange = std::strchr(text, '-') == nullptr && number >= (unsigned long long)minValue && number <= (unsigned long long)maxValue;
+            parsed = T(number);
+        }
+        else
+        {
+            double number = std::strtod(text, &end);
+            inRange = number >= minValue && number <= maxValue;     // false for NaN
+            parsed = T(number);
+        }
+        if (end != text && *end == '\0' && errno == 0 && inRange)
+            value = parsed;
+        else
+            std::cerr << "Bad value " << text << " for " << flag << ", keeping the default" << std::endl;
+    }
+};
+#endif
@@ -0,0 +1,184 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include "GLState.h"
+#include "JobSystem.h"
+#include "TextureContainer.h"
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Background asset loader.
+// Disk reads, mesh imports and image decodes run as JobSystem jobs. Anything that touches OpenGL goes to
+// the JobSystem's main thread queue, which the render loop empties under a per-frame time budget
+// (JobSystem::pumpMainThread), so the window keeps presenting frames while the assets stream in.
+class AssetLoader
+{
+public:
+    // Must be constructed on the thread that owns the OpenGL context.
+    AssetLoader()
+    {
+        glGenBuffers(1, &uploadBuffer);
+    }
+
+    ~AssetLoader()
+    {
+        shutdown();
+    }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // queues a job for a worker thread. The job must not call OpenGL; use enqueueMainThread for that.
+    void enqueue(std::function<void()> job)
+    {
+        JobSystem::instance().run([this, job]() {
+            if (!stopping)
+                job();
+        }, &pending);
+    }
+
+    // queues a job that will run on the render thread during JobSystem::pumpMainThread.
+    void enqueueMainThread(std::function<void()> job)
+    {
+        JobSystem::instance().runOnMainThread([this, job]() {
+            if (!stopping)
+                job();
+        }, &pending);
+    }
+
+    // true once every queued job (worker and render thread) has finished
+    bool isIdle() const
+    {
+        return pending.done();
+    }
+
+    // creates a texture that holds a 1x1 white placeholder right away and replaces it with the decoded
+    // image once it is ready. The returned id stays valid throughout, so it can be handed to a Mesh immediately.
+    // onUploaded runs on the render thread with the texture's size in GPU memory once the image is in place,
+    // or with 0 if the image could not be loaded and the placeholder stays.
+    GLuint loadTexture(const char* path, const std::string& directory, std::function<void(size_t)> onUploaded = nullptr)
+    {
+        std::string filename = directory + '/' + std::string(path);
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        GLState::instance().bindTextureForUpdate(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        enqueue([this, filename, textureID, onUploaded]() {
+            // a pre-baked container skips the decode and carries its own mip chain
+            std::shared_ptr<TextureContainer::BakedTexture> baked = std::make_shared<TextureContainer::BakedTexture>();
+            if (TextureContainer::read(filename, *baked))
+            {
+                enqueueMainThread([this, filename, textureID, baked, onUploaded]() {
+                    if (!TextureContainer::upload(textureID, *baked))
+                        enqueue([this, filename, textureID, onUploaded]() { decodeTexture(filename, textureID, onUploaded); });
+                    else if (onUploaded)
+                        onUploaded(TextureContainer::gpuBytes(*baked));
+                });
+                return;
+            }
+            decodeTexture(filename, textureID, onUploaded);
+        });
+
+        return textureID;
+    }
+
+    // stops loading: waits for the jobs that are running, and skips the ones that have not started yet,
+    // so call this before destroying anything those jobs refer to. Render thread only.
+    void shutdown()
+    {
+        if (stopping.exchange(true))
+            return;
+        JobSystem::instance().wait(pending, true);
+        glDeleteBuffers(1, &uploadBuffer);
+    }
+
+private:
+    struct DecodedImage {
+        unsigned char* pixels = nullptr;
+        int width = 0, height = 0, components = 0;
+
+        ~DecodedImage()
+        {
+            if (pixels != nullptr)
+                stbi_image_free(pixels);
+        }
+    };
+
+    JobCounter pending;     // queued and running jobs, worker and render thread
+    std::atomic<bool> stopping{ false };
+
+    // pixel unpack buffer the decoded images are streamed through
+    GLuint uploadBuffer = 0;
+
+    // worker side of the stb_image path: decodes the source image and queues its upload
+    void decodeTexture(const std::string& filename, GLuint textureID, std::function<void(size_t)> onUploaded)
+    {
+        std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>();
+        image->pixels = stbi_load(filename.c_str(), &image->width, &image->height, &image->components, 0);
+        if (image->pixels == nullptr)
+        {
+            std::cout << "Texture failed to load at path: " << filename << std::endl;
+            if (onUploaded)
+                enqueueMainThread([onUploaded]() { onUploaded(0); });
+            return;
+        }
+        enqueueMainThread([this, image, textureID, onUploaded]() {
+            uploadTexture(textureID, *image);
+            if (onUploaded)
+                onUploaded(TextureContainer::mippedTextureBytes(image->width, image->height, image->components));
+        });
+    }
+
+    // copies the pixels into the unpack buffer and lets the driver pull them into the texture from there.
+    // The buffer is orphaned before every upload so we never wait for the previous transfer to finish.
+    void uploadTexture(GLuint textureID, const DecodedImage& image)
+    {
+        GLenum format = GL_RGBA;
+        if (image.components == 1)
+            format = GL_RED;
+        else if (image.components == 3)
+            format = GL_RGB;
+
+        GLsizeiptr size = static_cast<GLsizeiptr>(image.width) * image.height * image.components;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        const void* source = nullptr;   // offset into the unpack buffer
+        if (mapped != nullptr)
+        {
+            std::memcpy(mapped, image.pixels, static_cast<size_t>(size));
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+        {
+            // mapping failed, upload straight from client memory instead
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            source = image.pixels;
+        }
+
+        GLState::instance().bindTextureForUpdate(GL_TEXTURE_2D, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, source);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+};
+#endif
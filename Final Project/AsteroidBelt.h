@@ -0,0 +1,73 @@
+#ifndef ASTEROID_BELT_H
+#define ASTEROID_BELT_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "Bounds.h"
+#include "OrbitEngine.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// A ring of small bodies orbiting the origin, drawn with the instanced path.
+// Each asteroid gets Kepler elements (slightly eccentric and inclined orbits, mean motion falling off with
+// radius as a^-3/2) and a spin, and the OrbitEngine evaluates all of them for a point in time.
+class AsteroidBelt
+{
+public:
+    AsteroidBelt(size_t count, float innerRadius, float outerRadius, uint32_t seed = 1)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        orbits.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            OrbitalElements elements;
+            elements.semiMajorAxis = innerRadius + (outerRadius - innerRadius) * unit(random);
+            elements.eccentricity = MAX_ECCENTRICITY * unit(random);
+            elements.inclination = MAX_INCLINATION * (2.0f * unit(random) - 1.0f);
+            elements.ascendingNode = glm::two_pi<float>() * unit(random);
+            elements.argumentOfPeriapsis = glm::two_pi<float>() * unit(random);
+            elements.meanAnomaly = glm::two_pi<float>() * unit(random);
+            elements.meanMotion = 0.6f / (elements.semiMajorAxis * std::sqrt(elements.semiMajorAxis));
+            elements.scale = MIN_SCALE + (MAX_SCALE - MIN_SCALE) * unit(random);
+            elements.spinSpeed = 2.0f * unit(random);
+            elements.spinPhase = glm::two_pi<float>() * unit(random);
+            orbits.add(elements);
+        }
+    }
+
+    size_t size() const
+    {
+        return orbits.size();
+    }
+
+    // world space box around every asteroid at any time, for a body model with the given bounding sphere radius
+    AABB bounds(float bodyRadius) const
+    {
+        if (orbits.size() == 0)
+            return AABB();
+        float radius = orbits.apoapsisBound() + MAX_SCALE * bodyRadius;
+        float height = orbits.heightBound() + MAX_SCALE * bodyRadius;
+        return AABB(glm::vec3(-radius, -height, -radius), glm::vec3(radius, height, radius));
+    }
+
+    // writes the model matrices of the first count asteroids at the given time to out, which can be a
+    // mapped instance buffer, and the distance from every probe point to the nearest asteroid to nearest
+    void transforms(float time, size_t count, glm::mat4* out, const glm::vec3* probes = nullptr, float* nearest = nullptr, size_t probeCount = 0)
+    {
+        orbits.propagate(time, count, out, probes, nearest, probeCount);
+    }
+
+    static constexpr float MAX_ECCENTRICITY = 0.08f;
+    static constexpr float MAX_INCLINATION = 0.025f;    // radians
+    static constexpr float MIN_SCALE = 0.01f;
+    static constexpr float MAX_SCALE = 0.04f;   // largest scale of an asteroid's body
+
+private:
+    OrbitEngine orbits;
+};
+#endif
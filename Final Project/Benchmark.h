@@ -0,0 +1,424 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glm/glm.hpp>
+
+#include "LightClusters.h"
+#include "Profiler.h"
+#include "ShadowFilter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one key of a scripted camera path
+struct CameraKey {
+    float time;             // seconds of simulation time
+    glm::vec3 position;
+    float yaw, pitch;       // degrees, as the mouse look uses them
+    bool follow;            // follow camera on from this key until the next
+};
+
+// Camera path replayed by the benchmark instead of the mouse and keyboard. Position, yaw and pitch are
+// interpolated linearly between keys; the follow camera switches at the keys. After the last key the camera stays.
+class CameraScript
+{
+public:
+    // a flight around the scene that rides along with the Earth for a while
+    static CameraScript defaultPath()
+    {
+        CameraScript script;
+        script.keys = {
+            { 0.0f, glm::vec3(0.0f, 2.0f, 5.0f), -90.0f, -15.0f, false },
+            { 2.5f, glm::vec3(7.0f, 3.0f, 7.0f), -135.0f, -20.0f, false },
+            { 4.0f, glm::vec3(7.0f, 3.0f, 7.0f), -135.0f, -20.0f, true },
+            { 6.0f, glm::vec3(7.0f, 3.0f, 7.0f), 0.0f, 0.0f, true },
+            { 7.0f, glm::vec3(0.0f, 9.0f, 0.5f), -90.0f, -85.0f, false },
+            { 10.0f, glm::vec3(-9.0f, 1.0f, 0.0f), 0.0f, -5.0f, false },
+            { 12.0f, glm::vec3(-2.5f, 0.5f, -2.5f), 45.0f, -5.0f, false }
+        };
+        return script;
+    }
+
+    // reads a script of one key per line, "time x y z yaw pitch follow" with follow 0 or 1, sorted by
+    // time. Empty lines and lines starting with # are skipped.
+    bool load(const std::string& path)
+    {
+        std::ifstream in(path);
+        if (!in)
+            return false;
+        std::vector<CameraKey> loaded;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            CameraKey key;
+            int follow = 0;
+            if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch >> follow))
+                return false;
+            key.follow = follow != 0;
+            if (!loaded.empty() && key.time < loaded.back().time)
+                return false;
+            loaded.push_back(key);
+        }
+        if (loaded.empty())
+            return false;
+        keys = loaded;
+        return true;
+    }
+
+    // the camera at a time
+    void sample(float time, glm::vec3& position, glm::vec3& front, bool& follow) const
+    {
+        size_t next = 0;
+        while (next < keys.size() && keys[next].time <= time)
+            next++;
+        const CameraKey& from = keys[next == 0 ? 0 : next - 1];
+        const CameraKey& to = keys[std::min(next, keys.size() - 1)];
+        float span = to.time - from.time;
+        float t = span > 0.0f ? std::min(std::max((time - from.time) / span, 0.0f), 1.0f) : 0.0f;
+
+        position = from.position + (to.position - from.position) * t;
+        float yaw = glm::radians(from.yaw + (to.yaw - from.yaw) * t);
+        float pitch = glm::radians(from.pitch + (to.pitch - from.pitch) * t);
+        front = glm::normalize(glm::vec3(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch)));
+        follow = from.follow;
+    }
+
+private:
+    std::vector<CameraKey> keys;
+};
+
+// counters of one frame, for the report
+struct BenchmarkCounters {
+    double drawCalls = 0.0;
+    double triangles = 0.0;
+    double stateChanges = 0.0;          // issued through GLState
+    double stateChangesElided = 0.0;
+    double uniformUploads = 0.0;
+    double uniformUploadsSkipped = 0.0;
+    double visibleBodies = 0.0;
+};
+
+// Deterministic benchmark run. Simulation time advances by a fixed timestep per frame, starting once the
+// scene is loaded, so every run renders the same frames. After the warmup frames the wall clock time of
+// every frame (start to start, so it includes waiting for the GPU) and its counters are recorded, and the
+// profiler statistics are restarted to cover the same frames.
+class BenchmarkRun
+{
+public:
+    BenchmarkRun(int warmupFrames, int measuredFrames, double timestep)
+        : warmupFrames(warmupFrames), measuredFrames(measuredFrames), timestep(timestep)
+    {
+    }
+
+    // starts a frame, recording the one before it with its counters. Call before the profiler's beginFrame,
+    // so its statistics restart with the first measured frame. Returns false once every measured frame is
+    // recorded and the run is over.
+    bool beginFrame(bool sceneReady, const BenchmarkCounters& previousFrame)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (frame > warmupFrames)
+        {
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(now - frameStart).count());
+            counterTotals.drawCalls += previousFrame.drawCalls;
+            counterTotals.triangles += previousFrame.triangles;
+            counterTotals.stateChanges += previousFrame.stateChanges;
+            counterTotals.stateChangesElided += previousFrame.stateChangesElided;
+            counterTotals.uniformUploads += previousFrame.uniformUploads;
+            counterTotals.uniformUploadsSkipped += previousFrame.uniformUploadsSkipped;
+            counterTotals.visibleBodies += previousFrame.visibleBodies;
+        }
+        frameStart = now;
+        if (int(frameTimes.size()) >= measuredFrames)
+            return false;
+
+        // nothing counts until every model and texture is in
+        if (!sceneReady && frame == 0)
+            return true;
+        frame++;
+        if (frame == warmupFrames + 1)
+            Profiler::instance().setHistoryLength(size_t(measuredFrames));
+        return true;
+    }
+
+    // simulation time of the current frame
+    double time() const
+    {
+        return frame > 0 ? (frame - 1) * timestep : 0.0;
+    }
+
+    // writes the report as JSON: frame time percentiles, the profiler's scopes and the average counters per frame
+    bool writeReport(const std::string& path, const std::string& context, const std::string& renderer, int width, int height) const
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        out.setf(std::ios::fixed);
+        out.precision(4);
+
+        std::vector<double> sorted(frameTimes);
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double ms : sorted)
+            total += ms;
+        size_t count = std::max<size_t>(sorted.size(), 1);
+
+        out << "{\n";
+        out << "  \"context\": \"" << escape(context) << "\",\n";
+        out << "  \"renderer\": \"" << escape(renderer) << "\",\n";
+        out << "  \"resolution\": [" << width << ", " << height << "],\n";
+        out << "  \"timestep\": " << timestep << ",\n";
+        out << "  \"warmupFrames\": " << warmupFrames << ",\n";
+        out << "  \"frames\": " << sorted.size() << ",\n";
+        out << "  \"frameTimeMs\": { \"avg\": " << total / count << ", \"min\": " << percentile(sorted, 0.0)
+            << ", \"p50\": " << percentile(sorted, 0.5) << ", \"p90\": " << percentile(sorted, 0.9)
+            << ", \"p99\": " << percentile(sorted, 0.99) << ", \"max\": " << percentile(sorted, 1.0) << " },\n";
+
+        out << "  \"scopes\": [";
+        std::vector<Profiler::ScopeStats> scopes = Profiler::instance().scopeStats();
+        for (size_t i = 0; i < scopes.size(); i++)
+        {
+            const Profiler::ScopeStats& scope = scopes[i];
+            out << (i == 0 ? "\n" : ",\n") << "    { \"scope\": \"" << escape(scope.path) << "\", \"frames\": " << scope.frames
+                << ", \"cpuMs\": " << summaryJson(scope.cpu);
+            if (scope.timesGpu)
+                out << ", \"gpuMs\": " << summaryJson(scope.gpu);
+            out << " }";
+        }
+        out << "\n  ],\n";
+
+        out << "  \"countersPerFrame\": {\n";
+        out << "    \"drawCalls\": " << counterTotals.drawCalls / count << ",\n";
+        out << "    \"triangles\": " << counterTotals.triangles / count << ",\n";
+        out << "    \"stateChanges\": " << counterTotals.stateChanges / count << ",\n";
+        out << "    \"stateChangesElided\": " << counterTotals.stateChangesElided / count << ",\n";
+        out << "    \"uniformUploads\": " << counterTotals.uniformUploads / count << ",\n";
+        out << "    \"uniformUploadsSkipped\": " << counterTotals.uniformUploadsSkipped / count << ",\n";
+        out << "    \"visibleBodies\": " << counterTotals.visibleBodies / count << "\n";
+        out << "  }\n}\n";
+        return bool(out);
+    }
+
+    void printSummary() const
+    {
+        std::vector<double> sorted(frameTimes);
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << "Benchmark: " << sorted.size() << " frames, p50 " << percentile(sorted, 0.5) << " ms, p90 "
+            << percentile(sorted, 0.9) << " ms, p99 " << percentile(sorted, 0.99) << " ms" << std::endl;
+    }
+
+private:
+    int warmupFrames;
+    int measuredFrames;
+    double timestep;
+    int frame = 0;      // frames since the scene was ready, the current one included
+    std::chrono::steady_clock::time_point frameStart;
+    std::vector<double> frameTimes;
+    BenchmarkCounters counterTotals;
+
+    // nearest rank percentile of sorted values
+    static double percentile(const std::vector<double>& sorted, double fraction)
+    {
+        if (sorted.empty())
+            return 0.0;
+        size_t rank = size_t(std::ceil(fraction * sorted.size()));
+        return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+    }
+
+    static std::string summaryJson(const Profiler::Summary& summary)
+    {
+        std::ostringstream text;
+        text.setf(std::ios::fixed);
+        text.precision(4);
+        text << "{ \"avg\": " << summary.average << ", \"p50\": " << summary.p50 << ", \"p99\": " << summary.p99 << " }";
+        return text.str();
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// One step of a sweep benchmark, timed in the render loop: after the warmup frames the frame times of the
+// measured frames are summed up, and when the last one is in their average is the step's result.
+class FrameSweep
+{
+public:
+    FrameSweep(int warmupFrames, int measuredFrames)
+        : warmupFrames(warmupFrames), measuredFrames(measuredFrames)
+    {
+    }
+
+    // true if the frame about to be added is measured
+    bool measuring() const
+    {
+        return frames >= warmupFrames;
+    }
+
+    // adds a frame's time. Returns true when it completes the step; the next frame starts a new one.
+    bool addFrame(double seconds)
+    {
+        if (measuring())
+            measuredSeconds += seconds;
+        if (++frames < warmupFrames + measuredFrames)
+            return false;
+        stepMs = 1000.0 * measuredSeconds / measuredFrames;
+        frames = 0;
+        measuredSeconds = 0.0;
+        return true;
+    }
+
+    // average frame time of the last completed step
+    double averageMs() const
+    {
+        return stepMs;
+    }
+
+    int measured() const
+    {
+        return measuredFrames;
+    }
+
+private:
+    int warmupFrames;
+    int measuredFrames;
+    int frames = 0;
+    double measuredSeconds = 0.0;
+    double stepMs = 0.0;
+};
+
+// Stress scene: a belt of asteroids, timed at each size and then doubled, from 1024 instances up to the most.
+// The frame time added is the previous frame's, drawn with the current count.
+class InstanceSweep
+{
+public:
+    explicit InstanceSweep(size_t maxInstances)
+        : maxInstances(maxInstances), instances(std::min<size_t>(maxInstances, 1024))
+    {
+    }
+
+    // instances to draw this frame
+    size_t count() const
+    {
+        return instances;
+    }
+
+    // returns true once the step with every instance is timed
+    bool addFrame(double seconds)
+    {
+        if (!finished && timer.addFrame(seconds))
+        {
+            std::cout << "Stress: " << instances << " instances, " << timer.averageMs() << " ms per frame" << std::endl;
+            finished = instances >= maxInstances;
+            instances = std::min(instances * 2, maxInstances);
+        }
+        return finished;
+    }
+
+private:
+    FrameSweep timer{ 30, 240 };
+    size_t maxInstances;
+    size_t instances;
+    bool finished = false;
+};
+
+// Light benchmark: one light first, then the active lights doubled after each step up to every light.
+class LightSweep
+{
+public:
+    explicit LightSweep(size_t maxLights)
+        : maxLights(maxLights), lights(std::min<size_t>(maxLights, 1))
+    {
+    }
+
+    // lights to bin and shade this frame
+    size_t activeCount() const
+    {
+        return lights;
+    }
+
+    // adds a frame with the binning statistics of its lights. Returns true once the step with every light is timed.
+    bool addFrame(double seconds, const LightClusters::Stats& stats)
+    {
+        if (timer.measuring())
+            binningMs += stats.binningMs;
+        if (!timer.addFrame(seconds))
+            return false;
+
+        std::cout << "Lights: " << lights << " (" << stats.lights << " visible), " << timer.averageMs() << " ms per frame, binning "
+            << binningMs / timer.measured() << " ms, " << stats.indices << " light indices" << std::endl;
+        bool finished = lights >= maxLights;
+        lights = std::min(lights * 2, maxLights);
+        binningMs = 0.0;
+        return finished;
+    }
+
+private:
+    FrameSweep timer{ 30, 120 };
+    size_t maxLights;
+    size_t lights;
+    double binningMs = 0.0;
+};
+
+// Shadow filter benchmark: the full 20 tap kernel first as the reference, then every cheaper setting.
+class ShadowFilterSweep
+{
+public:
+    // sets the filter to the setting of the current step
+    void apply(ShadowFilter& filter) const
+    {
+        filter.setQuality(steps[step].quality);
+        filter.setEarlyOut(steps[step].earlyOut);
+    }
+
+    // adds a frame drawn with the filter, moving it on to the next setting after each step. Returns true once
+    // every setting is timed.
+    bool addFrame(double seconds, ShadowFilter& filter)
+    {
+        if (step == STEP_COUNT)
+            return true;
+        if (!timer.addFrame(seconds))
+            return false;
+
+        double frameMs = timer.averageMs();
+        if (step == 0)
+            referenceMs = frameMs;
+        std::cout << "Shadow filter: " << ShadowFilter::taps(filter.quality()) << " taps, early-out "
+            << (filter.earlyOut() ? "on" : "off") << ", " << frameMs << " ms per frame, "
+            << frameMs - referenceMs << " ms against 20 taps" << std::endl;
+        if (++step == STEP_COUNT)
+            return true;
+        apply(filter);
+        return false;
+    }
+
+private:
+    struct Step { ShadowQuality quality; bool earlyOut; };
+    static const int STEP_COUNT = 6;
+    const Step steps[STEP_COUNT] = {
+        { SHADOW_QUALITY_HIGH, false }, { SHADOW_QUALITY_HIGH, true }, { SHADOW_QUALITY_MEDIUM, false },
+        { SHADOW_QUALITY_MEDIUM, true }, { SHADOW_QUALITY_LOW, false }, { SHADOW_QUALITY_HARD, false }
+    };
+
+    FrameSweep timer{ 30, 240 };
+    int step = 0;
+    double referenceMs = 0.0;
+};
+#endif
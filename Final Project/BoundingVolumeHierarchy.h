@@ -0,0 +1,251 @@
+#ifndef BOUNDING_VOLUME_HIERARCHY_H
+#define BOUNDING_VOLUME_HIERARCHY_H
+
+#include "Bounds.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Dynamic AABB tree over world space bounds, for culling.
+// Every leaf holds one item (an index chosen by the caller). Leaves are inserted next to the sibling
+// that grows the tree's surface area the least, and moving objects only refit the boxes on the path to
+// the root, so the tree is built once and kept up to date with setBounds() + refit() each frame.
+class BoundingVolumeHierarchy
+{
+public:
+    static constexpr uint32_t NO_NODE = 0xFFFFFFFFu;
+
+    struct CullStats {
+        uint32_t visible = 0;       // items that passed the test
+        uint32_t culled = 0;        // items rejected, alone or together with a whole subtree
+        uint32_t nodesTested = 0;   // boxes tested against the frustum
+    };
+
+    // adds an item and returns its leaf, which identifies it in setBounds() and remove()
+    uint32_t insert(const AABB& bounds, uint32_t item)
+    {
+        uint32_t leaf = allocateNode();
+        nodes[leaf].bounds = bounds;
+        nodes[leaf].item = item;
+        insertLeaf(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    void remove(uint32_t leaf)
+    {
+        removeLeaf(leaf);
+        freeNode(leaf);
+        leafCount--;
+    }
+
+    // moves a leaf; the boxes above it are fixed up by the next refit()
+    void setBounds(uint32_t leaf, const AABB& bounds)
+    {
+        Node& node = nodes[leaf];
+        if (node.bounds.min == bounds.min && node.bounds.max == bounds.max)
+            return;
+        node.bounds = bounds;
+        if (!node.moved)
+        {
+            node.moved = true;
+            movedLeaves.push_back(leaf);
+        }
+    }
+
+    const AABB& bounds(uint32_t leaf) const
+    {
+        return nodes[leaf].bounds;
+    }
+
+    uint32_t item(uint32_t leaf) const
+    {
+        return nodes[leaf].item;
+    }
+
+    size_t size() const
+    {
+        return leafCount;
+    }
+
+    // recomputes the boxes of the ancestors of every leaf moved since the last refit
+    void refit()
+    {
+        for (uint32_t leaf : movedLeaves)
+        {
+            nodes[leaf].moved = false;
+            for (uint32_t node = nodes[leaf].parent; node != NO_NODE; node = nodes[node].parent)
+                nodes[node].bounds = AABB::merge(nodes[nodes[node].left].bounds, nodes[nodes[node].right].bounds);
+        }
+        movedLeaves.clear();
+    }
+
+    // appends the items whose boxes intersect the frustum; subtrees outside it are skipped as a whole
+    void query(const Frustum& frustum, std::vector<uint32_t>& items)
+    {
+        stats = CullStats();
+        if (root == NO_NODE)
+            return;
+
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            uint32_t index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            stats.nodesTested++;
+            if (!frustum.intersects(node.bounds))
+                continue;
+
+            if (node.isLeaf())
+            {
+                items.push_back(node.item);
+                stats.visible++;
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+        stats.culled = uint32_t(leafCount) - stats.visible;
+    }
+
+    // counts of the last query()
+    CullStats lastQueryStats() const
+    {
+        return stats;
+    }
+
+private:
+    struct Node {
+        AABB bounds;
+        uint32_t parent = NO_NODE;
+        uint32_t left = NO_NODE;    // children of an inner node; NO_NODE for a leaf
+        uint32_t right = NO_NODE;
+        uint32_t item = 0;
+        bool moved = false;
+
+        bool isLeaf() const
+        {
+            return left == NO_NODE;
+        }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    std::vector<uint32_t> movedLeaves;
+    std::vector<uint32_t> stack;    // traversal stack, reused between queries
+    uint32_t root = NO_NODE;
+    size_t leafCount = 0;
+    CullStats stats;
+
+    uint32_t allocateNode()
+    {
+        if (freeNodes.empty())
+        {
+            nodes.push_back(Node());
+            return uint32_t(nodes.size() - 1);
+        }
+        uint32_t index = freeNodes.back();
+        freeNodes.pop_back();
+        nodes[index] = Node();
+        return index;
+    }
+
+    void freeNode(uint32_t index)
+    {
+        freeNodes.push_back(index);
+    }
+
+    void insertLeaf(uint32_t leaf)
+    {
+        if (root == NO_NODE)
+        {
+            root = leaf;
+            return;
+        }
+
+        // walk down to the sibling with the lowest cost: the area of the new parent plus the growth it
+        // causes in every ancestor on the way
+        AABB box = nodes[leaf].bounds;     // a copy, allocateNode() may move the nodes
+        uint32_t sibling = root;
+        while (!nodes[sibling].isLeaf())
+        {
+            const Node& node = nodes[sibling];
+            float area = node.bounds.area();
+            float combinedArea = AABB::merge(node.bounds, box).area();
+            // cost of making a new parent for this node and the leaf, and the cost pushed down to the children
+            float cost = 2.0f * combinedArea;
+            float inheritance = 2.0f * (combinedArea - area);
+
+            float leftCost = childCost(node.left, box) + inheritance;
+            float rightCost = childCost(node.right, box) + inheritance;
+            if (cost < leftCost && cost < rightCost)
+                break;
+            sibling = leftCost < rightCost ? node.left : node.right;
+        }
+
+        uint32_t oldParent = nodes[sibling].parent;
+        uint32_t newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].bounds = AABB::merge(box, nodes[sibling].bounds);
+        nodes[newParent].left = sibling;
+        nodes[newParent].right = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        if (oldParent == NO_NODE)
+            root = newParent;
+        else if (nodes[oldParent].left == sibling)
+            nodes[oldParent].left = newParent;
+        else
+            nodes[oldParent].right = newParent;
+
+        for (uint32_t node = oldParent; node != NO_NODE; node = nodes[node].parent)
+            nodes[node].bounds = AABB::merge(nodes[nodes[node].left].bounds, nodes[nodes[node].right].bounds);
+    }
+
+    float childCost(uint32_t child, const AABB& box) const
+    {
+        const Node& node = nodes[child];
+        float combinedArea = AABB::merge(node.bounds, box).area();
+        if (node.isLeaf())
+            return combinedArea;
+        return combinedArea - node.bounds.area();
+    }
+
+    void removeLeaf(uint32_t leaf)
+    {
+        if (nodes[leaf].moved)
+        {
+            nodes[leaf].moved = false;
+            movedLeaves.erase(std::find(movedLeaves.begin(), movedLeaves.end(), leaf));
+        }
+        if (leaf == root)
+        {
+            root = NO_NODE;
+            return;
+        }
+
+        // the sibling takes the parent's place
+        uint32_t parent = nodes[leaf].parent;
+        uint32_t grandParent = nodes[parent].parent;
+        uint32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+        nodes[sibling].parent = grandParent;
+        if (grandParent == NO_NODE)
+            root = sibling;
+        else
+        {
+            if (nodes[grandParent].left == parent)
+                nodes[grandParent].left = sibling;
+            else
+                nodes[grandParent].right = sibling;
+            for (uint32_t node = grandParent; node != NO_NODE; node = nodes[node].parent)
+                nodes[node].bounds = AABB::merge(nodes[nodes[node].left].bounds, nodes[nodes[node].right].bounds);
+        }
+        freeNode(parent);
+    }
+};
+#endif
@@ -0,0 +1,160 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// axis aligned bounding box. A default constructed box is empty (min > max) and grows with extend().
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    AABB() = default;
+    AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool empty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void extend(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void extend(const AABB& box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    glm::vec3 center() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    // half the size along each axis
+    glm::vec3 extents() const
+    {
+        return (max - min) * 0.5f;
+    }
+
+    // half the surface area, the cost measure of the BVH
+    float area() const
+    {
+        glm::vec3 size = max - min;
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    bool contains(const AABB& box) const
+    {
+        return min.x <= box.min.x && min.y <= box.min.y && min.z <= box.min.z
+            && max.x >= box.max.x && max.y >= box.max.y && max.z >= box.max.z;
+    }
+
+    // the box around this box after an affine transform (Arvo's method: the extents are projected
+    // onto the absolute values of the rotation/scale part)
+    AABB transformed(const glm::mat4& transform) const
+    {
+        if (empty())
+            return AABB();
+        glm::vec3 center = glm::vec3(transform * glm::vec4(this->center(), 1.0f));
+        glm::vec3 half = extents();
+        glm::vec3 extent(0.0f);
+        for (int axis = 0; axis < 3; axis++)
+            extent += glm::abs(glm::vec3(transform[axis])) * half[axis];
+        return AABB(center - extent, center + extent);
+    }
+
+    static AABB merge(const AABB& a, const AABB& b)
+    {
+        return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+    }
+};
+
+struct BoundingSphere {
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+
+    // the sphere around a box; a little looser than the tightest sphere but free to compute
+    static BoundingSphere fromAABB(const AABB& box)
+    {
+        BoundingSphere sphere;
+        if (box.empty())
+            return sphere;
+        sphere.center = box.center();
+        sphere.radius = glm::length(box.extents());
+        return sphere;
+    }
+};
+
+// the six planes of a view frustum, pointing inwards, extracted from a view projection matrix
+// (Gribb/Hartmann). Works for any OpenGL style projection, so also for the shadow cube faces.
+class Frustum
+{
+public:
+    enum Plane {
+        PLANE_LEFT,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+        PLANE_COUNT
+    };
+
+    glm::vec4 planes[PLANE_COUNT];
+
+    Frustum() = default;
+
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        // glm is column major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+        planes[PLANE_LEFT] = rows[3] + rows[0];
+        planes[PLANE_RIGHT] = rows[3] - rows[0];
+        planes[PLANE_BOTTOM] = rows[3] + rows[1];
+        planes[PLANE_TOP] = rows[3] - rows[1];
+        planes[PLANE_NEAR] = rows[3] + rows[2];
+        planes[PLANE_FAR] = rows[3] - rows[2];
+        for (glm::vec4& plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    // false only if the box is completely outside one of the planes. Boxes near a frustum corner
+    // may be reported visible although they are not, which only costs a draw.
+    bool intersects(const AABB& box) const
+    {
+        if (box.empty())
+            return false;
+        glm::vec3 center = box.center();
+        glm::vec3 extent = box.extents();
+        for (const glm::vec4& plane : planes)
+        {
+            glm::vec3 normal(plane);
+            float distance = glm::dot(normal, center) + plane.w;
+            float radius = glm::dot(glm::abs(normal), extent);
+            if (distance + radius < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool intersects(const BoundingSphere& sphere) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,630 @@
+#ifndef COMPONENT_BENCHMARKS_H
+#define COMPONENT_BENCHMARKS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "AppOptions.h"
+#include "AsteroidBelt.h"
+#include "GpuCulling.h"
+#include "InstanceBuffer.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "Model.h"
+#include "OrbitEngine.h"
+#include "ProgramCache.h"
+#include "SceneSetup.h"
+#include "ShaderVariants.h"
+#include "ShadowFaceCache.h"
+#include "ShadowFilter.h"
+#include "ShadowPass.h"
+#include "TextureContainer.h"
+#include "UniformBlocks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Benchmarks of single parts of the renderer, each of which runs instead of the scene and prints its results
+// as CSV. They need a current context but no window.
+
+// Loads every model texture through the stb_image path and through its baked texture container and prints the
+// load time and texture memory of both.
+inline void CompareTextureLoading()
+{
+    std::vector<std::string> images;
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it("Models", ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::string extension = it->path().extension().string();
+        if (extension == ".jpg" || extension == ".jpeg" || extension == ".png")
+            images.push_back(it->path().generic_string());
+    }
+    std::sort(images.begin(), images.end());
+
+    // stb memory is estimated for a full mip chain, see TextureContainer::mippedTextureBytes
+    std::cout << "texture, stb ms, stb KiB, container format, container ms, container KiB" << std::endl;
+    double stbTotalMs = 0.0, containerTotalMs = 0.0;
+    size_t stbTotalBytes = 0, containerTotalBytes = 0;
+    for (const std::string& image : images)
+    {
+        GLuint textures[2];
+        glGenTextures(2, textures);
+
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        int width, height, components;
+        unsigned char* data = stbi_load(image.c_str(), &width, &height, &components, 0);
+        if (data == nullptr)
+        {
+            glDeleteTextures(2, textures);
+            continue;
+        }
+        GLenum format = components == 1 ? GL_RED : (components == 3 ? GL_RGB : GL_RGBA);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+        stbi_image_free(data);
+        double stbMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        size_t stbBytes = TextureContainer::mippedTextureBytes(width, height, components);
+        stbTotalMs += stbMs;
+        stbTotalBytes += stbBytes;
+
+        std::cout << image << ", " << stbMs << ", " << stbBytes / 1024 << ", ";
+
+        static const char* formatNames[] = { "R8", "RGB8", "RGBA8", "BC1", "BC3", "BC5" };
+        start = std::chrono::steady_clock::now();
+        TextureContainer::BakedTexture baked;
+        if (TextureContainer::read(image, baked) && TextureContainer::upload(textures[1], baked))
+        {
+            glFinish();
+            double containerMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            size_t containerBytes = TextureContainer::gpuBytes(baked);
+            containerTotalMs += containerMs;
+            containerTotalBytes += containerBytes;
+            std::cout << formatNames[baked.format] << ", " << containerMs << ", " << containerBytes / 1024 << std::endl;
+        }
+        else
+        {
+            std::cout << "not baked (run with --bake), -, -" << std::endl;
+        }
+
+        glDeleteTextures(2, textures);
+    }
+    std::cout << "total, " << stbTotalMs << ", " << stbTotalBytes / 1024 << ", -, " << containerTotalMs << ", " << containerTotalBytes / 1024 << std::endl;
+}
+
+// Renders the Moon into a shadow cube map with every supported shadow back-end and prints the GPU time per frame
+// of each, once with the Moon drawn into all six faces and once into the faces it overlaps.
+inline void BenchmarkShadowBackends()
+{
+    // The Moon has the heaviest geometry of the models
+    Model moon("Models/Moon/scene.gltf");
+    if (!moon.ready)
+    {
+        std::cerr << "Could not load the Moon for the shadow benchmark" << std::endl;
+        return;
+    }
+
+    // Same cube map as the shadow pass of the scene
+    const GLuint shadowSize = 1024;
+    GLuint cubeMap;
+    glGenTextures(1, &cubeMap);
+    GLState::instance().bindTextureForUpdate(GL_TEXTURE_CUBE_MAP, cubeMap);
+    for (unsigned int i = 0; i < 6; ++i)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, shadowSize, shadowSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glViewport(0, 0, shadowSize, shadowSize);
+    glEnable(GL_DEPTH_TEST);
+
+    // The Moon next to the light, off the axes so it overlaps more than one face
+    glm::vec3 lightPos(0.0f);
+    float farPlane = 50.0f;
+    glm::mat4 faceMatrices[ShadowPass::FACE_COUNT];
+    ShadowPass::faceMatrices(lightPos, 1.0f, farPlane, faceMatrices);
+    glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 1.5f, 2.0f));
+    modelMatrix = glm::scale(modelMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
+    ShadowFaceCache faceCuller;
+    faceCuller.beginFrame(faceMatrices, lightPos, farPlane);
+    uint8_t overlapped = faceCuller.addCaster(0, moon.bounds.transformed(modelMatrix), modelMatrix);
+
+    // The back-ends read the faces from the shadow block, written every frame like the scene does
+    UniformBlocks uniformBlocks;
+    ShadowData shadowData;
+    std::copy(faceMatrices, faceMatrices + ShadowPass::FACE_COUNT, shadowData.shadowMatrices);
+    shadowData.lightPos = lightPos;
+    shadowData.farPlane = farPlane;
+
+    const int warmupFrames = 10;
+    const int measuredFrames = 200;
+    GLuint query;
+    glGenQueries(1, &query);
+    std::cout << "back-end, faces, GPU ms per frame, draw calls per frame" << std::endl;
+    for (int backend = 0; backend < SHADOW_BACKEND_COUNT; backend++)
+    {
+        if (!ShadowPass::supported(ShadowBackend(backend)))
+        {
+            std::cout << ShadowPass::name(ShadowBackend(backend)) << ", not supported, -, -" << std::endl;
+            continue;
+        }
+
+        ShadowPass pass((ShadowBackend(backend)));
+        for (uint8_t faces : { ShadowFaceCache::ALL_FACES, overlapped })
+        {
+            GLuint64 totalNs = 0;
+            for (int frame = 0; frame < warmupFrames + measuredFrames; frame++)
+            {
+                uniformBlocks.update(FrameData(), LightData(), shadowData);
+                pass.begin();
+                pass.addCaster(moon, modelMatrix, faces);
+                if (frame >= warmupFrames)
+                    glBeginQuery(GL_TIME_ELAPSED, query);
+                pass.render(cubeMap, ShadowFaceCache::ALL_FACES);
+                if (frame >= warmupFrames)
+                {
+                    glEndQuery(GL_TIME_ELAPSED);
+                    GLuint64 ns = 0;
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+                    totalNs += ns;
+                }
+            }
+            int faceCount = 0;
+            for (int face = 0; face < ShadowPass::FACE_COUNT; face++)
+                faceCount += (faces >> face) & 1;
+            std::cout << ShadowPass::name(ShadowBackend(backend)) << ", " << faceCount << ", "
+                << double(totalNs) / measuredFrames / 1e6 << ", " << pass.lastDrawCalls() << std::endl;
+        }
+        pass.clean();
+    }
+
+    glDeleteQueries(1, &query);
+    uniformBlocks.clean();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    GLState::instance().forgetTexture(cubeMap);
+    glDeleteTextures(1, &cubeMap);
+}
+
+// Propagates Kepler orbits with the scalar and the AVX2 kernel of the OrbitEngine, on one thread and on every
+// core, for 1024 bodies doubling up to maxBodies, and prints the bodies per millisecond of each into memory and
+// into a mapped instance buffer.
+inline void BenchmarkOrbits(size_t maxBodies)
+{
+    // a belt with some eccentric orbits, so the solver takes the Newton steps of a general population
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    OrbitEngine orbits;
+    orbits.reserve(maxBodies);
+    for (size_t i = 0; i < maxBodies; i++)
+    {
+        OrbitalElements elements;
+        elements.semiMajorAxis = 7.0f + 2.0f * unit(random);
+        elements.eccentricity = 0.5f * unit(random);
+        elements.inclination = 0.3f * unit(random);
+        elements.ascendingNode = glm::two_pi<float>() * unit(random);
+        elements.argumentOfPeriapsis = glm::two_pi<float>() * unit(random);
+        elements.meanAnomaly = glm::two_pi<float>() * unit(random);
+        elements.meanMotion = 0.6f / (elements.semiMajorAxis * std::sqrt(elements.semiMajorAxis));
+        elements.scale = 0.02f;
+        elements.spinSpeed = 2.0f * unit(random);
+        elements.spinPhase = 0.0f;
+        orbits.add(elements);
+    }
+    std::vector<glm::mat4> transforms(maxBodies);
+    InstanceBuffer instances;
+
+    // repeated until each measurement covers 100 ms
+    auto bodiesPerMs = [&](size_t count, bool mapped)
+    {
+        int runs = 0;
+        double elapsedMs = 0.0;
+        while (elapsedMs < 100.0 || runs < 3)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (mapped)
+            {
+                glm::mat4* out = instances.map(GLsizei(count));
+                if (out != nullptr)
+                    orbits.propagate(0.1f * runs, count, out);
+                instances.unmap();
+            }
+            else
+                orbits.propagate(0.1f * runs, count, transforms.data());
+            elapsedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            runs++;
+        }
+        return double(count) * runs / elapsedMs;
+    };
+
+    unsigned int allThreads = JobSystem::instance().threadCount();
+    std::cout << "Orbits: " << orbits.newtonIterations() << " Newton steps, AVX2 " << (OrbitEngine::avx2Supported() ? "supported" : "not supported")
+        << ", " << allThreads << " threads" << std::endl;
+    std::cout << "bodies, kernel, threads, bodies per ms into memory, bodies per ms into a mapped buffer" << std::endl;
+    for (size_t count = std::min<size_t>(1024, maxBodies); ; count = std::min(count * 2, maxBodies))
+    {
+        for (bool avx2 : { false, true })
+        {
+            if (avx2 && !OrbitEngine::avx2Supported())
+                continue;
+            orbits.setUseAvx2(avx2);
+            for (unsigned int threads : { 1u, allThreads })
+            {
+                orbits.setActiveThreads(threads);
+                std::cout << count << ", " << (avx2 ? "avx2" : "scalar") << ", " << threads << ", "
+                    << bodiesPerMs(count, false) << ", " << bodiesPerMs(count, true) << std::endl;
+                if (allThreads == 1)
+                    break;
+            }
+        }
+        if (count == maxBodies)
+            break;
+    }
+    instances.clean();
+}
+
+// Runs the JobSystem workloads of a frame (the orbits of a million body belt, binning the most lights the
+// clusters take) and a tree of small dependent jobs with 1 up to maxThreads threads (the calling thread
+// included), and prints the time and speedup of each and the jobs stolen.
+inline void BenchmarkJobScaling(unsigned int maxThreads)
+{
+    JobSystem& jobs = JobSystem::instance();
+
+    // a frame's parallel work at its largest: a million asteroids, and the most lights the clusters take
+    AsteroidBelt belt(1 << 20, 7.0f, 9.0f);
+    std::vector<glm::mat4> transforms(belt.size());
+    LightClusters clusters;
+    std::vector<PointLightSource> lights;
+    ScatterLights(LightClusters::MAX_LIGHTS, lights);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1366.0f / 768.0f, 0.1f, 100.0f);
+
+    // 64 jobs that each queue 64 small jobs, and a last job that runs once all of them are done
+    std::atomic<uint64_t> checksum{ 0 };
+    auto jobTree = [&]()
+    {
+        JobCounter leaves, total;
+        for (int branch = 0; branch < 64; branch++)
+        {
+            jobs.run([&jobs, &leaves, &checksum, branch]() {
+                for (int leaf = 0; leaf < 64; leaf++)
+                {
+                    jobs.run([&checksum, branch, leaf]() {
+                        float value = float(branch * 64 + leaf);
+                        for (int i = 0; i < 2000; i++)
+                            value = std::sqrt(value * value + 1.0f);
+                        checksum.fetch_add(uint64_t(value), std::memory_order_relaxed);
+                    }, &leaves);
+                }
+            }, &leaves);
+        }
+        jobs.runAfter(leaves, [&checksum]() { checksum.fetch_add(1, std::memory_order_relaxed); }, &total);
+        jobs.wait(total);
+    };
+
+    // milliseconds per run, after one warmup run
+    auto averageMs = [](const std::function<void()>& work)
+    {
+        const int runs = 20;
+        work();
+        auto start = std::chrono::steady_clock::now();
+        for (int run = 0; run < runs; run++)
+            work();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+    };
+
+    std::cout << "threads, orbits ms, light binning ms, job tree ms, orbits speedup, light binning speedup, job tree speedup, jobs stolen" << std::endl;
+    double baseline[3] = { 0.0, 0.0, 0.0 };
+    for (unsigned int threads = 1; threads <= maxThreads; threads++)
+    {
+        jobs.start(threads - 1);
+        JobSystem::Stats before = jobs.getStats();
+        float time = 0.0f;
+        double ms[3];
+        ms[0] = averageMs([&]() { belt.transforms(time += 0.01f, belt.size(), transforms.data()); });
+        ms[1] = averageMs([&]() { clusters.update(lights, view, projection, 1366.0f, 768.0f); });
+        ms[2] = averageMs(jobTree);
+        if (threads == 1)
+            std::copy(ms, ms + 3, baseline);
+        std::cout << threads << ", " << ms[0] << ", " << ms[1] << ", " << ms[2] << ", " << baseline[0] / ms[0] << ", "
+            << baseline[1] / ms[1] << ", " << baseline[2] / ms[2] << ", " << jobs.getStats().steals - before.steals << std::endl;
+    }
+    clusters.clean();
+}
+
+// Builds every shader program of the scene, with the given shadow filter, and of the supported shadow
+// back-ends in one batch, first with an empty program cache and then with the binaries that run stored, and
+// prints the time of each.
+inline void BenchmarkShaderStartup(uint32_t shadowFeatures)
+{
+    // a folder of its own, emptied for the cold runs, so the program cache of the scene stays as it is
+    ProgramCache::enabled() = true;
+    ProgramCache::directory() = "ShaderCache/benchmark";
+    if (!ProgramCache::active())
+        std::cout << "The driver has no program binary formats, so the program cache stays empty" << std::endl;
+    std::cout << "Parallel shader compile: " << (ShaderBatch::parallelCompile() ? "yes" : "no") << std::endl;
+
+    // every program the scene can use, built the way main() builds them
+    auto buildAll = [shadowFeatures](size_t& programs, size_t& cached)
+    {
+        ShaderBatch batch;
+        std::vector<std::unique_ptr<Shader>> shaders;
+        ShaderVariants lit("main.vsh", "main.fsh");
+        PrepareLitShaders(lit, shadowFeatures, true, false, &batch);
+        shaders.emplace_back(new Shader("light.vsh", "light.fsh", &batch));
+        std::vector<std::unique_ptr<ShadowPass>> passes;
+        for (int backend = 0; backend < SHADOW_BACKEND_COUNT; backend++)
+        {
+            if (ShadowPass::supported(ShadowBackend(backend)))
+                passes.emplace_back(new ShadowPass(ShadowBackend(backend), &batch));
+        }
+        batch.finish();
+        programs = batch.programCount();
+        cached = batch.cachedCount();
+        lit.clean();
+        for (std::unique_ptr<Shader>& shader : shaders)
+            shader->clean();
+        for (std::unique_ptr<ShadowPass>& pass : passes)
+            pass->clean();
+        return batch.milliseconds();
+    };
+
+    // the driver may keep a cache of its own (Mesa's can be turned off with MESA_SHADER_CACHE_DISABLE=true),
+    // which makes the cold runs after the first one faster
+    std::cout << "run, cold cache ms, warm cache ms, programs, loaded from the cache" << std::endl;
+    for (int run = 1; run <= 3; run++)
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(ProgramCache::directory(), ec);
+        size_t programs = 0, cached = 0;
+        double cold = buildAll(programs, cached);
+        double warm = buildAll(programs, cached);
+        std::cout << run << ", " << cold << ", " << warm << ", " << programs << ", " << cached << std::endl;
+    }
+}
+
+// Draws an asteroid belt of Moon instances into the shadow cube map and the main pass, once on the CPU path
+// (instanced draws of every instance at one level of detail, with the given shadow back-end) and once on the
+// GPU-driven path (compute culling and multi-draw indirect, see GpuCulling), for 10k, 25k, 50k and 100k
+// instances up to maxInstances, and prints the CPU and GPU time, the draw calls and the instances drawn per
+// frame of each. The errors are those the levels of detail may have, in pixels and in shadow map texels.
+inline void BenchmarkGpuCulling(size_t maxInstances, ShadowBackend shadowBackend, float lodPixelError, float shadowLodTexelError, uint32_t shadowFeatures)
+{
+    if (!GpuCulling::supported())
+    {
+        std::cout << "GPU culling needs OpenGL 4.3, the context has " << glGetString(GL_VERSION) << std::endl;
+        return;
+    }
+    maxInstances = std::min(maxInstances, size_t(GpuCulling::maxInstances()));
+    Model moon("Models/Moon/scene.gltf");
+    if (!moon.ready)
+    {
+        std::cerr << "Could not load the Moon for the GPU culling benchmark" << std::endl;
+        return;
+    }
+
+    // The scene's passes offscreen: the shadow cube map around the Sun and a window sized main pass
+    const GLuint shadowSize = 1024;
+    const GLsizei width = 1366, height = 768;
+    GLuint cubeMap;
+    glGenTextures(1, &cubeMap);
+    GLState::instance().bindTextureForUpdate(GL_TEXTURE_CUBE_MAP, cubeMap);
+    for (unsigned int i = 0; i < 6; ++i)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, shadowSize, shadowSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    ShadowFilter::configure(cubeMap);
+    GLuint shadowFbo, mainFbo, renderbuffers[2];
+    glGenFramebuffers(1, &shadowFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glGenFramebuffers(1, &mainFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, mainFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    glEnable(GL_DEPTH_TEST);
+
+    // The default camera of the scene, which sees part of the belt, and the Sun's light
+    glm::vec3 eye(0.0f, 2.0f, 5.0f);
+    glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(45.0f, float(width) / float(height), 0.1f, 150.0f);
+    glm::vec3 lightPos(0.0f);
+    float farPlane = 50.0f;
+    glm::mat4 faceMatrices[ShadowPass::FACE_COUNT];
+    ShadowPass::faceMatrices(lightPos, 1.0f, farPlane, faceMatrices);
+
+    FrameData frameData;
+    frameData.viewMatrix = view;
+    frameData.projectionMatrix = projection;
+    frameData.viewProjectionMatrix = projection * view;
+    frameData.eyePos = eye;
+    LightData lightData;
+    SetPointLight(lightData);
+    LightClusters lightClusters;
+    lightClusters.update(std::vector<PointLightSource>(), view, projection, float(width), float(height));
+    lightClusters.writeLookup(lightData);
+    ShadowData shadowData;
+    std::copy(faceMatrices, faceMatrices + ShadowPass::FACE_COUNT, shadowData.shadowMatrices);
+    shadowData.lightPos = lightPos;
+    shadowData.farPlane = farPlane;
+    UniformBlocks uniformBlocks;
+
+    ShaderBatch batch;
+    ShaderVariants lit("main.vsh", "main.fsh");
+    PrepareLitShaders(lit, shadowFeatures, true, true, &batch);
+    ShadowPass shadowPass(shadowBackend, &batch, true);
+    GpuCulling culling(&batch);
+    batch.finish();
+    ShaderSetup setupBelt = [&](Shader& shader) {
+        lightClusters.bind(shader);
+        Shader::SamplerBinding shadowMapSampler;
+        if (shader.findSampler(shadowMapUniform, shadowMapSampler))
+            GLState::instance().bindTexture(shadowMapSampler.unit, GL_TEXTURE_CUBE_MAP, cubeMap);
+    };
+
+    CullView views[GpuCulling::VIEW_COUNT];
+    views[GpuCulling::VIEW_CAMERA] = { Frustum(projection * view), eye, GpuCulling::detailFactor(projection[1][1], float(height), lodPixelError) };
+    for (int face = 0; face < ShadowPass::FACE_COUNT; face++)
+        views[GpuCulling::VIEW_FIRST_FACE + face] = { Frustum(faceMatrices[face]), lightPos, GpuCulling::detailFactor(1.0f, float(shadowSize), shadowLodTexelError) };
+
+    std::vector<size_t> steps;
+    for (size_t count : { 10000, 25000, 50000, 100000 })
+    {
+        if (count <= maxInstances)
+            steps.push_back(count);
+    }
+    if (steps.empty() || steps.back() < maxInstances)
+        steps.push_back(maxInstances);
+
+    const int warmupFrames = 10;
+    const int measuredFrames = 100;
+    GLuint query;
+    glGenQueries(1, &query);
+    std::cout << "Shadow back-end of the CPU path: " << ShadowPass::name(shadowPass.backend()) << std::endl;
+    std::cout << "instances, path, CPU ms per frame, GPU ms per frame, draw calls per frame, instances drawn per frame" << std::endl;
+    for (size_t count : steps)
+    {
+        // the belt at one moment, so both paths draw the same instances
+        AsteroidBelt belt(count, 7.0f, 9.0f);
+        InstanceBuffer instances;
+        glm::vec3 probes[2] = { eye, lightPos };
+        float nearest[2] = { FLT_MAX, FLT_MAX };
+        glm::mat4* mapped = instances.map(GLsizei(count));
+        if (mapped != nullptr)
+            belt.transforms(0.0f, count, mapped, probes, nearest, 2);
+        instances.unmap();
+        ShadowFaceCache faceCuller;
+        faceCuller.beginFrame(faceMatrices, lightPos, farPlane);
+        uint8_t beltFaces = faceCuller.addCaster(0, belt.bounds(moon.sphere.radius), glm::mat4(1.0f));
+
+        for (bool gpu : { false, true })
+        {
+            double cpuMs = 0.0;
+            GLuint64 totalNs = 0;
+            uint64_t drawCalls = 0;
+            GLuint visible[GpuCulling::VIEW_COUNT] = {};
+            for (int frame = 0; frame < warmupFrames + measuredFrames; frame++)
+            {
+                bool measured = frame >= warmupFrames;
+                LevelOfDetail::instance().beginFrame();
+                if (measured)
+                    glBeginQuery(GL_TIME_ELAPSED, query);
+                auto start = std::chrono::steady_clock::now();
+
+                uniformBlocks.update(frameData, lightData, shadowData);
+                shadowPass.begin();
+                if (gpu)
+                {
+                    culling.cull(moon.meshes, instances, views, uint8_t(1u | (beltFaces << GpuCulling::VIEW_FIRST_FACE)));
+                    shadowPass.addCaster(moon, culling, beltFaces);
+                }
+                else
+                    shadowPass.addCaster(moon, instances, beltFaces, BeltDetailScale(nearest[1], moon.sphere, 1.0f, float(shadowSize), shadowLodTexelError));
+                glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
+                glViewport(0, 0, shadowSize, shadowSize);
+                shadowPass.render(cubeMap, ShadowFaceCache::ALL_FACES);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, mainFbo);
+                glViewport(0, 0, width, height);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                if (gpu)
+                    moon.DrawIndirect(lit, shadowFeatures, setupBelt, culling, GpuCulling::VIEW_CAMERA);
+                else
+                    moon.DrawInstanced(lit, shadowFeatures, setupBelt, instances, 1, BeltDetailScale(nearest[0], moon.sphere, projection[1][1], float(height), lodPixelError));
+
+                if (measured)
+                {
+                    cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    glEndQuery(GL_TIME_ELAPSED);
+                    GLuint64 ns = 0;
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+                    totalNs += ns;
+                }
+            }
+            LevelOfDetail::instance().beginFrame();
+            drawCalls = LevelOfDetail::instance().getLastFrameStats().drawCalls;
+
+            // the CPU path draws every instance into the main pass and each face it redraws; the GPU path what it left visible
+            uint64_t drawn = 0;
+            if (gpu)
+            {
+                culling.visibleCounts(visible);
+                for (GLuint viewInstances : visible)
+                    drawn += viewInstances;
+            }
+            else
+            {
+                for (int face = 0; face < ShadowPass::FACE_COUNT; face++)
+                    drawn += ((beltFaces >> face) & 1) ? count : 0;
+                drawn += count;
+            }
+            std::cout << count << ", " << (gpu ? "gpu" : "cpu") << ", " << cpuMs / measuredFrames << ", "
+                << double(totalNs) / measuredFrames / 1e6 << ", " << drawCalls << ", " << drawn << std::endl;
+        }
+        instances.clean();
+    }
+
+    glDeleteQueries(1, &query);
+    culling.clean();
+    shadowPass.clean();
+    lit.clean();
+    lightClusters.clean();
+    uniformBlocks.clean();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &shadowFbo);
+    glDeleteFramebuffers(1, &mainFbo);
+    glDeleteRenderbuffers(2, renderbuffers);
+    GLState::instance().forgetTexture(cubeMap);
+    glDeleteTextures(1, &cubeMap);
+}
+
+// Runs the benchmark the options ask for, if any. shadowFeatures are those of the shadow filter of the run.
+// Returns false if there is none, so the scene should run.
+inline bool RunComponentBenchmark(const AppOptions& options, uint32_t shadowFeatures)
+{
+    if (options.compareTextures)
+        CompareTextureLoading();
+    else if (options.benchmarkShadows)
+        BenchmarkShadowBackends();
+    else if (options.benchmarkOrbitBodies > 0)
+        BenchmarkOrbits(options.benchmarkOrbitBodies);
+    else if (options.benchmarkJobThreads > 0)
+        BenchmarkJobScaling(options.benchmarkJobThreads);
+    else if (options.benchmarkShaders)
+        BenchmarkShaderStartup(shadowFeatures);
+    else if (options.benchmarkGpuCullingInstances > 0)
+        BenchmarkGpuCulling(options.benchmarkGpuCullingInstances, options.shadowBackend, options.lodPixelError, options.shadowLodTexelError, shadowFeatures);
+    else
+        return false;
+    return true;
+}
+#endif
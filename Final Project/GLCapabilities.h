@@ -0,0 +1,62 @@
+#ifndef GL_CAPABILITIES_H
+#define GL_CAPABILITIES_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <unordered_set>
+
+// Queries of what the current OpenGL context supports beyond the 3.3 core profile we ask for.
+namespace GLCapabilities
+{
+    typedef void* (*ProcLoader)(const char* name);
+
+    // the function loader GLAD was initialized with, for entry points GLAD was not generated with
+    inline ProcLoader& procLoader()
+    {
+        static ProcLoader loader = nullptr;
+        return loader;
+    }
+
+    inline void setProcLoader(ProcLoader loader)
+    {
+        procLoader() = loader;
+    }
+
+    // an entry point of an extension or of a later core version, or nullptr if the driver has none
+    template <typename Function>
+    Function loadFunction(const char* name)
+    {
+        return procLoader() != nullptr ? reinterpret_cast<Function>(procLoader()(name)) : nullptr;
+    }
+
+    // true if the context's OpenGL version is at least major.minor. Core profile contexts usually come with
+    // the newest version the driver has, whatever was asked for.
+    inline bool hasVersion(int major, int minor)
+    {
+        GLint contextMajor = 0, contextMinor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+        glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+        return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+    }
+
+    // true if the context advertises the extension. The list is read on the first call, so only call
+    // this once the context is current.
+    inline bool hasExtension(const std::string& name)
+    {
+        static const std::unordered_set<std::string> extensions = []() {
+            std::unordered_set<std::string> names;
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++)
+            {
+                const GLubyte* extension = glGetStringi(GL_EXTENSIONS, GLuint(i));
+                if (extension != nullptr)
+                    names.insert(reinterpret_cast<const char*>(extension));
+            }
+            return names;
+        }();
+        return extensions.count(name) != 0;
+    }
+}
+#endif
@@ -0,0 +1,187 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <iostream>
+
+// Shadow copy of the OpenGL binding state.
+// Program, VAO and texture binds go through here so a bind that would not change anything is never
+// issued. Code that binds behind the tracker's back (uploads, framebuffer setup) must call the matching
+// invalidate function afterwards, and deleted objects must be forgotten so a recycled name is rebound.
+// Render thread only.
+class GLState
+{
+public:
+    struct Stats {
+        uint64_t issued = 0;    // state changes sent to OpenGL
+        uint64_t elided = 0;    // redundant state changes skipped
+    };
+
+    // units above this are passed through untracked
+    static const GLuint TRACKED_TEXTURE_UNITS = 32;
+
+    static GLState& instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    GLState(const GLState&) = delete;
+    GLState& operator=(const GLState&) = delete;
+
+    void useProgram(GLuint program)
+    {
+        if (currentProgram == program)
+        {
+            frame.elided++;
+            return;
+        }
+        glUseProgram(program);
+        currentProgram = program;
+        frame.issued++;
+    }
+
+    void bindVertexArray(GLuint vertexArray)
+    {
+        if (currentVertexArray == vertexArray)
+        {
+            frame.elided++;
+            return;
+        }
+        glBindVertexArray(vertexArray);
+        currentVertexArray = vertexArray;
+        frame.issued++;
+    }
+
+    // binds a 2D or cube map texture to a texture unit, switching the active unit only if needed
+    void bindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        GLuint* bound = boundTexture(unit, target);
+        if (bound != nullptr && *bound == texture)
+        {
+            frame.elided++;
+            return;
+        }
+
+        if (activeUnit != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+            frame.issued++;
+        }
+        glBindTexture(target, texture);
+        if (bound != nullptr)
+            *bound = texture;
+        frame.issued++;
+    }
+
+    // binds a texture on whichever unit is active, to upload to it or change its parameters
+    void bindTextureForUpdate(GLenum target, GLuint texture)
+    {
+        bindTexture(activeUnit == UNKNOWN ? 0 : activeUnit, target, texture);
+    }
+
+    // the active texture unit or texture bindings were changed without the tracker
+    void invalidateTextures()
+    {
+        activeUnit = UNKNOWN;
+        for (GLuint unit = 0; unit < TRACKED_TEXTURE_UNITS; unit++)
+        {
+            textures2D[unit] = UNKNOWN;
+            texturesCube[unit] = UNKNOWN;
+        }
+    }
+
+    // a VAO was bound without the tracker
+    void invalidateVertexArray()
+    {
+        currentVertexArray = UNKNOWN;
+    }
+
+    // forget everything, e.g. after handing the context to code that does not use the tracker
+    void invalidate()
+    {
+        currentProgram = UNKNOWN;
+        invalidateVertexArray();
+        invalidateTextures();
+    }
+
+    // call when a texture is deleted: OpenGL unbinds it and the name may be handed out again
+    void forgetTexture(GLuint texture)
+    {
+        for (GLuint unit = 0; unit < TRACKED_TEXTURE_UNITS; unit++)
+        {
+            if (textures2D[unit] == texture)
+                textures2D[unit] = 0;
+            if (texturesCube[unit] == texture)
+                texturesCube[unit] = 0;
+        }
+    }
+
+    // call when a program is deleted
+    void forgetProgram(GLuint program)
+    {
+        if (currentProgram == program)
+            currentProgram = UNKNOWN;
+    }
+
+    // call when a VAO is deleted
+    void forgetVertexArray(GLuint vertexArray)
+    {
+        if (currentVertexArray == vertexArray)
+            currentVertexArray = UNKNOWN;
+    }
+
+    // starts a new frame of counters; the finished frame is kept for getLastFrameStats()
+    void beginFrame()
+    {
+        lastFrame = frame;
+        total.issued += frame.issued;
+        total.elided += frame.elided;
+        frames++;
+        frame = Stats();
+    }
+
+    Stats getLastFrameStats() const
+    {
+        return lastFrame;
+    }
+
+    void printStats() const
+    {
+        if (frames == 0)
+            return;
+        std::cout << "GL state changes per frame: " << double(total.issued) / frames << " issued, "
+            << double(total.elided) / frames << " elided (" << frames << " frames)" << std::endl;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    GLuint currentProgram = UNKNOWN;
+    GLuint currentVertexArray = UNKNOWN;
+    GLuint activeUnit = UNKNOWN;
+    GLuint textures2D[TRACKED_TEXTURE_UNITS];
+    GLuint texturesCube[TRACKED_TEXTURE_UNITS];
+    Stats frame, lastFrame, total;
+    uint64_t frames = 0;
+
+    GLState()
+    {
+        invalidateTextures();
+    }
+
+    GLuint* boundTexture(GLuint unit, GLenum target)
+    {
+        if (unit >= TRACKED_TEXTURE_UNITS)
+            return nullptr;
+        if (target == GL_TEXTURE_2D)
+            return &textures2D[unit];
+        if (target == GL_TEXTURE_CUBE_MAP)
+            return &texturesCube[unit];
+        return nullptr;
+    }
+};
+#endif
@@ -0,0 +1,458 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "VertexFormat.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <vector>
+
+// Shared geometry arena.
+// All meshes of one vertex layout live in a single vertex buffer and a single index buffer behind one VAO.
+// A mesh only owns a vertex range and an index range in them and is drawn with glDrawElementsBaseVertex,
+// so switching meshes never rebinds a VAO. Freed ranges go back to a freelist; when no free block is big
+// enough the arena compacts itself (if that frees enough space) or grows.
+class GeometryArena
+{
+public:
+    // RAII reference to a range in the arena. Move-only, gives the range back when destroyed.
+    class Allocation
+    {
+    public:
+        Allocation() = default;
+        Allocation(GeometryArena* arena, uint32_t id) : arena(arena), id(id) {}
+        Allocation(Allocation&& other) noexcept : arena(other.arena), id(other.id)
+        {
+            other.arena = nullptr;
+        }
+        Allocation& operator=(Allocation&& other) noexcept
+        {
+            std::swap(arena, other.arena);
+            std::swap(id, other.id);
+            return *this;
+        }
+        Allocation(const Allocation&) = delete;
+        Allocation& operator=(const Allocation&) = delete;
+        ~Allocation()
+        {
+            if (arena != nullptr)
+                arena->release(id);
+        }
+
+        explicit operator bool() const
+        {
+            return arena != nullptr;
+        }
+
+        GeometryArena* arena = nullptr;
+        uint32_t id = 0;
+    };
+
+    // arena for a vertex layout, created on first use (render thread only)
+    static GeometryArena& get(VertexLayout layout)
+    {
+        GeometryArena*& arena = arenas()[layout];
+        if (arena == nullptr)
+            arena = new GeometryArena(layout);
+        return *arena;
+    }
+
+    // copies vertices (already encoded in the arena's layout) into a new vertex range
+    Allocation allocateVertices(const void* data, uint32_t vertexCount)
+    {
+        uint32_t id = allocate(vertexRanges, vertexCount, 1);
+        Range& range = ranges[id];
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(range.offset) * format.stride, GLsizeiptr(vertexCount) * format.stride, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return Allocation(this, id);
+    }
+
+    // copies index data into a new index range (4 byte aligned)
+    Allocation allocateIndices(const void* data, uint32_t bytes)
+    {
+        uint32_t id = allocate(indexRanges, bytes, 4);
+        Range& range = ranges[id];
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(range.offset), GLsizeiptr(bytes), data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return Allocation(this, id);
+    }
+
+    // first vertex of a vertex range, for glDrawElementsBaseVertex
+    GLint baseVertex(const Allocation& allocation) const
+    {
+        return GLint(ranges[allocation.id].offset);
+    }
+
+    // byte offset of an index range, as the indices pointer of the draw call
+    const void* indexOffset(const Allocation& allocation) const
+    {
+        return (const void*)(uintptr_t)ranges[allocation.id].offset;
+    }
+
+    // binds the arena's VAO unless it is already bound
+    void bind()
+    {
+        GLState::instance().bindVertexArray(VAO);
+    }
+
+    // binds the arena's instancing VAO: the same vertex and index buffers plus a per-instance model
+    // matrix (ATTRIBUTE_INSTANCE_TRANSFORM) read from instanceBuffer, advancing one mat4 every divisor instances
+    void bindInstanced(GLuint instanceBuffer, GLuint divisor = 1)
+    {
+        if (instancedVAO == 0)
+        {
+            glGenVertexArrays(1, &instancedVAO);
+            attachBuffers();
+        }
+        GLState::instance().bindVertexArray(instancedVAO);
+        if (attachedInstanceBuffer != instanceBuffer)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            for (GLuint column = 0; column < 4; column++)
+            {
+                GLuint location = ATTRIBUTE_INSTANCE_TRANSFORM + column;
+                glEnableVertexAttribArray(location);
+                glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16, (void*)(sizeof(GLfloat) * 4 * column));
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            attachedInstanceBuffer = instanceBuffer;
+            attachedDivisor = 0;
+        }
+        if (attachedDivisor != divisor)
+        {
+            for (GLuint column = 0; column < 4; column++)
+                glVertexAttribDivisor(ATTRIBUTE_INSTANCE_TRANSFORM + column, divisor);
+            attachedDivisor = divisor;
+        }
+    }
+
+    // binds the arena's indirect VAO: the same vertex and index buffers plus a per-instance index
+    // (ATTRIBUTE_INSTANCE_INDEX) read from instanceIndexBuffer, for the culled instance lists of GpuCulling. The
+    // draw command's base instance picks where in the buffer an instance list starts.
+    void bindIndirect(GLuint instanceIndexBuffer)
+    {
+        if (indirectVAO == 0)
+        {
+            glGenVertexArrays(1, &indirectVAO);
+            attachBuffers();
+        }
+        GLState::instance().bindVertexArray(indirectVAO);
+        if (attachedIndexList != instanceIndexBuffer)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBuffer);
+            glEnableVertexAttribArray(ATTRIBUTE_INSTANCE_INDEX);
+            glVertexAttribIPointer(ATTRIBUTE_INSTANCE_INDEX, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+            glVertexAttribDivisor(ATTRIBUTE_INSTANCE_INDEX, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            attachedIndexList = instanceIndexBuffer;
+        }
+    }
+
+    // call before deleting an instance buffer or instance index buffer, so a buffer that later reuses its
+    // name gets attached again
+    static void forgetInstanceBuffer(GLuint instanceBuffer)
+    {
+        for (int i = 0; i < VERTEX_LAYOUT_COUNT; i++)
+        {
+            GeometryArena* arena = arenas()[i];
+            if (arena != nullptr && arena->attachedInstanceBuffer == instanceBuffer)
+                arena->attachedInstanceBuffer = 0;
+            if (arena != nullptr && arena->attachedIndexList == instanceBuffer)
+                arena->attachedIndexList = 0;
+        }
+    }
+
+    // moves every live range to the front of its buffer, leaving one free block at the end
+    void compact()
+    {
+        compactBuffer(vertexRanges, vertexBuffer, format.stride);
+        compactBuffer(indexRanges, indexBuffer, 1);
+        attachBuffers();
+    }
+
+    void printStats() const
+    {
+        std::cout << "Geometry arena (" << format.name << "): "
+            << (vertexRanges.capacity - vertexRanges.freeTotal()) * format.stride / 1024 << " / " << GLsizeiptr(vertexRanges.capacity) * format.stride / 1024 << " KiB vertices in "
+            << vertexRanges.freeBlocks.size() << " free blocks, "
+            << (indexRanges.capacity - indexRanges.freeTotal()) / 1024 << " / " << indexRanges.capacity / 1024 << " KiB indices in "
+            << indexRanges.freeBlocks.size() << " free blocks" << std::endl;
+    }
+
+    // deletes the GL objects of every arena. Call while the GL context is still current.
+    static void shutdownAll()
+    {
+        for (int i = 0; i < VERTEX_LAYOUT_COUNT; i++)
+        {
+            GeometryArena* arena = arenas()[i];
+            if (arena == nullptr)
+                continue;
+            GLState::instance().forgetVertexArray(arena->VAO);
+            glDeleteVertexArrays(1, &arena->VAO);
+            for (GLuint vertexArray : { arena->instancedVAO, arena->indirectVAO })
+            {
+                if (vertexArray == 0)
+                    continue;
+                GLState::instance().forgetVertexArray(vertexArray);
+                glDeleteVertexArrays(1, &vertexArray);
+            }
+            glDeleteBuffers(1, &arena->vertexBuffer);
+            glDeleteBuffers(1, &arena->indexBuffer);
+            arena->isShutDown = true;
+        }
+    }
+
+    GLuint VAO = 0;
+
+private:
+    // one suballocated buffer; offsets and sizes are in vertices for the vertex buffer and bytes for the index buffer
+    struct RangeAllocator {
+        uint32_t capacity = 0;
+        std::map<uint32_t, uint32_t> freeBlocks;    // offset -> size, ordered so neighbours can be merged
+
+        uint32_t freeTotal() const
+        {
+            uint32_t total = 0;
+            for (const auto& block : freeBlocks)
+                total += block.second;
+            return total;
+        }
+
+        // first fit; returns false if no free block is big enough
+        bool allocate(uint32_t size, uint32_t alignment, uint32_t& offset)
+        {
+            for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+            {
+                uint32_t blockOffset = it->first, blockSize = it->second;
+                uint32_t aligned = (blockOffset + alignment - 1) / alignment * alignment;
+                if (aligned + size > blockOffset + blockSize)
+                    continue;
+
+                freeBlocks.erase(it);
+                if (aligned > blockOffset)
+                    freeBlocks[blockOffset] = aligned - blockOffset;
+                if (aligned + size < blockOffset + blockSize)
+                    freeBlocks[aligned + size] = blockOffset + blockSize - aligned - size;
+                offset = aligned;
+                return true;
+            }
+            return false;
+        }
+
+        void free(uint32_t offset, uint32_t size)
+        {
+            if (size == 0)
+                return;
+            auto next = freeBlocks.lower_bound(offset);
+            if (next != freeBlocks.begin())
+            {
+                auto previous = std::prev(next);
+                if (previous->first + previous->second == offset)
+                {
+                    offset = previous->first;
+                    size += previous->second;
+                    freeBlocks.erase(previous);
+                }
+            }
+            if (next != freeBlocks.end() && offset + size == next->first)
+            {
+                size += next->second;
+                freeBlocks.erase(next);
+            }
+            freeBlocks[offset] = size;
+        }
+    };
+
+    struct Range {
+        RangeAllocator* allocator = nullptr;    // null when the slot is free
+        uint32_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    const VertexFormat& format;
+    GLuint vertexBuffer = 0, indexBuffer = 0;
+    GLuint instancedVAO = 0;            // created on the first instanced draw
+    GLuint attachedInstanceBuffer = 0;  // instance buffer the instancing VAO currently reads
+    GLuint attachedDivisor = 0;         // and its attribute divisor
+    GLuint indirectVAO = 0;             // created on the first indirect draw
+    GLuint attachedIndexList = 0;       // instance index buffer the indirect VAO currently reads
+    RangeAllocator vertexRanges, indexRanges;
+    std::vector<Range> ranges;
+    std::vector<uint32_t> freeRangeIds;
+    bool isShutDown = false;
+
+    static const uint32_t INITIAL_VERTEX_CAPACITY = 1 << 18;    // vertices
+    static const uint32_t INITIAL_INDEX_CAPACITY = 4 << 20;     // bytes
+
+    explicit GeometryArena(VertexLayout layout) : format(VertexFormat::get(layout))
+    {
+        glGenVertexArrays(1, &VAO);
+        vertexRanges.capacity = INITIAL_VERTEX_CAPACITY;
+        vertexRanges.freeBlocks[0] = INITIAL_VERTEX_CAPACITY;
+        indexRanges.capacity = INITIAL_INDEX_CAPACITY;
+        indexRanges.freeBlocks[0] = INITIAL_INDEX_CAPACITY;
+        vertexBuffer = createBuffer(GLsizeiptr(INITIAL_VERTEX_CAPACITY) * format.stride);
+        indexBuffer = createBuffer(INITIAL_INDEX_CAPACITY);
+        attachBuffers();
+    }
+
+    static GeometryArena** arenas()
+    {
+        static GeometryArena* instances[VERTEX_LAYOUT_COUNT] = {};
+        return instances;
+    }
+
+    static GLuint createBuffer(GLsizeiptr bytes)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return buffer;
+    }
+
+    // (re)points the VAOs at the current buffers, needed after they were replaced by growing or compacting
+    void attachBuffers()
+    {
+        for (GLuint vertexArray : { VAO, instancedVAO, indirectVAO })
+        {
+            if (vertexArray == 0)
+                continue;
+            GLState::instance().bindVertexArray(vertexArray);
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            format.setupAttributes();
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    uint32_t allocate(RangeAllocator& allocator, uint32_t size, uint32_t alignment)
+    {
+        GLuint& buffer = &allocator == &vertexRanges ? vertexBuffer : indexBuffer;
+        GLsizeiptr unit = &allocator == &vertexRanges ? format.stride : 1;
+
+        uint32_t offset;
+        if (!allocator.allocate(size, alignment, offset))
+        {
+            // fragmented but big enough: squeeze the holes out first, if the free tail that leaves takes the
+            // range, otherwise grow. Compacting keeps the alignment padding of index ranges, so the tail can be
+            // smaller than freeTotal().
+            uint64_t tailStart = (uint64_t(compactedEnd(allocator, unit)) + alignment - 1) / alignment * alignment;
+            if (tailStart + size <= allocator.capacity)
+                compactBuffer(allocator, buffer, unit);
+            else
+                growBuffer(allocator, buffer, unit, std::max(allocator.capacity * 2, allocator.capacity + size + alignment));
+            if (!allocator.allocate(size, alignment, offset))
+            {
+                // a fresh tail of size + alignment always takes the range
+                growBuffer(allocator, buffer, unit, std::max(allocator.capacity * 2, allocator.capacity + size + alignment));
+                allocator.allocate(size, alignment, offset);
+            }
+            attachBuffers();
+        }
+
+        uint32_t id;
+        if (!freeRangeIds.empty())
+        {
+            id = freeRangeIds.back();
+            freeRangeIds.pop_back();
+        }
+        else
+        {
+            id = static_cast<uint32_t>(ranges.size());
+            ranges.emplace_back();
+        }
+        ranges[id].allocator = &allocator;
+        ranges[id].offset = offset;
+        ranges[id].size = size;
+        return id;
+    }
+
+    void release(uint32_t id)
+    {
+        Range& range = ranges[id];
+        if (!isShutDown)
+            range.allocator->free(range.offset, range.size);
+        range = Range();
+        freeRangeIds.push_back(id);
+    }
+
+    void growBuffer(RangeAllocator& allocator, GLuint& buffer, GLsizeiptr unit, uint32_t newCapacity)
+    {
+        GLuint grown = createBuffer(GLsizeiptr(newCapacity) * unit);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(allocator.capacity) * unit);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = grown;
+
+        allocator.free(allocator.capacity, newCapacity - allocator.capacity);
+        allocator.capacity = newCapacity;
+    }
+
+    // the live ranges of an allocator, in buffer order
+    std::vector<Range*> liveRanges(const RangeAllocator& allocator)
+    {
+        std::vector<Range*> live;
+        for (Range& range : ranges)
+        {
+            if (range.allocator == &allocator)
+                live.push_back(&range);
+        }
+        std::sort(live.begin(), live.end(), [](const Range* a, const Range* b) { return a->offset < b->offset; });
+        return live;
+    }
+
+    // where the free tail would start after compactBuffer, alignment padding of index ranges included
+    uint32_t compactedEnd(const RangeAllocator& allocator, GLsizeiptr unit)
+    {
+        uint32_t offset = 0;
+        for (const Range* range : liveRanges(allocator))
+        {
+            if (unit == 1)
+                offset = (offset + 3) & ~3u;
+            offset += range->size;
+        }
+        return offset;
+    }
+
+    void compactBuffer(RangeAllocator& allocator, GLuint& buffer, GLsizeiptr unit)
+    {
+        std::vector<Range*> live = liveRanges(allocator);
+
+        GLuint compacted = createBuffer(GLsizeiptr(allocator.capacity) * unit);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, compacted);
+        uint32_t offset = 0;
+        for (Range* range : live)
+        {
+            // keep index ranges 4 byte aligned
+            if (unit == 1)
+                offset = (offset + 3) & ~3u;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GLintptr(range->offset) * unit, GLintptr(offset) * unit, GLsizeiptr(range->size) * unit);
+            range->offset = offset;
+            offset += range->size;
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = compacted;
+
+        allocator.freeBlocks.clear();
+        if (offset < allocator.capacity)
+            allocator.freeBlocks[offset] = allocator.capacity - offset;
+    }
+};
+#endif
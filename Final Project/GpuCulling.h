@@ -0,0 +1,338 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "GLCapabilities.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "LevelOfDetail.h"
+#include "Mesh.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// compute shaders, shader storage buffers and multi-draw indirect are core in 4.3; defined here for 3.3 headers
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_MAX_SHADER_STORAGE_BLOCK_SIZE
+#define GL_MAX_SHADER_STORAGE_BLOCK_SIZE 0x90DE
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+
+// a view the instances are culled for: its frustum, the eye its levels of detail are measured from, and
+// the detail factor of its projection (see GpuCulling::detailFactor), 0 to draw full detail
+struct CullView {
+    Frustum frustum;
+    glm::vec3 eye = glm::vec3(0.0f);
+    float detailFactor = 0.0f;
+};
+
+// GPU-driven drawing of an instanced model (OpenGL 4.3).
+// Every frame cull() runs gpu_cull.csh over the instance buffer: each instance is tested against the camera
+// frustum and the shadow cube faces it is asked for, gets a level of detail per view from its own distance,
+// and is appended to the visible list of its (view, mesh, level) draw command, whose instanceCount the
+// shader counts up. draw() then submits all levels of a mesh in one glMultiDrawElementsIndirect, so a pass
+// costs one call per mesh whatever the instance count, and the CPU neither reads nor writes an instance.
+// The vertex shaders (INDIRECT_INSTANCES) read the instance index from the visible list as an instanced
+// attribute, the draw command's base instance pointing at its range, and fetch the model matrix from the
+// instance buffer through a buffer texture. Render thread only.
+class GpuCulling
+{
+public:
+    static constexpr int VIEW_COUNT = 7;        // the camera and the six shadow cube faces
+    static constexpr int VIEW_CAMERA = 0;
+    static constexpr int VIEW_FIRST_FACE = 1;   // cube face f is view VIEW_FIRST_FACE + f
+    static constexpr size_t MAX_LEVELS = 8;     // levels of detail per mesh the culling shader picks from
+
+    // glDrawElementsIndirect's command
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    typedef void (APIENTRYP DispatchComputeProc)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+    typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+    typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+
+    struct EntryPoints {
+        DispatchComputeProc dispatchCompute = nullptr;
+        MemoryBarrierProc memoryBarrier = nullptr;
+        MultiDrawElementsIndirectProc multiDrawElementsIndirect = nullptr;
+    };
+
+    // the 4.3 functions of the current context; read on the first call, so only call this once it is current
+    static const EntryPoints& entryPoints()
+    {
+        static const EntryPoints entries = []() {
+            EntryPoints loaded;
+            loaded.dispatchCompute = GLCapabilities::loadFunction<DispatchComputeProc>("glDispatchCompute");
+            loaded.memoryBarrier = GLCapabilities::loadFunction<MemoryBarrierProc>("glMemoryBarrier");
+            loaded.multiDrawElementsIndirect = GLCapabilities::loadFunction<MultiDrawElementsIndirectProc>("glMultiDrawElementsIndirect");
+            return loaded;
+        }();
+        return entries;
+    }
+
+    // true if the context can run the GPU-driven path
+    static bool supported()
+    {
+        const EntryPoints& entries = entryPoints();
+        return GLCapabilities::hasVersion(4, 3) && entries.dispatchCompute != nullptr && entries.memoryBarrier != nullptr
+            && entries.multiDrawElementsIndirect != nullptr;
+    }
+
+    // the most instances one cull() can take: the buffer texture the vertex shaders fetch the transforms
+    // through and the storage block the culling shader reads them from both have a size limit
+    static GLsizei maxInstances()
+    {
+        GLint texels = 0, blockBytes = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+        glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &blockBytes);
+        return GLsizei(std::min<int64_t>(texels / 4, blockBytes / GLint(sizeof(glm::mat4))));
+    }
+
+    // the detail factor of a view: the pixels one world unit covers at distance 1, divided by the error
+    // allowed on screen (see LevelOfDetail::detailScale). 0 for full detail.
+    static float detailFactor(float projectionScaleY, float viewportHeight, float maxPixelError)
+    {
+        return maxPixelError > 0.0f ? 0.5f * viewportHeight * projectionScaleY / maxPixelError : 0.0f;
+    }
+
+    explicit GpuCulling(ShaderBatch* batch = nullptr)
+        : cullShader("gpu_cull.csh", batch)
+    {
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glGenTextures(1, &transformTexture);
+    }
+
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling& operator=(const GpuCulling&) = delete;
+
+    // culls the instances for the views in viewMask (bit v for views[v]) and builds their draw commands.
+    // meshes are the model's; draw() must be given the same ones, in the same order.
+    void cull(const std::vector<Mesh>& meshes, const InstanceBuffer& instances, const CullView* views, uint8_t viewMask)
+    {
+        culledViews = instances.count() > 0 ? uint8_t(viewMask & ((1u << VIEW_COUNT) - 1)) : 0;
+        buildCommands(meshes, GLuint(instances.count()));
+        upload(buffers[BUFFER_COMMANDS], commands.data(), commands.size() * sizeof(DrawCommand));
+        if (culledViews == 0)
+            return;
+
+        CullViewData viewData[VIEW_COUNT] = {};
+        for (int view = 0; view < VIEW_COUNT; view++)
+        {
+            if ((culledViews & (1u << view)) == 0)
+                continue;
+            for (int plane = 0; plane < Frustum::PLANE_COUNT; plane++)
+                viewData[view].planes[plane] = views[view].frustum.planes[plane];
+            viewData[view].eyeDetail = glm::vec4(views[view].eye, views[view].detailFactor);
+        }
+        upload(buffers[BUFFER_VIEWS], viewData, sizeof(viewData));
+        upload(buffers[BUFFER_MESHES], meshData.data(), meshData.size() * sizeof(CullMeshData));
+
+        // the vertex shaders fetch the transforms through a buffer texture over the instance buffer
+        if (attachedTransforms != instances.id())
+        {
+            GLState::instance().bindTextureForUpdate(GL_TEXTURE_BUFFER, transformTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instances.id());
+            attachedTransforms = instances.id();
+        }
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances.id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[BUFFER_COMMANDS]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[BUFFER_VISIBLE]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buffers[BUFFER_VIEWS]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffers[BUFFER_MESHES]);
+
+        cullShader.use();
+        cullShader.setInt(instanceCountUniform, instances.count());
+        cullShader.setInt(viewMaskUniform, culledViews);
+        cullShader.setInt(meshCountUniform, GLint(meshData.size()));
+        cullShader.setInt(commandsPerViewUniform, GLint(commandsPerView));
+        const EntryPoints& entries = entryPoints();
+        entries.dispatchCompute((GLuint(instances.count()) + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1, 1);
+        // the draws read the commands and the visible lists the shader wrote
+        entries.memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        dispatches++;
+    }
+
+    // true if the last cull() built commands for the view
+    bool culled(int view) const
+    {
+        return (culledViews & (1u << view)) != 0;
+    }
+
+    // draws the visible instances of meshes[meshIndex] of the last cull() for a view: every level of
+    // detail in one multi-draw. The shader must be an INDIRECT_INSTANCES variant and already current.
+    void draw(Mesh& mesh, size_t meshIndex, int view, Shader& shader)
+    {
+        if (!culled(view) || meshIndex >= meshData.size())
+            return;
+        Shader::SamplerBinding binding;
+        if (shader.findSampler(transformsSampler, binding))
+            GLState::instance().bindTexture(binding.unit, GL_TEXTURE_BUFFER, transformTexture);
+        mesh.bindIndirect(shader, buffers[BUFFER_VISIBLE]);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[BUFFER_COMMANDS]);
+        size_t first = size_t(view) * commandsPerView + meshData[meshIndex].firstCommand;
+        entryPoints().multiDrawElementsIndirect(GL_TRIANGLES, mesh.indexType, (const void*)(first * sizeof(DrawCommand)),
+            GLsizei(meshData[meshIndex].levelCount), sizeof(DrawCommand));
+        LevelOfDetail::instance().submittedIndirect();
+    }
+
+    // instances the last cull() left visible in each view, summed over the meshes and levels. Reads the
+    // commands back, which waits for the GPU, so this is for benchmarks and tests only.
+    void visibleCounts(GLuint counts[VIEW_COUNT]) const
+    {
+        std::fill(counts, counts + VIEW_COUNT, 0u);
+        if (culledViews == 0 || commands.empty())
+            return;
+        std::vector<DrawCommand> written(commands.size());
+        entryPoints().memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffers[BUFFER_COMMANDS]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, GLsizeiptr(written.size() * sizeof(DrawCommand)), written.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        for (size_t command = 0; command < written.size(); command++)
+            counts[command / commandsPerView] += written[command].instanceCount;
+    }
+
+    // compute dispatches so far
+    uint64_t dispatchCount() const
+    {
+        return dispatches;
+    }
+
+    void clean()
+    {
+        GeometryArena::forgetInstanceBuffer(buffers[BUFFER_VISIBLE]);
+        GLState::instance().forgetTexture(transformTexture);
+        glDeleteTextures(1, &transformTexture);
+        glDeleteBuffers(BUFFER_COUNT, buffers);
+        cullShader.clean();
+    }
+
+private:
+    enum Buffer {
+        BUFFER_COMMANDS,
+        BUFFER_VISIBLE,     // instance indices, one range of the instance count per command
+        BUFFER_VIEWS,
+        BUFFER_MESHES,
+        BUFFER_COUNT
+    };
+
+    static constexpr GLuint WORK_GROUP_SIZE = 64;   // local_size_x of gpu_cull.csh
+
+    // the std430 structs of gpu_cull.csh
+    struct CullViewData {
+        glm::vec4 planes[Frustum::PLANE_COUNT];
+        glm::vec4 eyeDetail;
+    };
+
+    struct CullMeshData {
+        glm::vec4 sphere;
+        GLuint levelCount;
+        GLuint firstCommand;
+        GLuint pad0;
+        GLuint pad1;
+        float errors[MAX_LEVELS];
+    };
+
+    static_assert(sizeof(DrawCommand) == 20, "DrawCommand must match DrawElementsIndirectCommand");
+    static_assert(sizeof(CullViewData) == 112 && sizeof(CullMeshData) == 64, "the cull structs must match their std430 layout");
+
+    static constexpr UniformId instanceCountUniform = UniformId("instanceCount");
+    static constexpr UniformId viewMaskUniform = UniformId("viewMask");
+    static constexpr UniformId meshCountUniform = UniformId("meshCount");
+    static constexpr UniformId commandsPerViewUniform = UniformId("commandsPerView");
+    static constexpr UniformId transformsSampler = UniformId("instanceTransforms");
+
+    Shader cullShader;
+    GLuint buffers[BUFFER_COUNT] = {};
+    GLuint transformTexture = 0;
+    GLuint attachedTransforms = 0;
+    GLsizeiptr visibleBytes = 0;        // allocated size of the visible lists, only ever grows
+    uint8_t culledViews = 0;
+    size_t commandsPerView = 0;
+    std::vector<DrawCommand> commands;  // every view's commands with their instance counts zeroed
+    std::vector<CullMeshData> meshData;
+    uint64_t dispatches = 0;
+
+    // lays out the commands: per view, the levels of every mesh in a row, each with room for every instance
+    // in the visible lists. Rebuilt every frame, as cheap as it is, so meshes moving in the geometry arena
+    // are picked up.
+    void buildCommands(const std::vector<Mesh>& meshes, GLuint instanceCount)
+    {
+        meshData.clear();
+        commandsPerView = 0;
+        for (const Mesh& mesh : meshes)
+        {
+            CullMeshData data = {};
+            data.sphere = glm::vec4(mesh.sphere.center, mesh.sphere.radius);
+            data.levelCount = GLuint(std::min(mesh.lods.size(), MAX_LEVELS));
+            data.firstCommand = GLuint(commandsPerView);
+            for (GLuint level = 0; level < data.levelCount; level++)
+                data.errors[level] = mesh.lods[level].error;
+            meshData.push_back(data);
+            commandsPerView += data.levelCount;
+        }
+
+        commands.resize(commandsPerView * VIEW_COUNT);
+        for (int view = 0; view < VIEW_COUNT; view++)
+        {
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                for (GLuint level = 0; level < meshData[i].levelCount; level++)
+                {
+                    size_t index = size_t(view) * commandsPerView + meshData[i].firstCommand + level;
+                    DrawCommand& command = commands[index];
+                    command.count = meshes[i].lods[level].indexCount;
+                    command.instanceCount = 0;
+                    command.firstIndex = meshes[i].indirectFirstIndex(level);
+                    command.baseVertex = meshes[i].indirectBaseVertex();
+                    command.baseInstance = GLuint(index) * instanceCount;
+                }
+            }
+        }
+
+        GLsizeiptr bytes = GLsizeiptr(commands.size()) * GLsizeiptr(instanceCount) * GLsizeiptr(sizeof(GLuint));
+        if (bytes > visibleBytes)
+        {
+            visibleBytes = bytes;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[BUFFER_VISIBLE]);
+            glBufferData(GL_COPY_WRITE_BUFFER, visibleBytes, nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+    }
+
+    // replaces a buffer's contents, orphaning the old storage
+    static void upload(GLuint buffer, const void* data, size_t bytes)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(std::max<size_t>(bytes, 16)), nullptr, GL_STREAM_DRAW);
+        if (bytes > 0)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, GLsizeiptr(bytes), data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+};
+#endif
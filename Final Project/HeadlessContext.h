@@ -0,0 +1,128 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+// HEADLESS_EGL is defined by the CMake build on Linux; the Visual Studio build has no EGL
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+
+// Offscreen OpenGL 3.3 core context without a window system, for the benchmark on machines without a display
+// or GPU (Mesa llvmpipe works). The context renders into an EGL pbuffer surface, which stands in for the
+// window's default framebuffer, so the render loop draws to framebuffer 0 as usual. EGL devices are tried
+// first (EGL_EXT_platform_device, which Mesa exposes for its software rasterizer too), then the default display.
+class HeadlessContext
+{
+public:
+    HeadlessContext() = default;
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+    ~HeadlessContext()
+    {
+        destroy();
+    }
+
+    // creates the context and its width x height pbuffer and makes them current; false if that is not possible
+    bool create(int width, int height)
+    {
+#ifdef HEADLESS_EGL
+        auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+        auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (queryDevices != nullptr && getPlatformDisplay != nullptr)
+        {
+            EGLDeviceEXT devices[8];
+            EGLint deviceCount = 0;
+            queryDevices(8, devices, &deviceCount);
+            for (EGLint i = 0; i < deviceCount; i++)
+            {
+                if (tryDisplay(getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr), width, height))
+                    return true;
+            }
+        }
+        if (tryDisplay(eglGetDisplay(EGL_DEFAULT_DISPLAY), width, height))
+            return true;
+        std::cerr << "Could not create a headless EGL context" << std::endl;
+        return false;
+#else
+        (void)width;
+        (void)height;
+        std::cerr << "Headless contexts need EGL, which this build does not have" << std::endl;
+        return false;
+#endif
+    }
+
+    // presents the pbuffer (nothing to see, but it ends the frame like a window's swap would)
+    void swapBuffers()
+    {
+#ifdef HEADLESS_EGL
+        eglSwapBuffers(display, surface);
+#endif
+    }
+
+    void destroy()
+    {
+#ifdef HEADLESS_EGL
+        if (display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        if (surface != EGL_NO_SURFACE)
+            eglDestroySurface(display, surface);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+        surface = EGL_NO_SURFACE;
+#endif
+    }
+
+    // OpenGL function loader for GLAD
+    static void* getProcAddress(const char* name)
+    {
+#ifdef HEADLESS_EGL
+        return reinterpret_cast<void*>(eglGetProcAddress(name));
+#else
+        (void)name;
+        return nullptr;
+#endif
+    }
+
+private:
+#ifdef HEADLESS_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+
+    bool tryDisplay(EGLDisplay candidate, int width, int height)
+    {
+        if (candidate == EGL_NO_DISPLAY || !eglInitialize(candidate, nullptr, nullptr))
+            return false;
+        display = candidate;
+
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE
+        };
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (eglChooseConfig(display, configAttributes, &config, 1, &configCount) && configCount > 0 && eglBindAPI(EGL_OPENGL_API))
+        {
+            surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+            if (surface != EGL_NO_SURFACE)
+                context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+            if (context != EGL_NO_CONTEXT && eglMakeCurrent(display, surface, surface, context))
+                return true;
+        }
+        destroy();
+        return false;
+    }
+#endif
+};
+#endif
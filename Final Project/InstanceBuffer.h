@@ -0,0 +1,92 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GeometryArena.h"
+
+// Per-instance model matrices for the instanced draw path (Model::DrawInstanced).
+// The buffer is rewritten every frame, so each update orphans the old storage instead of waiting
+// for the GPU to finish reading it. update() copies the transforms from memory; map() lets them be
+// generated straight into the buffer.
+class InstanceBuffer
+{
+public:
+    InstanceBuffer()
+    {
+        glGenBuffers(1, &buffer);
+    }
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // replaces the instance transforms. Render thread only.
+    void update(const glm::mat4* transforms, GLsizei count)
+    {
+        if (count > capacity)
+            capacity = count;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(capacity) * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        if (count > 0)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, GLsizeiptr(count) * sizeof(glm::mat4), glm::value_ptr(transforms[0]));
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        instanceCount = count;
+    }
+
+    // orphans the storage and maps room for count transforms, to be written in place (from any thread)
+    // until unmap(); nothing else may touch the buffer meanwhile. Render thread only.
+    glm::mat4* map(GLsizei count)
+    {
+        if (count > capacity)
+            capacity = count;
+        instanceCount = count;
+        if (count == 0)
+            return nullptr;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(capacity) * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, GLsizeiptr(count) * sizeof(glm::mat4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (mapped == nullptr)
+            instanceCount = 0;
+        return static_cast<glm::mat4*>(mapped);
+    }
+
+    // finishes the writes of map(). If the driver lost the mapped contents, the buffer draws nothing.
+    void unmap()
+    {
+        if (instanceCount == 0)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE)
+            instanceCount = 0;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    GLuint id() const
+    {
+        return buffer;
+    }
+
+    // instances written by the last update
+    GLsizei count() const
+    {
+        return instanceCount;
+    }
+
+    // deletes the buffer (for cleanup)
+    void clean()
+    {
+        GeometryArena::forgetInstanceBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+private:
+    GLuint buffer = 0;
+    GLsizei capacity = 0;
+    GLsizei instanceCount = 0;
+};
+#endif
@@ -0,0 +1,388 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the unfinished jobs of a group. Jobs started with a counter increment it when they are queued and
+// decrement it when they finish; jobs queued with runAfter() wait for it to reach zero. A counter must
+// outlive the jobs that use it.
+class JobCounter
+{
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    // a waiter may see the count reach zero while the last job is still releasing the continuations
+    ~JobCounter()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+
+    bool done() const
+    {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+    size_t value() const
+    {
+        return pending.load(std::memory_order_acquire);
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<size_t> pending{ 0 };
+    std::mutex mutex;
+    std::vector<std::function<void()>> continuations;   // queued by runAfter() until pending is zero
+};
+
+// Engine-wide task scheduler.
+// Every worker thread owns a deque of jobs: it pushes and pops its own jobs at the back (newest first, still
+// warm in its cache) and, when that runs dry, steals the oldest job from the front of another worker's deque.
+// Jobs queued from outside the workers are dealt round-robin into the deques. Waiting for a counter or a
+// parallelFor runs other jobs instead of blocking, so jobs may wait on jobs. Anything that calls OpenGL goes
+// to the main thread queue, which the thread that called start() (the one with the context) empties with
+// pumpMainThread(). The deques are short mutex-guarded critical sections rather than lock-free: the jobs
+// here are coarse (imports, decodes, slices of thousands of bodies), so the locks are never the bottleneck.
+class JobSystem
+{
+public:
+    struct Stats {
+        uint64_t jobs = 0;      // jobs run by the workers and by waiting threads
+        uint64_t steals = 0;    // of those, jobs taken from another worker's deque
+    };
+
+    static JobSystem& instance()
+    {
+        static JobSystem jobSystem;
+        return jobSystem;
+    }
+
+    // one worker per core, leaving a core for the render thread
+    static unsigned int defaultWorkerCount()
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    // starts the workers (restarting them if they run) and makes the calling thread the main thread.
+    // With 0 workers every job runs on the thread that queues or waits for it.
+    void start(unsigned int workerCount = defaultWorkerCount())
+    {
+        stopWorkers();
+        mainThread = std::this_thread::get_id();
+        stopping = false;
+        for (unsigned int i = 0; i < workerCount; i++)
+            queues.emplace_back(new WorkerQueue());
+        for (unsigned int i = 0; i < workerCount; i++)
+            workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+
+    // stops the workers once they have run every queued job; main thread jobs are dropped. Jobs queued
+    // afterwards run right away on the queuing thread.
+    void shutdown()
+    {
+        stopWorkers();
+        std::lock_guard<std::mutex> lock(mainThreadMutex);
+        mainThreadJobs.clear();
+    }
+
+    unsigned int workerCount() const
+    {
+        return unsigned(workers.size());
+    }
+
+    // threads that take part in a parallelFor: the workers and the calling thread
+    unsigned int threadCount() const
+    {
+        return workerCount() + 1;
+    }
+
+    bool isMainThread() const
+    {
+        return std::this_thread::get_id() == mainThread;
+    }
+
+    // queues a job for a worker. The job must not call OpenGL; use runOnMainThread for that.
+    void run(std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        push(Job{ std::move(job), counter });
+    }
+
+    // queues a job once every job counted by dependency has finished (right away if none are left)
+    void runAfter(JobCounter& dependency, std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (!dependency.done())
+            {
+                dependency.continuations.push_back([this, job, counter]() { push(Job{ job, counter }); });
+                return;
+            }
+        }
+        push(Job{ std::move(job), counter });
+    }
+
+    // queues a job that runs on the main thread during pumpMainThread
+    void runOnMainThread(std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mainThreadMutex);
+        mainThreadJobs.push_back(Job{ std::move(job), counter });
+    }
+
+    // runs queued main thread jobs until the queue is empty or the budget is used up. At least one job
+    // runs per call so the queue always makes progress. Main thread only.
+    void pumpMainThread(double budgetMilliseconds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (runMainThreadJob())
+        {
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMilliseconds)
+                return;
+        }
+    }
+
+    // returns once every job counted by counter has finished, running queued jobs meanwhile. With
+    // runMainThreadJobs the main thread runs its own queue too, which it must when waiting for jobs of it.
+    void wait(JobCounter& counter, bool runMainThreadJobs = false)
+    {
+        while (!counter.done())
+        {
+            if (runMainThreadJobs && isMainThread() && runMainThreadJob())
+                continue;
+            if (!runOneJob(currentWorker()))
+                std::this_thread::yield();
+        }
+    }
+
+    // runs body(begin, end) over [0, count) in ranges of about grain items, spread over the workers and
+    // the calling thread, and returns when every range is done. Ranges are claimed from a shared cursor,
+    // so threads that finish early take more of them.
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+    {
+        grain = std::max<size_t>(grain, 1);
+        size_t ranges = (count + grain - 1) / grain;
+        if (ranges <= 1 || workers.empty())
+        {
+            if (count > 0)
+                body(0, count);
+            return;
+        }
+
+        // one job per helping worker; each claims ranges until none are left
+        std::shared_ptr<std::atomic<size_t>> next = std::make_shared<std::atomic<size_t>>(0);
+        auto claim = [next, count, grain, ranges, &body]() {
+            for (size_t range = next->fetch_add(1); range < ranges; range = next->fetch_add(1))
+                body(range * grain, std::min(count, (range + 1) * grain));
+        };
+        JobCounter helpers;
+        size_t helperCount = std::min<size_t>(workers.size(), ranges - 1);
+        for (size_t i = 0; i < helperCount; i++)
+            run(claim, &helpers);
+        claim();
+        wait(helpers);
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.jobs = jobsRun.load(std::memory_order_relaxed);
+        stats.steals = jobsStolen.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobCounter* counter;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::thread::id mainThread = std::this_thread::get_id();
+
+    // sleeping workers wait here until a job is queued
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<unsigned int> nextQueue{ 0 };
+    bool stopping = false;
+
+    std::mutex mainThreadMutex;
+    std::deque<Job> mainThreadJobs;
+
+    std::atomic<uint64_t> jobsRun{ 0 };
+    std::atomic<uint64_t> jobsStolen{ 0 };
+
+    JobSystem() = default;
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    ~JobSystem()
+    {
+        stopWorkers();
+    }
+
+    // index of the worker the calling thread is, -1 for other threads
+    static int& currentWorker()
+    {
+        static thread_local int worker = -1;
+        return worker;
+    }
+
+    void push(Job job)
+    {
+        if (queues.empty())
+        {
+            execute(job);
+            return;
+        }
+        // a worker keeps its own jobs, everyone else deals them out
+        int worker = currentWorker();
+        size_t target = worker >= 0 ? size_t(worker) : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->jobs.push_back(std::move(job));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            // taken so a worker between its last check and its wait cannot miss the notification
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // pops a job from the worker's own deque, or steals one; false if every deque is empty
+    bool takeJob(int worker, Job& job)
+    {
+        size_t queueCount = queues.size();
+        if (queueCount == 0)
+            return false;
+        if (worker >= 0)
+        {
+            WorkerQueue& own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        size_t first = worker >= 0 ? size_t(worker) + 1 : nextQueue.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < queueCount; i++)
+        {
+            size_t victim = (first + i) % queueCount;
+            if (int(victim) == worker)
+                continue;
+            WorkerQueue& other = *queues[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.jobs.empty())
+            {
+                job = std::move(other.jobs.front());
+                other.jobs.pop_front();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                jobsStolen.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool runOneJob(int worker)
+    {
+        Job job;
+        if (!takeJob(worker, job))
+            return false;
+        execute(job);
+        return true;
+    }
+
+    bool runMainThreadJob()
+    {
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(mainThreadMutex);
+            if (mainThreadJobs.empty())
+                return false;
+            job = std::move(mainThreadJobs.front());
+            mainThreadJobs.pop_front();
+        }
+        execute(job);
+        return true;
+    }
+
+    void execute(Job& job)
+    {
+        job.function();
+        jobsRun.fetch_add(1, std::memory_order_relaxed);
+        if (job.counter != nullptr)
+            finish(*job.counter);
+    }
+
+    // counts a job of the counter as done, releasing the jobs waiting for the counter when it was the last
+    void finish(JobCounter& counter)
+    {
+        std::vector<std::function<void()>> continuations;
+        {
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            continuations.swap(counter.continuations);
+        }
+        for (std::function<void()>& continuation : continuations)
+            continuation();
+    }
+
+    void workerLoop(unsigned int worker)
+    {
+        currentWorker() = int(worker);
+        for (;;)
+        {
+            if (runOneJob(int(worker)))
+                continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            if (stopping && queued.load(std::memory_order_acquire) == 0)
+                return;
+        }
+    }
+
+    void stopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+        // without workers, jobs run where they are queued
+        queues.clear();
+    }
+};
+#endif
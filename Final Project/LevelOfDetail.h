@@ -0,0 +1,114 @@
+#ifndef LEVEL_OF_DETAIL_H
+#define LEVEL_OF_DETAIL_H
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// one level of detail of a mesh: a range of the mesh's index buffer, all levels share its vertices
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;        // how far the level's surface may be from the full detail one, in mesh units
+};
+
+// Picks LOD levels from their projected screen-space error.
+// A draw gets a detail scale: the size of one mesh unit in pixels divided by the error allowed on screen.
+// The coarsest level whose error times the scale is at most 1 is drawn; FULL_DETAIL always draws level 0.
+class LevelOfDetail
+{
+public:
+    static constexpr float FULL_DETAIL = FLT_MAX;
+
+    struct Stats {
+        uint64_t drawCalls = 0;             // mesh draw calls
+        uint64_t triangles = 0;             // triangles submitted
+        uint64_t fullDetailTriangles = 0;   // the same draws at full detail
+    };
+
+    static LevelOfDetail& instance()
+    {
+        static LevelOfDetail lod;
+        return lod;
+    }
+
+    // detail scale of a model drawn with modelMatrix and seen from eye through a projection whose
+    // projection[1][1] is projectionScaleY into a viewport viewportHeight pixels high. The distance is taken
+    // to the nearest point of the model's bounding sphere, so the error is never underestimated.
+    static float detailScale(const glm::mat4& modelMatrix, const BoundingSphere& localSphere, const glm::vec3& eye,
+        float projectionScaleY, float viewportHeight, float maxPixelError)
+    {
+        float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+        glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(localSphere.center, 1.0f));
+        float distance = glm::length(center - eye) - localSphere.radius * scale;
+        return detailScale(scale, distance, projectionScaleY, viewportHeight, maxPixelError);
+    }
+
+    // the same for a mesh unit of worldScale world units at the given distance from the eye
+    static float detailScale(float worldScale, float distance, float projectionScaleY, float viewportHeight, float maxPixelError)
+    {
+        if (distance <= 0.0f || maxPixelError <= 0.0f)
+            return FULL_DETAIL;
+        float pixelsPerUnit = 0.5f * viewportHeight * projectionScaleY / distance;
+        return pixelsPerUnit * worldScale / maxPixelError;
+    }
+
+    // index of the level to draw at a detail scale
+    static size_t select(const std::vector<MeshLod>& lods, float detailScale)
+    {
+        size_t level = 0;
+        while (level + 1 < lods.size() && lods[level + 1].error * detailScale <= 1.0f)
+            level++;
+        return level;
+    }
+
+    // counts a draw of level of lods, instanceCount times
+    void submitted(const std::vector<MeshLod>& lods, size_t level, uint64_t instanceCount)
+    {
+        frame.drawCalls++;
+        frame.triangles += lods[level].indexCount / 3 * instanceCount;
+        frame.fullDetailTriangles += lods[0].indexCount / 3 * instanceCount;
+    }
+
+    // counts an indirect draw call. Its levels and instance counts are picked on the GPU (see GpuCulling),
+    // so its triangles are not counted.
+    void submittedIndirect()
+    {
+        frame.drawCalls++;
+    }
+
+    // starts a new frame of counters; the finished frame is kept for getLastFrameStats()
+    void beginFrame()
+    {
+        lastFrame = frame;
+        total.drawCalls += frame.drawCalls;
+        total.triangles += frame.triangles;
+        total.fullDetailTriangles += frame.fullDetailTriangles;
+        frames++;
+        frame = Stats();
+    }
+
+    Stats getLastFrameStats() const
+    {
+        return lastFrame;
+    }
+
+    void printStats() const
+    {
+        if (frames == 0)
+            return;
+        std::cout << "Triangles per frame: " << double(total.triangles) / frames << " submitted, "
+            << double(total.fullDetailTriangles) / frames << " at full detail, in " << double(total.drawCalls) / frames << " draw calls (" << frames << " frames)" << std::endl;
+    }
+
+private:
+    Stats frame, lastFrame, total;
+    uint64_t frames = 0;
+};
+#endif
@@ -0,0 +1,353 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Shader.h"
+#include "UniformBlocks.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// a point light without shadows, faded to zero at its radius
+struct PointLightSource {
+    glm::vec3 position;     // world space
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// Clustered forward lighting.
+// The view frustum is split into TILES_X x TILES_Y screen tiles and SLICES exponential depth slices
+// (froxels). Every frame update() bins the lights into the clusters their sphere touches on the CPU, in
+// blocks of lights spread over the JobSystem, and uploads three buffer textures: the light data (two texels per light: position + radius, color +
+// intensity), an offset + count pair per cluster, and the light indices the pairs point into. main.fsh
+// finds its cluster from gl_FragCoord, with the lookup constants of the LightData block (writeLookup), and
+// loops over that cluster's lights only. Render thread only.
+class LightClusters
+{
+public:
+    static constexpr int TILES_X = 16;
+    static constexpr int TILES_Y = 9;
+    static constexpr int SLICES = 24;
+    static constexpr int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+    static constexpr size_t MAX_LIGHTS = 65535;     // light indices are 16 bit
+    static constexpr size_t LIGHTS_PER_JOB = 256;
+
+    struct Stats {
+        size_t lights = 0;          // lights in front of the camera
+        size_t indices = 0;         // light x cluster pairs
+        size_t occupiedClusters = 0;
+        double binningMs = 0.0;     // CPU time of the last update()
+    };
+
+    LightClusters()
+    {
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glGenTextures(BUFFER_COUNT, textures);
+        static const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            // a buffer texture needs a data store, even an empty frame uploads one element
+            upload(buffers[i], nullptr, 16);
+            GLState::instance().bindTextureForUpdate(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+    }
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // bins the lights for a camera and uploads the cluster buffers. projection must be a perspective
+    // projection; the viewport is the one the main pass is drawn into.
+    void update(const std::vector<PointLightSource>& lights, const glm::mat4& view, const glm::mat4& projection, float viewportWidth, float viewportHeight)
+    {
+        auto start = std::chrono::steady_clock::now();
+        setProjection(projection);
+        width = viewportWidth;
+        height = viewportHeight;
+
+        // light data, and (cluster, light) pairs of every light touching a cluster, per block of lights
+        size_t lightCount = std::min(lights.size(), MAX_LIGHTS);
+        size_t blockCount = (lightCount + LIGHTS_PER_JOB - 1) / LIGHTS_PER_JOB;
+        lightData.resize(lightCount * 2);
+        if (blocks.size() < blockCount)
+            blocks.resize(blockCount);
+        JobSystem::instance().parallelFor(blockCount, 1, [&](size_t firstBlock, size_t endBlock) {
+            for (size_t b = firstBlock; b < endBlock; b++)
+            {
+                LightBlock& block = blocks[b];
+                block.pairs.clear();
+                block.visibleLights = 0;
+                for (size_t i = b * LIGHTS_PER_JOB; i < std::min(lightCount, (b + 1) * LIGHTS_PER_JOB); i++)
+                {
+                    const PointLightSource& light = lights[i];
+                    lightData[i * 2] = glm::vec4(light.position, light.radius);
+                    lightData[i * 2 + 1] = glm::vec4(light.color, light.intensity);
+
+                    glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+                    if (binLight(uint32_t(i), center, light.radius, block.pairs))
+                        block.visibleLights++;
+                }
+            }
+        });
+
+        // counting sort of the pairs by cluster, the blocks in light order as a single pass would have them
+        uint32_t visibleLights = 0;
+        size_t pairCount = 0;
+        std::fill(ranges.begin(), ranges.end(), ClusterRange());
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            visibleLights += blocks[b].visibleLights;
+            pairCount += blocks[b].pairs.size();
+            for (const ClusterLight& pair : blocks[b].pairs)
+                ranges[pair.cluster].count++;
+        }
+        uint32_t offset = 0;
+        stats.occupiedClusters = 0;
+        for (ClusterRange& range : ranges)
+        {
+            range.offset = offset;
+            offset += range.count;
+            if (range.count > 0)
+                stats.occupiedClusters++;
+        }
+        indices.resize(pairCount);
+        std::vector<uint32_t>& cursor = scratch;
+        cursor.assign(CLUSTER_COUNT, 0);
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            for (const ClusterLight& pair : blocks[b].pairs)
+                indices[ranges[pair.cluster].offset + cursor[pair.cluster]++] = uint16_t(pair.light);
+        }
+
+        upload(buffers[BUFFER_LIGHTS], lightData.data(), lightData.size() * sizeof(glm::vec4));
+        upload(buffers[BUFFER_RANGES], ranges.data(), ranges.size() * sizeof(ClusterRange));
+        upload(buffers[BUFFER_INDICES], indices.data(), indices.size() * sizeof(uint16_t));
+
+        stats.lights = visibleLights;
+        stats.indices = indices.size();
+        stats.binningMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // fills in the cluster lookup of the frame's LightData block, for the camera of the last update()
+    void writeLookup(LightData& light) const
+    {
+        light.clusterTileScale = glm::vec2(TILES_X / width, TILES_Y / height);
+        light.clusterSliceScale = sliceScale;
+        light.clusterNear = nearPlane;
+        light.clusterFar = farPlane;
+    }
+
+    // binds the cluster buffers to the shader's cluster samplers. Shaders without the clustered
+    // lighting samplers are left alone.
+    void bind(Shader& shader)
+    {
+        static const UniformId samplers[BUFFER_COUNT] = { UniformId("clusterLightData"), UniformId("clusterRanges"), UniformId("clusterLightIndices") };
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            Shader::SamplerBinding binding;
+            if (shader.findSampler(samplers[i], binding))
+                GLState::instance().bindTexture(binding.unit, GL_TEXTURE_BUFFER, textures[i]);
+        }
+    }
+
+    Stats lastStats() const
+    {
+        return stats;
+    }
+
+    void clean()
+    {
+        for (GLuint texture : textures)
+            GLState::instance().forgetTexture(texture);
+        glDeleteTextures(BUFFER_COUNT, textures);
+        glDeleteBuffers(BUFFER_COUNT, buffers);
+    }
+
+private:
+    enum Buffer {
+        BUFFER_LIGHTS,
+        BUFFER_RANGES,
+        BUFFER_INDICES,
+        BUFFER_COUNT
+    };
+
+    struct ClusterLight {
+        uint32_t cluster;
+        uint32_t light;
+    };
+
+    // the pairs binned by one job
+    struct LightBlock {
+        std::vector<ClusterLight> pairs;
+        uint32_t visibleLights = 0;
+    };
+
+    // one RG32UI texel of the ranges buffer
+    struct ClusterRange {
+        uint32_t offset = 0;
+        uint32_t count = 0;
+    };
+
+    GLuint buffers[BUFFER_COUNT];
+    GLuint textures[BUFFER_COUNT];
+
+    // projection the cluster boxes were built for
+    glm::mat4 clusterProjection = glm::mat4(0.0f);
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    float sliceScale = 1.0f;        // SLICES / log(far / near)
+    float width = 1.0f, height = 1.0f;
+    std::vector<glm::vec3> clusterMin, clusterMax;  // view space boxes
+
+    std::vector<glm::vec4> lightData;
+    std::vector<LightBlock> blocks;
+    std::vector<ClusterRange> ranges = std::vector<ClusterRange>(CLUSTER_COUNT);
+    std::vector<uint16_t> indices;
+    std::vector<uint32_t> scratch;
+    Stats stats;
+
+    static int clusterIndex(int x, int y, int slice)
+    {
+        return x + TILES_X * (y + TILES_Y * slice);
+    }
+
+    // view depth at the start of a slice
+    float sliceDepth(int slice) const
+    {
+        return nearPlane * std::pow(farPlane / nearPlane, float(slice) / SLICES);
+    }
+
+    int sliceOf(float depth) const
+    {
+        int slice = int(std::floor(std::log(depth / nearPlane) * sliceScale));
+        return std::max(0, std::min(SLICES - 1, slice));
+    }
+
+    // NDC x or y of a view space coordinate at a depth, for an axis of the projection
+    float toNdc(int axis, float coordinate, float depth) const
+    {
+        return clusterProjection[axis][axis] * coordinate / depth - clusterProjection[2][axis];
+    }
+
+    // rebuilds the view space cluster boxes when the projection changes
+    void setProjection(const glm::mat4& projection)
+    {
+        if (projection == clusterProjection)
+            return;
+        clusterProjection = projection;
+        // near and far back out of the depth row of a perspective projection
+        nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+        sliceScale = SLICES / std::log(farPlane / nearPlane);
+
+        clusterMin.resize(CLUSTER_COUNT);
+        clusterMax.resize(CLUSTER_COUNT);
+        for (int slice = 0; slice < SLICES; slice++)
+        {
+            float depths[2] = { sliceDepth(slice), sliceDepth(slice + 1) };
+            for (int y = 0; y < TILES_Y; y++)
+            {
+                for (int x = 0; x < TILES_X; x++)
+                {
+                    glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+                    for (float depth : depths)
+                    {
+                        for (int corner = 0; corner < 4; corner++)
+                        {
+                            // the view space point of this NDC tile corner at the depth
+                            float ndcX = -1.0f + 2.0f * float(x + (corner & 1)) / TILES_X;
+                            float ndcY = -1.0f + 2.0f * float(y + (corner >> 1)) / TILES_Y;
+                            glm::vec3 point(depth * (ndcX + projection[2][0]) / projection[0][0],
+                                depth * (ndcY + projection[2][1]) / projection[1][1], -depth);
+                            low = glm::min(low, point);
+                            high = glm::max(high, point);
+                        }
+                    }
+                    int cluster = clusterIndex(x, y, slice);
+                    clusterMin[cluster] = low;
+                    clusterMax[cluster] = high;
+                }
+            }
+        }
+    }
+
+    // adds a pair to pairs for every cluster the light's view space sphere touches. Returns false if it touches none.
+    bool binLight(uint32_t light, const glm::vec3& center, float radius, std::vector<ClusterLight>& pairs) const
+    {
+        float nearDepth = -center.z - radius;
+        float farDepth = -center.z + radius;
+        if (farDepth < nearPlane || nearDepth > farPlane)
+            return false;
+        nearDepth = std::max(nearDepth, nearPlane);
+        farDepth = std::min(farDepth, farPlane);
+
+        // screen rectangle of the sphere's box, from its corners at the nearest and farthest depth
+        glm::vec2 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+        for (float depth : { nearDepth, farDepth })
+        {
+            for (float dx : { -radius, radius })
+            {
+                float ndcX = toNdc(0, center.x + dx, depth);
+                ndcMin.x = std::min(ndcMin.x, ndcX);
+                ndcMax.x = std::max(ndcMax.x, ndcX);
+            }
+            for (float dy : { -radius, radius })
+            {
+                float ndcY = toNdc(1, center.y + dy, depth);
+                ndcMin.y = std::min(ndcMin.y, ndcY);
+                ndcMax.y = std::max(ndcMax.y, ndcY);
+            }
+        }
+        if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+            return false;
+
+        int x0 = std::max(0, int((ndcMin.x + 1.0f) * 0.5f * TILES_X));
+        int x1 = std::min(TILES_X - 1, int((ndcMax.x + 1.0f) * 0.5f * TILES_X));
+        int y0 = std::max(0, int((ndcMin.y + 1.0f) * 0.5f * TILES_Y));
+        int y1 = std::min(TILES_Y - 1, int((ndcMax.y + 1.0f) * 0.5f * TILES_Y));
+        int slice0 = sliceOf(nearDepth);
+        int slice1 = sliceOf(farDepth);
+
+        bool touched = false;
+        float radiusSquared = radius * radius;
+        for (int slice = slice0; slice <= slice1; slice++)
+        {
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    // exact sphere against cluster box test
+                    int cluster = clusterIndex(x, y, slice);
+                    glm::vec3 closest = glm::max(clusterMin[cluster], glm::min(center, clusterMax[cluster]));
+                    glm::vec3 offset = closest - center;
+                    if (glm::dot(offset, offset) > radiusSquared)
+                        continue;
+                    pairs.push_back({ uint32_t(cluster), light });
+                    touched = true;
+                }
+            }
+        }
+        return touched;
+    }
+
+    // replaces a buffer's contents, orphaning the old storage
+    static void upload(GLuint buffer, const void* data, size_t bytes)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(std::max<size_t>(bytes, 16)), nullptr, GL_STREAM_DRAW);
+        if (bytes > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, GLsizeiptr(bytes), data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+#endif
@@ -3,14 +3,35 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 // Local header files for shaders and models
 #include "Shader.h"
 #include "Model.h"
+#include "AppOptions.h"
+#include "AsteroidBelt.h"
+#include "Benchmark.h"
+#include "BoundingVolumeHierarchy.h"
+#include "ComponentBenchmarks.h"
+#include "GpuCulling.h"
+#include "HeadlessContext.h"
+#include "InstanceBuffer.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "Profiler.h"
+#include "SceneGraph.h"
+#include "SceneSetup.h"
+#include "ShadowFaceCache.h"
+#include "ShadowFilter.h"
+#include "ShadowPass.h"
+#include "ShaderVariants.h"
+#include "UniformBlocks.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -39,6 +60,16 @@ void scroll_zoom(GLFWwindow* window, double xOffset, double yOffset);
 void processInput(GLFWwindow *window);
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
+/// <summary>
+/// Moves a body's leaf in the culling BVH to its current world bounds, inserting the leaf the first time
+/// the bounds are known (models have none until they finish loading).
+/// </summary>
+/// <param name="bvh">Culling BVH of the scene</param>
+/// <param name="leaf">The body's leaf, or BoundingVolumeHierarchy::NO_NODE if it has none yet</param>
+/// <param name="body">Item stored in the leaf</param>
+/// <param name="worldBounds">World space bounds of the body this frame</param>
+void UpdateBodyBounds(BoundingVolumeHierarchy& bvh, uint32_t& leaf, uint32_t body, const AABB& worldBounds);
+
 // camera variables
 glm::vec3 cameraPos = glm::vec3(0.0f, 2.0f, 5.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -48,6 +79,16 @@ float lastframe = 0.0f;
 bool followCameraIsEnabled = false;
 glm::mat4 earthModelMatrix = glm::mat4(1.0f);
 
+// shadow filter quality, cycled with T
+ShadowFilter shadowFilter;
+
+// profiler overlay, toggled with P; the window title shows the numbers while it is on
+const char* windowTitle = "Co Valenzuela Final Project";
+bool profilerOverlay = false;
+
+// ends the render loop; the in-loop benchmarks set it when they are done, and without a window it is the only way out
+bool exitRequested = false;
+
 // mouse input variables
 bool firstMouse = true;
 float yaw = -90.0f;
@@ -56,73 +97,181 @@ float lastX = 800.0f / 2.0;
 float lastY = 600.0f / 2.0;
 float fov = 45.0f;
 
+// uniform names, hashed at compile time
+constexpr UniformId modelMatrixUniform("modelMatrix");
+
 /// <summary>
 /// Main function.
 /// </summary>
+/// <param name="argc">Number of command line arguments</param>
+/// <param name="argv">Command line arguments, read into AppOptions. "--bake" rebuilds the mesh caches and texture containers of every model
+/// and exits ("--uncompressed" keeps the textures uncompressed). "--compare-textures" prints the texture loading comparison and exits.
+/// "--texture-budget-mb N" sets the GPU memory budget of the texture cache.
+/// "--vertex-format float|half|snorm16" selects the GPU vertex layout of the models.
+/// "--stress-instances N" adds an instanced asteroid belt and doubles its size from 1024 up to N instances, printing the frame time of each step.
+/// "--gpu-culling" culls and draws the belt on the GPU with a compute shader and multi-draw indirect where the context has OpenGL 4.3;
+/// "--benchmark-gpu-culling N" compares that with the CPU path for up to N instances and exits.
+/// "--benchmark-orbits N" prints the orbit propagation throughput of every kernel and thread count for up to N bodies and exits.
+/// "--job-workers N" sets the worker threads of the job system (one per core but one by default); "--benchmark-jobs N" times
+/// the parallel workloads with 1 up to N threads and exits.
+/// "--no-program-cache" compiles every shader program instead of loading its binary from ShaderCache; "--benchmark-shaders"
+/// prints the shader startup time with an empty and a filled program cache and exits.
+/// "--shadow-backend gs|layered|six-pass" selects how the shadow cube map is rendered; "--benchmark-shadows" times every back-end on the Moon and exits.
+/// "--lights N" adds N unshadowed point lights around the Sun, shaded with clustered forward lighting; "--benchmark-lights" doubles
+/// the light count from 1 up to N (1024 by default), prints the frame time of each step and exits.
+/// "--shadow-taps 1|4|8|20" selects the shadow filter tier and "--no-shadow-early-out" always takes the whole kernel;
+/// "--benchmark-shadow-filter" prints the frame time of every tier against the 20 tap kernel and exits.
+/// "--lod-error PIXELS" and "--shadow-lod-error TEXELS" set the screen-space error the levels of detail may have in the main
+/// and the shadow pass (1 by default); "--no-lod" always draws full detail.
+/// "--profile" times the passes and model draws on the CPU and GPU and prints their statistics on exit; "--profile-overlay"
+/// also shows them on screen (P toggles it), "--profile-trace FILE" writes the profiled frames as a Chrome trace and
+/// "--profile-csv FILE" the statistics as CSV.
+/// "--benchmark" renders a fixed number of frames offscreen (through EGL when the build has it, otherwise in a hidden window)
+/// with a fixed timestep and a scripted camera, then writes a JSON report and exits. "--benchmark-frames N" (600) and
+/// "--benchmark-warmup N" (60) set the frames measured and skipped, "--benchmark-timestep SECONDS" the timestep (1/60),
+/// "--benchmark-report FILE" the report (benchmark.json) and "--camera-script FILE" the camera path (see CameraScript).</param>
 /// <returns>An integer indicating whether the program ended successfully or not.
 /// A value of 0 indicates the program ended succesfully, while a non-zero value indicates
 /// something wrong happened during execution.</returns>
-int main()
+int main(int argc, char* argv[])
 {
-	// Initialize GLFW
-	int glfwInitStatus = glfwInit();
-	if (glfwInitStatus == GLFW_FALSE)
+	// The settings of the run; those of the global subsystems are handed over before anything uses them
+	AppOptions options = AppOptions::parse(argc, argv);
+	VertexFormat::defaultLayout() = options.vertexLayout;
+	ProgramCache::enabled() = options.programCache;
+	shadowFilter.setQuality(options.shadowQuality);
+	shadowFilter.setEarlyOut(options.shadowEarlyOut);
+	profilerOverlay = options.profileOverlay;
+
+	// Loading, orbits and light binning run on the job system; this thread is its main thread, the one with the context
+	JobSystem::instance().start(options.jobWorkers);
+
+	// Offline bake step: import every model with ASSIMP, write its mesh cache and texture containers, no window needed
+	if (options.bake)
 	{
-		std::cerr << "Failed to initialize GLFW!" << std::endl;
-		return 1;
+		bool baked = Model::Bake("Models/Earth/scene.gltf", options.compressTextures);
+		baked = Model::Bake("Models/Sun/scene.gltf", options.compressTextures) && baked;
+		baked = Model::Bake("Models/Moon/scene.gltf", options.compressTextures) && baked;
+		return baked ? 0 : 1;
 	}
 
-	// Tell GLFW that we prefer to use OpenGL 3.3
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-
-	// Tell GLFW that we prefer to use the modern OpenGL
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-	// Tell GLFW to create a window
 	float windowWidth = 1366;
 	float windowHeight = 768;
-	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Co Valenzuela Final Project", nullptr, nullptr);
-	if (window == nullptr)
+	GLFWwindow* window = nullptr;
+
+	// The benchmark renders offscreen through EGL where it can, so it runs without a display too
+	HeadlessContext headless;
+	bool headlessContext = options.benchmark && headless.create(int(windowWidth), int(windowHeight));
+	if (headlessContext)
 	{
-		std::cerr << "Failed to create GLFW window!" << std::endl;
-		glfwTerminate();
-		return 1;
+		// Tell GLAD to load the OpenGL function pointers
+		if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(HeadlessContext::getProcAddress)))
+		{
+			std::cerr << "Failed to initialize GLAD!" << std::endl;
+			return 1;
+		}
+		GLCapabilities::setProcLoader(HeadlessContext::getProcAddress);
 	}
-	//for spacebar input
-	glfwSetKeyCallback(window, keyCallback);
-	// hide the cursor
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	else
+	{
+		// Initialize GLFW
+		int glfwInitStatus = glfwInit();
+		if (glfwInitStatus == GLFW_FALSE)
+		{
+			std::cerr << "Failed to initialize GLFW!" << std::endl;
+			return 1;
+		}
+
+		// Tell GLFW that we prefer to use OpenGL 3.3
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+
+		// Tell GLFW that we prefer to use the modern OpenGL
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+		// Tell GLFW to create a window (a hidden one for the benchmark)
+		if (options.benchmark)
+			glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(windowWidth, windowHeight, windowTitle, nullptr, nullptr);
+		if (window == nullptr)
+		{
+			std::cerr << "Failed to create GLFW window!" << std::endl;
+			glfwTerminate();
+			return 1;
+		}
+		//for spacebar input
+		glfwSetKeyCallback(window, keyCallback);
+		// hide the cursor
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-	// call the mouse input method whenever the cursor is moved on the window
-	glfwSetCursorPosCallback(window, mouse_input);
+		// call the mouse input method whenever the cursor is moved on the window
+		glfwSetCursorPosCallback(window, mouse_input);
 
-	//call the scroll zoom method whenever the user scrolls
-	glfwSetScrollCallback(window, scroll_zoom);
+		//call the scroll zoom method whenever the user scrolls
+		glfwSetScrollCallback(window, scroll_zoom);
 
-	// Tell GLFW to use the OpenGL context that was assigned to the window that we just created
-	glfwMakeContextCurrent(window);
+		// Tell GLFW to use the OpenGL context that was assigned to the window that we just created
+		glfwMakeContextCurrent(window);
 
-	// Register the callback function that handles when the framebuffer size has changed
-	glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+		// Don't let vsync cap the frame times the stress scene measures
+		if (options.measuresFrames())
+			glfwSwapInterval(0);
+
+		// Register the callback function that handles when the framebuffer size has changed
+		glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+
+		// Tell GLAD to load the OpenGL function pointers
+		if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+		{
+			std::cerr << "Failed to initialize GLAD!" << std::endl;
+			return 1;
+		}
+		GLCapabilities::setProcLoader(reinterpret_cast<GLCapabilities::ProcLoader>(glfwGetProcAddress));
+	}
+
+	// The component benchmarks run instead of the scene
+	if (RunComponentBenchmark(options, shadowFilter.features()))
+	{
+		glfwTerminate();
+		return 0;
+	}
 
-	// Tell GLAD to load the OpenGL function pointers
-	if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+	// The GPU-driven belt needs compute shaders and multi-draw indirect, and its buffers have a size limit
+	size_t stressInstances = options.stressInstances;
+	bool gpuCulling = options.gpuCulling;
+	if (gpuCulling && !GpuCulling::supported())
+	{
+		std::cout << "GPU culling needs OpenGL 4.3, drawing the belt on the CPU path" << std::endl;
+		gpuCulling = false;
+	}
+	else if (gpuCulling && stressInstances > size_t(GpuCulling::maxInstances()))
 	{
-		std::cerr << "Failed to initialize GLAD!" << std::endl;
-		return 1;
+		std::cout << "GPU culling takes at most " << GpuCulling::maxInstances() << " instances, drawing the belt on the CPU path" << std::endl;
+		gpuCulling = false;
 	}
 
 	// Create the shader programs
-	Shader mainShader("main.vsh", "main.fsh");
-	Shader lightShader("light.vsh", "light.fsh");
-	Shader shadowShader("shadow.vsh", "shadow.fsh", "shadow.gsh");
+	// They come from the program cache or are compiled in one batch that is only waited for once the models are loading
+	// The lit models draw with variants of one program specialized per material, vertex layout and shadow filter
+	ShaderBatch shaderBatch;
+	ShaderVariants litShaders("main.vsh", "main.fsh");
+	bool beltOnGpu = gpuCulling && stressInstances > 0;
+	PrepareLitShaders(litShaders, shadowFilter.features(), stressInstances > 0, beltOnGpu, &shaderBatch);
+	Shader lightShader("light.vsh", "light.fsh", &shaderBatch);
+	std::unique_ptr<GpuCulling> beltCulling(beltOnGpu ? new GpuCulling(&shaderBatch) : nullptr);
+	ShadowPass shadowPass(options.shadowBackend, &shaderBatch, beltOnGpu);
+	std::cout << "Shadow back-end: " << ShadowPass::name(shadowPass.backend()) << std::endl;
+
+	// Textures are shared between all models through one cache
+	TextureManager::instance().setBudget(options.textureBudgetMB * 1024 * 1024);
 
 	// Get the model(s)
-	Model Earth("Models/Earth/scene.gltf");
-	Model Sun("Models/Sun/scene.gltf");
-	Model Moon("Models/Moon/scene.gltf");
+	// They load in the background so the first frame shows up right away; each model starts drawing once it's ready
+	AssetLoader assetLoader;
+	Model Earth("Models/Earth/scene.gltf", assetLoader);
+	Model Sun("Models/Sun/scene.gltf", assetLoader);
+	Model Moon("Models/Moon/scene.gltf", assetLoader);
 	
 	// WALL FOR SHADOW DEBUG
 	// Model Wall("Models/Wall/scene.gltf");
@@ -141,7 +290,7 @@ int main()
 	//Binding texture to FBO
 	GLuint fboTex;
 	glGenTextures(1, &fboTex);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, fboTex);
+	GLState::instance().bindTextureForUpdate(GL_TEXTURE_CUBE_MAP, fboTex);
 
 	GLuint shadowWidth = 1024, shadowHeight = 1024;
 	// makes empty texture for each face of the cube map
@@ -149,12 +298,23 @@ int main()
 		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
 			shadowWidth, shadowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	// linear filtering with depth compares, for the shadow filter
+	ShadowFilter::configure(fboTex);
+
+	shaderBatch.finish();
+	std::cout << "Shader programs: " << shaderBatch.programCount() << " in " << shaderBatch.milliseconds() << " ms, "
+		<< shaderBatch.cachedCount() << " from the program cache" << (ProgramCache::active() ? "" : " (off)")
+		<< (ShaderBatch::parallelCompile() ? ", parallel compile" : "") << std::endl;
+
+	// Stress scene: a belt of Moon instances, measured for a number of frames at each size, then doubled
+	AsteroidBelt belt(stressInstances, 7.0f, 9.0f);
+	InstanceBuffer beltInstances;
+	// distance from the camera and the light to the nearest instance, for the belt's levels of detail
+	float beltNearest[2] = { FLT_MAX, FLT_MAX };
+	InstanceSweep stressSweep(stressInstances);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, fboTex, 0);
@@ -168,219 +328,399 @@ int main()
 		std::cout << "Error! Framebuffer not complete!" << std::endl;
 	}
 
+	// Scene hierarchy: Sun -> Earth orbit -> Earth spin, Earth orbit -> Moon
+	// Only the animated nodes get new local transforms each frame; the world matrices are updated once per frame
+	SceneGraph scene;
+	uint32_t sunNode = scene.addNode("Sun");
+	glm::mat4 sunBody = glm::scale(glm::mat4(1.0f), glm::vec3(0.15f, 0.15f, 0.15f));
+	sunBody = glm::rotate(sunBody, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	uint32_t sunBodyNode = scene.addNode("Sun body", sunNode, sunBody);
+	uint32_t earthOrbitNode = scene.addNode("Earth orbit", sunNode);
+	uint32_t earthSpinNode = scene.addNode("Earth spin", earthOrbitNode);
+	uint32_t moonNode = scene.addNode("Moon", earthOrbitNode);
+
+	// Frustum culling: one BVH leaf per body of the main pass, refit every frame from the world matrices
+	enum Body { BODY_SUN, BODY_EARTH, BODY_MOON, BODY_BELT, BODY_COUNT };
+	BoundingVolumeHierarchy bvh;
+	uint32_t bodyLeaves[BODY_COUNT];
+	std::fill(bodyLeaves, bodyLeaves + BODY_COUNT, BoundingVolumeHierarchy::NO_NODE);
+	std::vector<uint32_t> visibleBodies;
+	uint64_t cullFrames = 0, visibleTotal = 0, culledTotal = 0;
+	AABB bodyBounds[BODY_COUNT];
+
+	// Shadow casters are drawn only into the cube faces they overlap, and unchanged faces are not redrawn
+	ShadowFaceCache shadowFaces;
+	uint64_t beltVersion = 0;
+
+	// Extra point lights, binned into view space clusters every frame. The light benchmark starts with one
+	// light and doubles the active ones after each measurement
+	LightClusters lightClusters;
+	// Camera, light and shadow data shared by every program, written once per frame
+	UniformBlocks uniformBlocks;
+	std::vector<PointLightSource> allLights, sceneLights;
+	ScatterLights(options.lightCount, allLights);
+	LightSweep lightSweep(allLights.size());
+	sceneLights.assign(allLights.begin(), allLights.begin() + (options.benchmarkLights ? lightSweep.activeCount() : allLights.size()));
+
+	// Shadow filter benchmark: every filter setting, timed one after the other
+	ShadowFilterSweep filterSweep;
+	if (options.benchmarkShadowFilter)
+		filterSweep.apply(shadowFilter);
+
+	// Any profiler output turns the profiler on (see AppOptions)
+	Profiler::instance().setEnabled(options.profile);
+	Profiler::instance().setTraceCapture(!options.profileTracePath.empty());
+	int titleFrames = 0;
+
+	// Benchmark: once everything is loaded, warmup frames and then measured frames, all with the same times and camera
+	BenchmarkRun benchmarkRun(options.benchmarkWarmupFrames, options.benchmarkFrames, options.benchmarkTimestep);
+
 	// Render loop
-	while (!glfwWindowShouldClose(window))
+	while (!exitRequested && (window == nullptr || !glfwWindowShouldClose(window)))
 	{
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastframe;
+		Shader::beginFrame();
+		GLState::instance().beginFrame();
+		LevelOfDetail::instance().beginFrame();
+		if (options.benchmark)
+		{
+			BenchmarkCounters counters;
+			counters.drawCalls = double(LevelOfDetail::instance().getLastFrameStats().drawCalls);
+			counters.triangles = double(LevelOfDetail::instance().getLastFrameStats().triangles);
+			counters.stateChanges = double(GLState::instance().getLastFrameStats().issued);
+			counters.stateChangesElided = double(GLState::instance().getLastFrameStats().elided);
+			counters.uniformUploads = double(Shader::lastFrameStats().uploaded);
+			counters.uniformUploadsSkipped = double(Shader::lastFrameStats().skipped);
+			counters.visibleBodies = double(visibleBodies.size());
+			if (!benchmarkRun.beginFrame(assetLoader.isIdle() && Earth.ready && Sun.ready && Moon.ready, counters))
+				break;
+		}
+		Profiler::instance().beginFrame();
+
+		float currentFrame = options.benchmark ? float(benchmarkRun.time()) : float(glfwGetTime());
+		deltaTime = options.benchmark ? float(options.benchmarkTimestep) : currentFrame - lastframe;
 		lastframe = currentFrame;
 
-		processInput(window);
+		Profiler::instance().beginScope("Update");
+		if (options.benchmark)
+			options.cameraScript.sample(currentFrame, cameraPos, cameraFront, followCameraIsEnabled);
+		else
+			processInput(window);
+
+		// Finish pending GPU uploads of the models and textures that were loaded in the background
+		JobSystem::instance().pumpMainThread(4.0);
+
+		// Animate the hierarchy from the one time sample of this frame, so both passes agree
+		glm::mat4 earthOrbit = glm::rotate(glm::mat4(1.0f), glm::radians(5 * currentFrame), glm::vec3(0.0f, 1.0f, 0.0f));
+		earthOrbit = glm::translate(earthOrbit, glm::vec3(0.0f, 0.0f, 5.0f));
+		scene.setLocal(earthOrbitNode, earthOrbit);
+
+		glm::mat4 earthSpin = glm::rotate(glm::mat4(1.0f), glm::radians(-113.4f), glm::vec3(1.0f, 0.0f, 0.0f));
+		earthSpin = glm::rotate(earthSpin, glm::radians(25 * currentFrame), glm::vec3(0.0f, 0.0f, 1.0f));
+		earthSpin = glm::scale(earthSpin, glm::vec3(0.5f, 0.5f, 0.5f));
+		scene.setLocal(earthSpinNode, earthSpin);
+
+		glm::mat4 moonOrbit = glm::rotate(glm::mat4(1.0f), glm::radians(25 * currentFrame), glm::vec3(0.0f, 1.0f, 0.0f));
+		moonOrbit = glm::translate(moonOrbit, glm::vec3(0.0f, 0.0f, 0.75f));
+		moonOrbit = glm::scale(moonOrbit, glm::vec3(0.15f, 0.15f, 0.15f));
+		scene.setLocal(moonNode, moonOrbit);
+
+		scene.update();
+		earthModelMatrix = scene.world(earthOrbitNode);
+
+		if (followCameraIsEnabled)
+		{
+			cameraPos = glm::vec3(-2.0f, 0.0f, 0.0f);
+			cameraPos = glm::vec3(earthModelMatrix * glm::vec4(cameraPos, 1.0f));
+		}
+
+		// The sweep benchmarks time the frames once the models they draw are in
+		bool sceneReady = Earth.ready && Moon.ready && Sun.ready;
+		if (stressInstances > 0 && Moon.ready)
+			stressSweep.addFrame(deltaTime);
+		if (options.benchmarkLights && sceneReady)
+		{
+			if (lightSweep.addFrame(deltaTime, lightClusters.lastStats()))
+				exitRequested = true;
+			if (sceneLights.size() != lightSweep.activeCount())
+				sceneLights.assign(allLights.begin(), allLights.begin() + lightSweep.activeCount());
+		}
+		if (options.benchmarkShadowFilter && sceneReady && filterSweep.addFrame(deltaTime, shadowFilter))
+			exitRequested = true;
+		if (stressInstances > 0)
+		{
+			// The orbits are written straight into the instance buffer, finding the instances nearest the camera and the light on the way
+			Profiler::instance().beginScope("Orbits");
+			glm::vec3 beltProbes[2] = { cameraPos, glm::vec3(0.0f) };
+			std::fill(beltNearest, beltNearest + 2, FLT_MAX);
+			size_t stressCount = stressSweep.count();
+			glm::mat4* mapped = beltInstances.map(GLsizei(stressCount));
+			if (mapped != nullptr)
+				belt.transforms(currentFrame, stressCount, mapped, beltProbes, beltNearest, 2);
+			beltInstances.unmap();
+			beltVersion++;
+			Profiler::instance().endScope();
+		}
+
+		bodyBounds[BODY_SUN] = Sun.bounds.transformed(scene.world(sunBodyNode));
+		bodyBounds[BODY_EARTH] = Earth.bounds.transformed(scene.world(earthSpinNode));
+		bodyBounds[BODY_MOON] = Moon.bounds.transformed(scene.world(moonNode));
+		bodyBounds[BODY_BELT] = stressInstances > 0 && Moon.ready ? belt.bounds(Moon.sphere.radius) : AABB();
+		for (uint32_t body = 0; body < BODY_COUNT; body++)
+			UpdateBodyBounds(bvh, bodyLeaves[body], body, bodyBounds[body]);
+		bvh.refit();
+		Profiler::instance().endScope();
 
 		// Clear the color and depth buffer
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		float aspect = (float)shadowWidth / (float)shadowHeight;
 		float near = 1.0f;
 		float far = 50.0f;
 		glm::vec3 lightPos = glm::vec3(0.0f);
 
 		// makes projection matrices for each face of the cube map
-		glm::mat4 projectionMatrixLight = glm::perspective(glm::radians(90.0f), aspect, near, far);
-		std::vector<glm::mat4> viewMatrixLight;
-		viewMatrixLight.push_back(projectionMatrixLight *
-			glm::lookAt(lightPos, lightPos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-		viewMatrixLight.push_back(projectionMatrixLight *
-			glm::lookAt(lightPos, lightPos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-		viewMatrixLight.push_back(projectionMatrixLight *
-			glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-		viewMatrixLight.push_back(projectionMatrixLight *
-			glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
-		viewMatrixLight.push_back(projectionMatrixLight *
-			glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-		viewMatrixLight.push_back(projectionMatrixLight *
-			glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-
-		//FIRST PASS
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, shadowWidth, shadowHeight);
-		shadowShader.use();
-		
+		glm::mat4 viewMatrixLight[ShadowPass::FACE_COUNT];
+		ShadowPass::faceMatrices(lightPos, near, far, viewMatrixLight);
 
-		// Passing shadow uniforms
-		for (int i = 0; i < 6; ++i)
-		{
-			std::string shadowMatrixName = "shadowMatrices[" + std::to_string(i) + "]";
-			const char* convertedShadowMatrixName = shadowMatrixName.c_str();
-			GLint shadowMatrixUniformLocation = glGetUniformLocation(shadowShader.program, convertedShadowMatrixName);
-			glUniformMatrix4fv(shadowMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(viewMatrixLight[i]));
-		}
+		//---View Matrix---
+		glm::mat4 viewMatrix;
 
-		GLint farPlaneUniformLocation = glGetUniformLocation(shadowShader.program, "farPlane");
-		glUniform1f(farPlaneUniformLocation, far);
-		GLint lightPosUniformLocation = glGetUniformLocation(shadowShader.program, "lightPos");
-		glUniform3f(lightPosUniformLocation, 0.0f, 0.0f, 0.0f);
-		GLint modelMatrixUniformLocation = glGetUniformLocation(shadowShader.program, "modelMatrix");
-		
-		// Avoid drawing Sun because it's not supposed to cast a shadow
+		viewMatrix = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 
-		glm::mat4 modelMatrix = glm::mat4(1.0f);
+		//---Perspective Matrix---
+		glm::mat4 perspectiveMatrix = glm::perspective(45.0f, (GLfloat)windowWidth / (GLfloat)windowHeight, 0.1f, 150.0f);
 
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(5 * glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));		
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 5.0f));	
-		earthModelMatrix = modelMatrix;
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(-113.4f), glm::vec3(1.0f, 0.0f, 0.0f));
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(25 * glfwGetTime())), glm::vec3(0.0f, 0.0f, 1.0f));
-		modelMatrix = glm::scale(modelMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
-		glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-		
+		// Bin the extra lights for this camera
+		Profiler::instance().beginScope("Light binning");
+		lightClusters.update(sceneLights, viewMatrix, perspectiveMatrix, windowWidth, windowHeight);
+		Profiler::instance().endScope();
+
+		// Camera, light and shadow data for both passes, in one write before anything draws
+		FrameData frameData;
+		frameData.viewMatrix = viewMatrix;
+		frameData.projectionMatrix = perspectiveMatrix;
+		frameData.viewProjectionMatrix = perspectiveMatrix * viewMatrix;
+		frameData.eyePos = cameraPos;
+		LightData lightData;
+		SetPointLight(lightData);
+		lightClusters.writeLookup(lightData);
+		ShadowData shadowData;
+		std::copy(viewMatrixLight, viewMatrixLight + ShadowPass::FACE_COUNT, shadowData.shadowMatrices);
+		shadowData.lightPos = lightPos;
+		shadowData.farPlane = far;
+		uniformBlocks.update(frameData, lightData, shadowData);
 
-		if (followCameraIsEnabled)
+		//FIRST PASS
+		Profiler::instance().beginScope("Shadow pass", true);
+		// Avoid drawing Sun because it's not supposed to cast a shadow
+		shadowFaces.beginFrame(viewMatrixLight, lightPos, far);
+		uint8_t earthFaces = shadowFaces.addCaster(BODY_EARTH, bodyBounds[BODY_EARTH], scene.world(earthSpinNode));
+		uint8_t moonFaces = shadowFaces.addCaster(BODY_MOON, bodyBounds[BODY_MOON], scene.world(moonNode));
+		uint8_t beltFaces = shadowFaces.addCaster(BODY_BELT, bodyBounds[BODY_BELT], glm::mat4(1.0f), beltVersion);
+		uint8_t dirtyFaces = shadowFaces.endCasters();
+
+		// GPU-driven belt: every instance is culled against the camera and the belt's faces to redraw, and gets
+		// its own levels of detail, in one dispatch whose commands both passes draw from
+		if (beltCulling && Moon.ready)
 		{
-			cameraPos = glm::vec3(-2.0f, 0.0f, 0.0f);
-			cameraPos = glm::vec3(earthModelMatrix * glm::vec4(cameraPos, 1.0f));
+			Profiler::instance().beginScope("GPU culling", true);
+			CullView beltViews[GpuCulling::VIEW_COUNT];
+			beltViews[GpuCulling::VIEW_CAMERA] = { Frustum(perspectiveMatrix * viewMatrix), cameraPos,
+				GpuCulling::detailFactor(perspectiveMatrix[1][1], windowHeight, options.lodPixelError) };
+			for (int face = 0; face < ShadowPass::FACE_COUNT; face++)
+				beltViews[GpuCulling::VIEW_FIRST_FACE + face] = { Frustum(viewMatrixLight[face]), lightPos,
+					GpuCulling::detailFactor(1.0f, float(shadowHeight), options.shadowLodTexelError) };
+			uint8_t beltViewMask = uint8_t((1u << GpuCulling::VIEW_CAMERA) | (shadowFaces.drawMask(beltFaces) << GpuCulling::VIEW_FIRST_FACE));
+			beltCulling->cull(Moon.meshes, beltInstances, beltViews, beltViewMask);
+			Profiler::instance().endScope();
 		}
-		Earth.Draw(shadowShader);
 
-		modelMatrix = glm::mat4(1.0f);
+		// Levels of detail of the casters, from their size in shadow map texels (the faces have a 90 degree field of view)
+		float earthShadowDetail = LevelOfDetail::detailScale(scene.world(earthSpinNode), Earth.sphere, lightPos, 1.0f, float(shadowHeight), options.shadowLodTexelError);
+		float moonShadowDetail = LevelOfDetail::detailScale(scene.world(moonNode), Moon.sphere, lightPos, 1.0f, float(shadowHeight), options.shadowLodTexelError);
+		float beltShadowDetail = BeltDetailScale(beltNearest[1], Moon.sphere, 1.0f, float(shadowHeight), options.shadowLodTexelError);
 
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(5 * glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 5.0f));
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(25 * glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 0.75f));
-		modelMatrix = glm::scale(modelMatrix, glm::vec3(0.15f, 0.15f, 0.15f));
-		glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+		shadowPass.begin();
+		shadowPass.addCaster(Earth, scene.world(earthSpinNode), shadowFaces.drawMask(earthFaces), earthShadowDetail);
+		shadowPass.addCaster(Moon, scene.world(moonNode), shadowFaces.drawMask(moonFaces), moonShadowDetail);
+		if (beltCulling)
+			shadowPass.addCaster(Moon, *beltCulling, shadowFaces.drawMask(beltFaces));
+		else
+			shadowPass.addCaster(Moon, beltInstances, shadowFaces.drawMask(beltFaces), beltShadowDetail);
 
-		Moon.Draw(shadowShader);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, shadowWidth, shadowHeight);
+		shadowPass.render(fboTex, dirtyFaces);
+		Profiler::instance().endScope();
 
 		// DEBUG WALL FOR SHADOWS
-		// modelMatrix = glm::mat4(1.0f);
+		// glm::mat4 modelMatrix = glm::mat4(1.0f);
 		// modelMatrix = glm::rotate(modelMatrix, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 		// modelMatrix = glm::rotate(modelMatrix, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 		// modelMatrix = glm::translate(modelMatrix, glm::vec3(-10.0f, 0.0f, 0.0f));
 		// modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, -5.0f));
-		// glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+		// shadowShader.setMat4(modelMatrixUniform, modelMatrix);
 		
 		// Wall.Draw(shadowShader);
 		
 
 		//SECOND PASS
+		Profiler::instance().beginScope("Main pass", true);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glViewport(0, 0, windowWidth, windowHeight);
 		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, fboTex);
 
-		//---View Matrix---
-		glm::mat4 viewMatrix;
-
-		viewMatrix = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-
-		//---Perspective Matrix---
-		glm::mat4 perspectiveMatrix = glm::perspective(45.0f, (GLfloat)windowWidth / (GLfloat)windowHeight, 0.1f, 150.0f);
+		// Cull the bodies outside the camera frustum
+		Profiler::instance().beginScope("Culling");
+		Frustum cameraFrustum(perspectiveMatrix * viewMatrix);
+		visibleBodies.clear();
+		bvh.query(cameraFrustum, visibleBodies);
+		bool bodyVisible[BODY_COUNT] = {};
+		for (uint32_t body : visibleBodies)
+			bodyVisible[body] = true;
+		cullFrames++;
+		visibleTotal += bvh.lastQueryStats().visible;
+		culledTotal += bvh.lastQueryStats().culled;
+		Profiler::instance().endScope();
 
 		// Shader Program for the Sun
 		lightShader.use();
 
 		//---Transformation Matrix for the Model (Sun)---
 
-		glm::mat4 modelMatrixLight = glm::mat4(1.0f);
-		modelMatrixLight = glm::scale(modelMatrixLight, glm::vec3(0.15f, 0.15f, 0.15f));
-		modelMatrixLight = glm::rotate(modelMatrixLight, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+		const glm::mat4& modelMatrixLight = scene.world(sunBodyNode);
 
-		glm::mat4 mvpMatrixLight;
-		mvpMatrixLight = perspectiveMatrix * viewMatrix * modelMatrixLight;
-
-		GLint mvpLightMatrixUniformLocation = glGetUniformLocation(lightShader.program, "mvpMatrixLight");
-		glUniformMatrix4fv(mvpLightMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(mvpMatrixLight));
+		lightShader.setMat4(modelMatrixUniform, modelMatrixLight);
 		
 		// Sun
-		Sun.Draw(lightShader);
-
-		// Use the shader program that we created
-		mainShader.use();
+		if (bodyVisible[BODY_SUN])
+			Sun.Draw(lightShader, LevelOfDetail::detailScale(modelMatrixLight, Sun.sphere, cameraPos, perspectiveMatrix[1][1], windowHeight, options.lodPixelError));
+
+		// The lit models pick their variant per mesh; every variant they switch to gets the cluster buffers,
+		// the shadow map and the model matrix (the camera and lights come from the uniform blocks)
+		uint32_t litFeatures = shadowFilter.features();
+		glm::mat4 modelMatrix;
+		ShaderSetup setupLit = [&](Shader& shader) {
+			lightClusters.bind(shader);
+			Shader::SamplerBinding shadowMapSampler;
+			if (shader.findSampler(shadowMapUniform, shadowMapSampler))
+				GLState::instance().bindTexture(shadowMapSampler.unit, GL_TEXTURE_CUBE_MAP, fboTex);
+			shader.setMat4(modelMatrixUniform, modelMatrix);
+		};
 
 		//---Transformation Matrix for the Model (Earth)---
 
-		modelMatrix = glm::mat4(1.0f);
-
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(5 * glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 5.0f));	
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(-113.4f), glm::vec3(1.0f, 0.0f, 0.0f));
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(25 * glfwGetTime())), glm::vec3(0.0f, 0.0f, 1.0f));
-		modelMatrix = glm::scale(modelMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
-
-		modelMatrixUniformLocation = glGetUniformLocation(mainShader.program, "modelMatrix");
-		glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-		glm:: mat4 earthModelMatrix = modelMatrix;
-		glm::mat4 mvpMatrix;
-		mvpMatrix = perspectiveMatrix * viewMatrix * modelMatrix;
-
-		GLint mvpMatrixUniformLocation = glGetUniformLocation(mainShader.program, "mvpMatrix");
-		glUniformMatrix4fv(mvpMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(mvpMatrix));
+		modelMatrix = scene.world(earthSpinNode);
 
 		// Earth
-		Earth.Draw(mainShader);
+		if (bodyVisible[BODY_EARTH])
+			Earth.Draw(litShaders, litFeatures, setupLit, LevelOfDetail::detailScale(modelMatrix, Earth.sphere, cameraPos, perspectiveMatrix[1][1], windowHeight, options.lodPixelError));
 
 		//---Transformation Matrix for the Model (Moon)---
-		modelMatrix = glm::mat4(1.0f);
-
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(5 * glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 5.0f));
-		modelMatrix = glm::rotate(modelMatrix, glm::radians(float(25 * glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 0.75f));
-		modelMatrix = glm::scale(modelMatrix, glm::vec3(0.15f, 0.15f, 0.15f));
-		glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+		modelMatrix = scene.world(moonNode);
 
-		mvpMatrix = perspectiveMatrix * viewMatrix * modelMatrix;
-		glUniformMatrix4fv(mvpMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(mvpMatrix));
-
-		Moon.Draw(mainShader);
+		if (bodyVisible[BODY_MOON])
+			Moon.Draw(litShaders, litFeatures, setupLit, LevelOfDetail::detailScale(modelMatrix, Moon.sphere, cameraPos, perspectiveMatrix[1][1], windowHeight, options.lodPixelError));
 
 		// DEBUG WALL FOR SHADOWS
-		// modelMatrix = glm::mat4(1.0f);
+		// glm::mat4 modelMatrix = glm::mat4(1.0f);
 		// modelMatrix = glm::rotate(modelMatrix, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 		// modelMatrix = glm::rotate(modelMatrix, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 		// modelMatrix = glm::translate(modelMatrix, glm::vec3(-10.0f, 0.0f, 0.0f));
 		// modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, -5.0f));
-		// glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+		// mainShader.setMat4(modelMatrixUniform, modelMatrix);
 		
 		// mvpMatrix = perspectiveMatrix * viewMatrix * modelMatrix;
-		// glUniformMatrix4fv(mvpMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(mvpMatrix));
+		// mainShader.setMat4(mvpMatrixUniform, mvpMatrix);
 
 		// Wall.Draw(mainShader);
 
-		// Lighting uniforms
-		GLint eyePosUniformLocation = glGetUniformLocation(mainShader.program, "eyePos");
-		glUniform3f(eyePosUniformLocation, cameraPos.x,  cameraPos.y,  cameraPos.z);
-		farPlaneUniformLocation = glGetUniformLocation(mainShader.program, "farPlane");
-		glUniform1f(farPlaneUniformLocation, far);
-
-		GLint ambientUniformLocation = glGetUniformLocation(mainShader.program, "pointLight.ambient");
-		glUniform3f(ambientUniformLocation, 0.1f, 0.1f, 0.1f);
-		GLint pointLightDiffuseUniformLocation = glGetUniformLocation(mainShader.program, "pointLight.diffuse");
-		glUniform3f(pointLightDiffuseUniformLocation, 1.0f, 1.0f, 1.0f);
-		GLint pointLightSpecularUniformLocation = glGetUniformLocation(mainShader.program, "pointLight.specular");
-		glUniform3f(pointLightSpecularUniformLocation, 0.5f, 0.5f, 0.5f);
-
-		GLint pointLightPosUniformLocation = glGetUniformLocation(mainShader.program, "pointLight.position");
-		glUniform3f(pointLightPosUniformLocation, 0.0f, 0.0f, 0.0f);
+		// Asteroid belt, one instanced draw per Moon mesh (one multi-draw of every level on the GPU-driven path)
+		if (stressInstances > 0 && bodyVisible[BODY_BELT])
+		{
+			ShaderSetup setupBelt = [&](Shader& shader) {
+				lightClusters.bind(shader);
+				Shader::SamplerBinding shadowMapSampler;
+				if (shader.findSampler(shadowMapUniform, shadowMapSampler))
+					GLState::instance().bindTexture(shadowMapSampler.unit, GL_TEXTURE_CUBE_MAP, fboTex);
+			};
+			if (beltCulling)
+				Moon.DrawIndirect(litShaders, litFeatures, setupBelt, *beltCulling, GpuCulling::VIEW_CAMERA);
+			else
+			{
+				float beltDetail = BeltDetailScale(beltNearest[0], Moon.sphere, perspectiveMatrix[1][1], windowHeight, options.lodPixelError);
+				Moon.DrawInstanced(litShaders, litFeatures, setupBelt, beltInstances, 1, beltDetail);
+			}
+		}
+		Profiler::instance().endScope();
 
+		if (profilerOverlay)
+		{
+			Profiler::instance().drawOverlay(int(windowWidth));
+			if (window != nullptr && ++titleFrames % 30 == 0)
+				glfwSetWindowTitle(window, (std::string(windowTitle) + " | " + Profiler::instance().summaryText()).c_str());
+		}
 
 		// Tell GLFW to swap the screen buffer with the offscreen buffer
-		glfwSwapBuffers(window);
+		Profiler::instance().beginScope("Swap");
+		if (window != nullptr)
+		{
+			glfwSwapBuffers(window);
 
-		// Tell GLFW to process window events (e.g., input events, window closed events, etc.)
-		glfwPollEvents();
+			// Tell GLFW to process window events (e.g., input events, window closed events, etc.)
+			glfwPollEvents();
+		}
+		else
+			headless.swapBuffers();
+		// benchmark frames include the GPU's work
+		if (options.benchmark)
+			glFinish();
+		Profiler::instance().endScope();
 	}
 
 	// --- Cleanup ---
+	// Close the profiler's last frame before anything else adds to it
+	Profiler::instance().shutdown();
+	// Stop the loader, its pending jobs still refer to the models
+	assetLoader.shutdown();
+	TextureManager::instance().printStats();
+	TextureManager::instance().shutdown();
+	GeometryArena::get(VertexFormat::defaultLayout()).printStats();
+	GeometryArena::shutdownAll();
+	Shader::printUniformStats();
+	GLState::instance().printStats();
+	LevelOfDetail::instance().printStats();
+	shadowFaces.printStats();
+	if (cullFrames > 0)
+		std::cout << "Frustum culling per frame: " << double(visibleTotal) / cullFrames << " bodies visible, "
+			<< double(culledTotal) / cullFrames << " culled" << std::endl;
+	Profiler::instance().printStats();
+	if (!options.profileTracePath.empty() && !Profiler::instance().writeTrace(options.profileTracePath))
+		std::cerr << "Could not write the profiler trace to " << options.profileTracePath << std::endl;
+	if (!options.profileCsvPath.empty() && !Profiler::instance().writeCsv(options.profileCsvPath))
+		std::cerr << "Could not write the profiler statistics to " << options.profileCsvPath << std::endl;
+	if (options.benchmark)
+	{
+		benchmarkRun.printSummary();
+		std::string renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+		if (benchmarkRun.writeReport(options.benchmarkReportPath, headlessContext ? "EGL pbuffer" : "GLFW hidden window", renderer, int(windowWidth), int(windowHeight)))
+			std::cout << "Benchmark report written to " << options.benchmarkReportPath << std::endl;
+		else
+			std::cerr << "Could not write the benchmark report to " << options.benchmarkReportPath << std::endl;
+	}
+
 	// Make sure to delete the shader program
-	mainShader.clean();
+	litShaders.clean();
 	lightShader.clean();
-
-	// Remember to tell GLFW to clean itself up before exiting the application
+	shadowPass.clean();
+	if (beltCulling)
+		beltCulling->clean();
+	beltInstances.clean();
+	lightClusters.clean();
+	uniformBlocks.clean();
+
+	// Remember to tell GLFW (or EGL) to clean itself up before exiting the application
+	JobSystem::instance().shutdown();
+	headless.destroy();
 	glfwTerminate();
 
 	return 0;
@@ -477,6 +817,19 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 	{
 		followCameraIsEnabled = !followCameraIsEnabled;
 	}
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+	{
+		shadowFilter.cycleQuality();
+		std::cout << "Shadow filter: " << ShadowFilter::taps(shadowFilter.quality()) << " taps" << std::endl;
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+	{
+		profilerOverlay = !profilerOverlay;
+		if (profilerOverlay)
+			Profiler::instance().setEnabled(true);
+		else
+			glfwSetWindowTitle(window, windowTitle);
+	}
 }
 
 
@@ -493,3 +846,14 @@ void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
 	// update the dimensions of the region to the new size
 	glViewport(0, 0, width, height);
 }
+
+void UpdateBodyBounds(BoundingVolumeHierarchy& bvh, uint32_t& leaf, uint32_t body, const AABB& worldBounds)
+{
+	if (worldBounds.empty())
+		return;
+	if (leaf == BoundingVolumeHierarchy::NO_NODE)
+		leaf = bvh.insert(worldBounds, body);
+	else
+		bvh.setBounds(leaf, worldBounds);
+}
+
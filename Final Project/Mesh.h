@@ -6,22 +6,54 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "Bounds.h"
+#include "GeometryArena.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "LevelOfDetail.h"
 #include "Shader.h"
+#include "ShaderVariants.h"
+#include "TextureManager.h"
+#include "VertexFormat.h"
 
 #include <string>
 #include <vector>
 
-struct Vertex {
-    GLfloat x, y, z;	// Position
-    GLubyte r, g, b;    // Color (if any)
-    GLfloat u, v;		// UV coordinates
-    GLfloat nx, ny, nz; // Normal vector
-};
-
 struct Texture {
     GLuint id;
     std::string type;
     std::string path;
+    TextureHandle handle;   // keeps the texture resident in the TextureManager while the mesh uses it
+};
+
+// material texture reference as found in the model file (not loaded yet)
+struct TextureRef {
+    std::string type;
+    std::string path;
+};
+
+// one material texture resolved against a shader program: which unit and target it goes to and which
+// sampler reads it there
+struct MaterialBinding {
+    GLuint unit;
+    GLenum target;
+    GLuint texture;
+    GLint samplerLocation;
+};
+
+// the texture bindings of a mesh for one shader program, built once and never changed afterwards
+struct MaterialBlock {
+    GLuint program;
+    std::vector<MaterialBinding> bindings;
+};
+
+// CPU-side mesh data, produced by the Assimp import or read back from the mesh cache
+struct MeshData {
+    std::vector<Vertex>     vertices;
+    std::vector<GLuint>     indices;    // every LOD level, the full detail one first
+    std::vector<TextureRef> textures;
+    AABB                    bounds;     // of the vertex positions, in mesh space
+    std::vector<MeshLod>    lods;       // empty for a single level over all indices
 };
 
 class Mesh {
@@ -30,95 +62,217 @@ public:
     std::vector<Vertex>       vertices;
     std::vector<GLuint> indices;
     std::vector<Texture>      textures;
-    GLuint VAO;
+    GLuint VAO;             // the shared VAO of the layout's geometry arena
+    VertexLayout layout;
+    // dequantization of the vertex positions (identity unless the layout quantizes them)
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    // local bounds, from the import; computed from the vertices if the import had none
+    AABB bounds;
+    BoundingSphere sphere;
+    // index ranges of the levels of detail, full detail first
+    std::vector<MeshLod> lods;
+    // GL_UNSIGNED_SHORT when every vertex fits a 16 bit index, GL_UNSIGNED_INT otherwise
+    GLenum indexType;
+    // what the shaders have to do for this mesh's material and vertex layout (see ShaderVariants)
+    uint32_t shaderFeatures;
 
     // constructor
-    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, const AABB& bounds = AABB(), const std::vector<MeshLod>& lods = {}, VertexLayout layout = VertexFormat::defaultLayout())
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->layout = layout;
+        this->bounds = bounds;
+        this->lods = lods;
+        indexType = this->vertices.size() < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        if (this->lods.empty())
+            this->lods.push_back({ 0, uint32_t(this->indices.size()), 0.0f });
+        if (this->bounds.empty())
+        {
+            for (const Vertex& vertex : this->vertices)
+                this->bounds.extend(glm::vec3(vertex.x, vertex.y, vertex.z));
+        }
+        sphere = BoundingSphere::fromAABB(this->bounds);
+
+        shaderFeatures = VertexFormat::get(layout).octahedralNormals ? SHADER_FEATURE_OCTAHEDRAL_NORMALS : 0u;
+        for (const Texture& texture : this->textures)
+        {
+            if (texture.type == "texture_specular")
+                shaderFeatures |= SHADER_FEATURE_SPECULAR_MAP;
+        }
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
-    // render the mesh
-    void Draw(Shader& shader)
+    // render the mesh, at the level of detail the detail scale asks for (see LevelOfDetail)
+    void Draw(Shader& shader, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        bindMaterial(shader);
+
+        // draw mesh out of the shared arena; the VAO stays bound for the next mesh of the same layout
+        GeometryArena& arena = GeometryArena::get(layout);
+        arena.bind();
+        const MeshLod& lod = selectLod(detailScale, 1);
+        glDrawElementsBaseVertex(GL_TRIANGLES, GLsizei(lod.indexCount), indexType, lodOffset(arena, lod), arena.baseVertex(vertexRange));
+    }
+
+    // render the mesh instanceCount times without per-instance attributes; the shader tells the copies
+    // apart by gl_InstanceID
+    void DrawCopies(Shader& shader, GLsizei instanceCount, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (instanceCount == 0)
+            return;
+        bindMaterial(shader);
+
+        GeometryArena& arena = GeometryArena::get(layout);
+        arena.bind();
+        const MeshLod& lod = selectLod(detailScale, instanceCount);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, GLsizei(lod.indexCount), indexType, lodOffset(arena, lod), instanceCount, arena.baseVertex(vertexRange));
+    }
+
+    // render one copy of the mesh per instance in the buffer, with one of the instanced shaders. With
+    // repeat > 1 every instance is drawn repeat times in a row (gl_InstanceID % repeat tells them apart).
+    // All instances share one level of detail, so the detail scale should be the one of the nearest instance.
+    void DrawInstanced(Shader& shader, const InstanceBuffer& instances, GLuint repeat = 1, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (instances.count() == 0 || repeat == 0)
+            return;
+        bindMaterial(shader);
+
+        GeometryArena& arena = GeometryArena::get(layout);
+        arena.bindInstanced(instances.id(), repeat);
+        GLsizei instanceCount = instances.count() * GLsizei(repeat);
+        const MeshLod& lod = selectLod(detailScale, instanceCount);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, GLsizei(lod.indexCount), indexType, lodOffset(arena, lod), instanceCount, arena.baseVertex(vertexRange));
+    }
+
+    // binds the material and the arena's indirect VAO for draws of the culled instance lists of GpuCulling,
+    // which reads each instance's index from instanceIndices. The draws themselves come from a command buffer.
+    void bindIndirect(Shader& shader, GLuint instanceIndices)
+    {
+        bindMaterial(shader);
+        GeometryArena::get(layout).bindIndirect(instanceIndices);
+    }
+
+    // the firstIndex of an indirect draw command of a level: where its indices start in the arena, in indices
+    GLuint indirectFirstIndex(size_t level) const
+    {
+        const GeometryArena& arena = GeometryArena::get(layout);
+        return GLuint(uintptr_t(arena.indexOffset(indexRange)) / indexSize() + lods[level].firstIndex);
+    }
+
+    // the baseVertex of an indirect draw command
+    GLint indirectBaseVertex() const
+    {
+        return GeometryArena::get(layout).baseVertex(vertexRange);
+    }
+
+private:
+    static constexpr UniformId positionScaleUniform = UniformId("positionScale");
+    static constexpr UniformId positionOffsetUniform = UniformId("positionOffset");
+
+    // render data: ranges in the geometry arena, given back when the mesh is destroyed
+    GeometryArena::Allocation vertexRange;
+    GeometryArena::Allocation indexRange;
+    // one binding block per shader program the mesh has been drawn with
+    std::vector<MaterialBlock> materials;
+
+    // picks the level for a detail scale and counts its triangles
+    const MeshLod& selectLod(float detailScale, GLsizei instanceCount) const
+    {
+        size_t level = LevelOfDetail::select(lods, detailScale);
+        LevelOfDetail::instance().submitted(lods, level, uint64_t(instanceCount));
+        return lods[level];
+    }
+
+    // the indices pointer of a level's draw call
+    const void* lodOffset(const GeometryArena& arena, const MeshLod& lod) const
+    {
+        return static_cast<const char*>(arena.indexOffset(indexRange)) + lod.firstIndex * indexSize();
+    }
+
+    // bytes per index in the arena
+    size_t indexSize() const
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    }
+
+    // binds the material's textures and tells the vertex shader how to dequantize this mesh's positions
+    void bindMaterial(Shader& shader)
     {
-        // bind appropriate textures
+        // the tracker skips the textures that are already bound
+        GLState& state = GLState::instance();
+        for (const MaterialBinding& binding : materialFor(shader).bindings)
+            state.bindTexture(binding.unit, binding.target, binding.texture);
+
+        shader.setVec3(positionScaleUniform, positionScale);
+        shader.setVec3(positionOffsetUniform, positionOffset);
+    }
+
+    // returns the mesh's binding block for a program, baking it on the first draw with that program
+    const MaterialBlock& materialFor(const Shader& shader)
+    {
+        for (const MaterialBlock& material : materials)
+        {
+            if (material.program == shader.program)
+                return material;
+        }
+        materials.push_back(bakeMaterial(shader));
+        return materials.back();
+    }
+
+    // resolves every texture to the sampler it feeds in the program. We assume a convention for sampler
+    // names in the shaders: the Nth texture of a type is read by e.g. texture_diffuseN, texture_specularN.
+    // Textures without a matching sampler are left out.
+    MaterialBlock bakeMaterial(const Shader& shader) const
+    {
+        MaterialBlock material;
+        material.program = shader.program;
+
         GLuint diffuseNr = 1;
         GLuint specularNr = 1;
         GLuint normalNr = 1;
         GLuint heightNr = 1;
-        for (GLuint i = 0; i < textures.size(); i++)
+        for (const Texture& texture : textures)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             std::string number;
-            std::string name = textures[i].type;
+            const std::string& name = texture.type;
             if (name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer GLuint to stream
+                number = std::to_string(specularNr++);
             else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer GLuint to stream
+                number = std::to_string(normalNr++);
             else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer GLuint to stream
+                number = std::to_string(heightNr++);
 
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.program, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            Shader::SamplerBinding sampler;
+            if (shader.findSampler(name + number, sampler))
+                material.bindings.push_back({ sampler.unit, sampler.target, texture.id, sampler.location });
         }
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        return material;
     }
 
-private:
-    // render data 
-    GLuint VBO, EBO;
-
-    // initializes all the buffer objects/arrays
+    // copies the vertices and indices into the geometry arena of the mesh's layout
     void setupMesh()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
-        // vertex Color
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, r));
-        // vertex UV coordinates
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, u));
-        // vertex Normal
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, nx));
-
-        glBindVertexArray(0);
+        // load data into the arena's vertex buffer, re-encoded in the mesh's vertex layout
+        const VertexFormat& format = VertexFormat::get(layout);
+        std::vector<unsigned char> packed = format.encode(vertices, positionScale, positionOffset);
+        GeometryArena& arena = GeometryArena::get(layout);
+        vertexRange = arena.allocateVertices(packed.data(), GLuint(vertices.size()));
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+            indexRange = arena.allocateIndices(shortIndices.data(), GLuint(shortIndices.size() * sizeof(GLushort)));
+        }
+        else
+            indexRange = arena.allocateIndices(indices.data(), GLuint(indices.size() * sizeof(GLuint)));
+        VAO = arena.VAO;
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,287 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Baked mesh cache (*.meshcache).
+// Holds the final Vertex/index arrays produced by the Assimp import together with the mesh ranges and
+// the material texture references, so a model can be loaded without running Assimp at all.
+//
+// File layout (little endian, every section starts on an 8 byte boundary so it can be used in place once mapped):
+//   MeshCacheHeader
+//   MeshCacheRange[meshCount]
+//   MeshCacheTextureRef[textureRefCount]
+//   MeshCacheLod[lodCount]
+//   char strings[stringBytes]
+//   Vertex vertices[vertexCount]
+//   GLuint indices[indexCount]             every mesh's LOD levels one after another, full detail first
+namespace MeshCache
+{
+    // bump whenever the layout above, the Vertex struct, the import flags or the import processing change
+    const uint32_t VERSION = 5;
+    const char MAGIC[4] = { 'G', 'M', 'S', 'H' };
+
+    struct MeshCacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexSize;        // sizeof(Vertex) at bake time
+        uint32_t importFlags;       // Assimp post-process flags used for the bake
+        uint64_t sourceStamp;       // hash of the size and write time of every source file
+        uint32_t meshCount;
+        uint32_t textureRefCount;
+        uint32_t lodCount;
+        uint32_t reserved;
+        uint64_t stringBytes;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+    };
+
+    struct MeshCacheRange {
+        uint32_t firstVertex, vertexCount;
+        uint32_t firstIndex, indexCount;
+        uint32_t firstTextureRef, textureRefCount;
+        uint32_t firstLod, lodCount;
+        float boundsMin[3], boundsMax[3];   // mesh space AABB
+    };
+
+    struct MeshCacheLod {
+        uint32_t firstIndex, indexCount;    // relative to the mesh's first index
+        float error;
+    };
+
+    struct MeshCacheTextureRef {
+        uint32_t typeOffset, typeLength;    // into the string table
+        uint32_t pathOffset, pathLength;
+    };
+
+    // cache file that belongs to a model source file, e.g. Models/Earth/scene.gltf -> Models/Earth/scene.meshcache
+    inline std::string cachePathFor(const std::string& sourcePath)
+    {
+        std::string::size_type dot = sourcePath.find_last_of('.');
+        std::string::size_type slash = sourcePath.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return sourcePath + ".meshcache";
+        return sourcePath.substr(0, dot) + ".meshcache";
+    }
+
+    // FNV-1a over the size and write time of the model file and the buffer (.bin) files next to it.
+    // A glTF keeps its geometry in the .bin, so editing either one must invalidate the cache.
+    inline uint64_t sourceStamp(const std::string& sourcePath)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::vector<fs::path> files;
+        files.push_back(fs::path(sourcePath));
+        fs::path dir = fs::path(sourcePath).parent_path();
+        if (dir.empty())
+            dir = ".";
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+        {
+            if (it->path().extension() == ".bin")
+                files.push_back(it->path());
+        }
+        std::sort(files.begin() + 1, files.end());
+
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint64_t value) {
+            for (int i = 0; i < 8; i++)
+            {
+                hash ^= (value >> (i * 8)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+        };
+        for (const fs::path& file : files)
+        {
+            uintmax_t size = fs::file_size(file, ec);
+            if (ec)
+                return 0;
+            auto time = fs::last_write_time(file, ec);
+            if (ec)
+                return 0;
+            mix(uint64_t(size));
+            mix(uint64_t(time.time_since_epoch().count()));
+        }
+        return hash;
+    }
+
+    // writes the baked meshes of a model. Returns false if the file could not be written.
+    inline bool write(const std::string& cachePath, uint64_t stamp, uint32_t importFlags, const std::vector<MeshData>& meshes)
+    {
+        std::vector<MeshCacheRange> ranges;
+        std::vector<MeshCacheTextureRef> textureRefs;
+        std::vector<MeshCacheLod> lods;
+        std::string strings;
+        uint64_t vertexCount = 0, indexCount = 0;
+
+        for (const MeshData& mesh : meshes)
+        {
+            MeshCacheRange range;
+            range.firstVertex = static_cast<uint32_t>(vertexCount);
+            range.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+            range.firstIndex = static_cast<uint32_t>(indexCount);
+            range.indexCount = static_cast<uint32_t>(mesh.indices.size());
+            range.firstTextureRef = static_cast<uint32_t>(textureRefs.size());
+            range.textureRefCount = static_cast<uint32_t>(mesh.textures.size());
+            range.firstLod = static_cast<uint32_t>(lods.size());
+            range.lodCount = static_cast<uint32_t>(mesh.lods.size());
+            for (const MeshLod& lod : mesh.lods)
+                lods.push_back({ lod.firstIndex, lod.indexCount, lod.error });
+            for (int axis = 0; axis < 3; axis++)
+            {
+                range.boundsMin[axis] = mesh.bounds.min[axis];
+                range.boundsMax[axis] = mesh.bounds.max[axis];
+            }
+            ranges.push_back(range);
+
+            for (const TextureRef& texture : mesh.textures)
+            {
+                MeshCacheTextureRef ref;
+                ref.typeOffset = static_cast<uint32_t>(strings.size());
+                ref.typeLength = static_cast<uint32_t>(texture.type.size());
+                strings += texture.type;
+                ref.pathOffset = static_cast<uint32_t>(strings.size());
+                ref.pathLength = static_cast<uint32_t>(texture.path.size());
+                strings += texture.path;
+                textureRefs.push_back(ref);
+            }
+
+            vertexCount += mesh.vertices.size();
+            indexCount += mesh.indices.size();
+        }
+
+        MeshCacheHeader header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.vertexSize = sizeof(Vertex);
+        header.importFlags = importFlags;
+        header.sourceStamp = stamp;
+        header.meshCount = static_cast<uint32_t>(ranges.size());
+        header.textureRefCount = static_cast<uint32_t>(textureRefs.size());
+        header.lodCount = static_cast<uint32_t>(lods.size());
+        header.reserved = 0;
+        header.stringBytes = strings.size();
+        header.vertexCount = vertexCount;
+        header.indexCount = indexCount;
+
+        // write to a temporary file first so a crash mid-bake never leaves a truncated cache behind
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+
+            const char padding[8] = {};
+            auto writeSection = [&out, &padding](const void* bytes, uint64_t size) {
+                if (size > 0)
+                    out.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+                out.write(padding, static_cast<std::streamsize>(alignTo8(size) - size));
+            };
+
+            writeSection(&header, sizeof(header));
+            writeSection(ranges.data(), ranges.size() * sizeof(MeshCacheRange));
+            writeSection(textureRefs.data(), textureRefs.size() * sizeof(MeshCacheTextureRef));
+            writeSection(lods.data(), lods.size() * sizeof(MeshCacheLod));
+            writeSection(strings.data(), strings.size());
+            for (const MeshData& mesh : meshes)
+                out.write(reinterpret_cast<const char*>(mesh.vertices.data()), static_cast<std::streamsize>(mesh.vertices.size() * sizeof(Vertex)));
+            out.write(padding, static_cast<std::streamsize>(alignTo8(vertexCount * sizeof(Vertex)) - vertexCount * sizeof(Vertex)));
+            for (const MeshData& mesh : meshes)
+                out.write(reinterpret_cast<const char*>(mesh.indices.data()), static_cast<std::streamsize>(mesh.indices.size() * sizeof(GLuint)));
+
+            if (!out)
+                return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tempPath, cachePath, ec);
+        return !ec;
+    }
+
+    // reads a baked model back. Returns false if the cache is missing, corrupt or was baked from
+    // different source files (stale), in which case the caller should fall back to Assimp.
+    inline bool read(const std::string& cachePath, uint64_t stamp, uint32_t importFlags, std::vector<MeshData>& meshes)
+    {
+        MappedFile file(cachePath);
+        if (file.data == nullptr || file.size < sizeof(MeshCacheHeader))
+            return false;
+
+        MeshCacheHeader header;
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+            || header.vertexSize != sizeof(Vertex) || header.importFlags != importFlags
+            || stamp == 0 || header.sourceStamp != stamp)
+            return false;
+
+        uint64_t rangesOffset = alignTo8(sizeof(MeshCacheHeader));
+        uint64_t textureRefsOffset = rangesOffset + alignTo8(uint64_t(header.meshCount) * sizeof(MeshCacheRange));
+        uint64_t lodsOffset = textureRefsOffset + alignTo8(uint64_t(header.textureRefCount) * sizeof(MeshCacheTextureRef));
+        uint64_t stringsOffset = lodsOffset + alignTo8(uint64_t(header.lodCount) * sizeof(MeshCacheLod));
+        uint64_t verticesOffset = stringsOffset + alignTo8(header.stringBytes);
+        uint64_t indicesOffset = verticesOffset + alignTo8(header.vertexCount * sizeof(Vertex));
+        uint64_t endOffset = indicesOffset + header.indexCount * sizeof(GLuint);
+        if (endOffset > file.size)
+            return false;
+
+        const MeshCacheRange* ranges = reinterpret_cast<const MeshCacheRange*>(file.data + rangesOffset);
+        const MeshCacheTextureRef* textureRefs = reinterpret_cast<const MeshCacheTextureRef*>(file.data + textureRefsOffset);
+        const MeshCacheLod* lods = reinterpret_cast<const MeshCacheLod*>(file.data + lodsOffset);
+        const char* strings = reinterpret_cast<const char*>(file.data + stringsOffset);
+        const Vertex* vertices = reinterpret_cast<const Vertex*>(file.data + verticesOffset);
+        const GLuint* indices = reinterpret_cast<const GLuint*>(file.data + indicesOffset);
+
+        std::vector<MeshData> result(header.meshCount);
+        for (uint32_t i = 0; i < header.meshCount; i++)
+        {
+            const MeshCacheRange& range = ranges[i];
+            if (uint64_t(range.firstVertex) + range.vertexCount > header.vertexCount
+                || uint64_t(range.firstIndex) + range.indexCount > header.indexCount
+                || uint64_t(range.firstTextureRef) + range.textureRefCount > header.textureRefCount
+                || uint64_t(range.firstLod) + range.lodCount > header.lodCount)
+                return false;
+
+            MeshData& mesh = result[i];
+            mesh.vertices.assign(vertices + range.firstVertex, vertices + range.firstVertex + range.vertexCount);
+            mesh.indices.assign(indices + range.firstIndex, indices + range.firstIndex + range.indexCount);
+            // indices are relative to the mesh's vertices; one past them would draw from another mesh or past the buffer
+            for (GLuint index : mesh.indices)
+            {
+                if (index >= range.vertexCount)
+                    return false;
+            }
+            mesh.bounds = AABB(glm::vec3(range.boundsMin[0], range.boundsMin[1], range.boundsMin[2]),
+                glm::vec3(range.boundsMax[0], range.boundsMax[1], range.boundsMax[2]));
+            for (uint32_t j = 0; j < range.lodCount; j++)
+            {
+                const MeshCacheLod& lod = lods[range.firstLod + j];
+                if (uint64_t(lod.firstIndex) + lod.indexCount > range.indexCount)
+                    return false;
+                mesh.lods.push_back({ lod.firstIndex, lod.indexCount, lod.error });
+            }
+            for (uint32_t j = 0; j < range.textureRefCount; j++)
+            {
+                const MeshCacheTextureRef& ref = textureRefs[range.firstTextureRef + j];
+                if (uint64_t(ref.typeOffset) + ref.typeLength > header.stringBytes
+                    || uint64_t(ref.pathOffset) + ref.pathLength > header.stringBytes)
+                    return false;
+                TextureRef texture;
+                texture.type.assign(strings + ref.typeOffset, ref.typeLength);
+                texture.path.assign(strings + ref.pathOffset, ref.pathLength);
+                mesh.textures.push_back(texture);
+            }
+        }
+
+        meshes.swap(result);
+        return true;
+    }
+}
+#endif
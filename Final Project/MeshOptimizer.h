@@ -0,0 +1,294 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glad/glad.h>
+
+#include "LevelOfDetail.h"
+#include "VertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Import-time optimization of an indexed triangle mesh:
+//   weld         merges vertices whose attributes are all equal
+//   reorder      sorts the triangles of every LOD level for the post-transform vertex cache (Forsyth's
+//                linear-speed algorithm), then sorts the vertices by first use so fetches walk the vertex
+//                buffer forwards; vertices no level uses are dropped
+// The vertex cache is measured with a FIFO cache model: ACMR is the average number of cache misses (vertex
+// shader runs) per triangle, ATVR the same per vertex, 1.0 being the ideal.
+class MeshOptimizer
+{
+public:
+    // FIFO entries of the cache model used for the statistics
+    static constexpr size_t FIFO_CACHE_SIZE = 16;
+
+    // counters of a whole model, summed over its meshes
+    struct Stats {
+        size_t verticesBefore = 0;  // as imported
+        size_t verticesAfter = 0;   // welded and without unused vertices
+        size_t triangles = 0;       // of the full detail levels
+        size_t missesBefore = 0;    // FIFO cache misses drawing the full detail levels
+        size_t missesAfter = 0;
+
+        float acmrBefore() const { return triangles > 0 ? float(missesBefore) / triangles : 0.0f; }
+        float acmrAfter() const { return triangles > 0 ? float(missesAfter) / triangles : 0.0f; }
+        float atvrBefore() const { return verticesBefore > 0 ? float(missesBefore) / verticesBefore : 0.0f; }
+        float atvrAfter() const { return verticesAfter > 0 ? float(missesAfter) / verticesAfter : 0.0f; }
+
+        Stats& operator+=(const Stats& other)
+        {
+            verticesBefore += other.verticesBefore;
+            verticesAfter += other.verticesAfter;
+            triangles += other.triangles;
+            missesBefore += other.missesBefore;
+            missesAfter += other.missesAfter;
+            return *this;
+        }
+    };
+
+    // merges identical vertices and points the indices at the survivors. Run before the LOD chain is built,
+    // so the simplifier sees the welded mesh.
+    static void weld(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, Stats& stats)
+    {
+        stats.verticesBefore += vertices.size();
+        stats.missesBefore += fifoMisses(indices.data(), indices.size());
+        stats.triangles += indices.size() / 3;
+
+        std::unordered_map<VertexKey, GLuint, VertexKeyHash> unique;
+        unique.reserve(vertices.size());
+        std::vector<GLuint> remap(vertices.size());
+        std::vector<Vertex> welded;
+        welded.reserve(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            auto inserted = unique.emplace(VertexKey(vertices[i]), GLuint(welded.size()));
+            if (inserted.second)
+                welded.push_back(vertices[i]);
+            remap[i] = inserted.first->second;
+        }
+        for (GLuint& index : indices)
+            index = remap[index];
+        vertices.swap(welded);
+    }
+
+    // sorts the triangles of every level for the vertex cache and the vertices for fetch locality.
+    // The levels share the vertex buffer, so the vertices are ordered by their first use in the full
+    // detail level, followed by the ones only coarser levels use (none for the simplifier's levels).
+    static void reorder(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, const std::vector<MeshLod>& lods, Stats& stats)
+    {
+        if (lods.empty())
+            optimizeVertexCache(indices.data(), indices.size(), vertices.size());
+        for (const MeshLod& lod : lods)
+            optimizeVertexCache(indices.data() + lod.firstIndex, lod.indexCount, vertices.size());
+
+        const size_t UNUSED = ~size_t(0);
+        std::vector<size_t> remap(vertices.size(), UNUSED);
+        std::vector<Vertex> ordered;
+        ordered.reserve(vertices.size());
+        for (GLuint& index : indices)
+        {
+            if (remap[index] == UNUSED)
+            {
+                remap[index] = ordered.size();
+                ordered.push_back(vertices[index]);
+            }
+            index = GLuint(remap[index]);
+        }
+        vertices.swap(ordered);
+
+        size_t fullDetailCount = lods.empty() ? indices.size() : lods[0].indexCount;
+        stats.verticesAfter += vertices.size();
+        stats.missesAfter += fifoMisses(indices.data(), fullDetailCount);
+    }
+
+    static void printStats(const Stats& stats)
+    {
+        size_t stride = VertexFormat::get(VERTEX_LAYOUT_FLOAT).stride;
+        std::cout << "  Mesh optimization: " << stats.verticesBefore << " -> " << stats.verticesAfter << " vertices ("
+            << (stats.verticesBefore - stats.verticesAfter) * stride / 1024 << " KiB of float vertices saved), ACMR "
+            << stats.acmrBefore() << " -> " << stats.acmrAfter() << ", ATVR " << stats.atvrBefore() << " -> " << stats.atvrAfter() << std::endl;
+    }
+
+    // cache misses drawing the triangles with a FIFO vertex cache of FIFO_CACHE_SIZE entries
+    static size_t fifoMisses(const GLuint* indices, size_t indexCount)
+    {
+        GLuint cache[FIFO_CACHE_SIZE];
+        size_t cached = 0, next = 0, misses = 0;
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            if (std::find(cache, cache + cached, indices[i]) != cache + cached)
+                continue;
+            misses++;
+            cache[next] = indices[i];
+            next = (next + 1) % FIFO_CACHE_SIZE;
+            cached = std::min(cached + 1, FIFO_CACHE_SIZE);
+        }
+        return misses;
+    }
+
+    // reorders the triangles of an index range in place (Forsyth, "Linear-Speed Vertex Cache Optimisation").
+    // Every vertex is scored by its position in a simulated LRU cache and by how many triangles still use it;
+    // the next triangle is the best scoring one among the triangles of the cached vertices.
+    static void optimizeVertexCache(GLuint* indices, size_t indexCount, size_t vertexCount)
+    {
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0)
+            return;
+
+        // triangles of every vertex, as offsets into one array
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            liveTriangles[indices[i]]++;
+        std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            firstTriangle[v + 1] = firstTriangle[v] + liveTriangles[v];
+        std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+        std::vector<uint32_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            vertexTriangles[filled[indices[i]]++] = uint32_t(i / 3);
+
+        std::vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            vertexScore[v] = scoreVertex(-1, liveTriangles[v]);
+
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<GLuint> result;
+        result.reserve(triangleCount * 3);
+        std::vector<uint32_t> cache, nextCache;
+        cache.reserve(LRU_CACHE_SIZE + 3);
+        nextCache.reserve(LRU_CACHE_SIZE + 3);
+
+        size_t scanCursor = 0;      // triangles before it are all emitted
+        int64_t best = -1;
+        while (result.size() < triangleCount * 3)
+        {
+            // nothing in the cache scores: start over at the next unemitted triangle
+            if (best < 0)
+            {
+                while (emitted[scanCursor])
+                    scanCursor++;
+                best = int64_t(scanCursor);
+            }
+
+            uint32_t triangle = uint32_t(best);
+            emitted[triangle] = true;
+            nextCache.clear();
+            for (int corner = 0; corner < 3; corner++)
+            {
+                GLuint vertex = indices[triangle * 3 + corner];
+                result.push_back(vertex);
+                if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end())
+                    nextCache.push_back(vertex);
+
+                // drop the triangle from the vertex's live list
+                uint32_t* begin = &vertexTriangles[firstTriangle[vertex]];
+                uint32_t* end = begin + liveTriangles[vertex];
+                *std::find(begin, end, triangle) = *(end - 1);
+                liveTriangles[vertex]--;
+            }
+            for (uint32_t vertex : cache)
+            {
+                if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end())
+                    nextCache.push_back(vertex);
+            }
+
+            // rescore the vertices in (and just out of) the cache and the triangles that use them
+            for (size_t i = 0; i < nextCache.size(); i++)
+            {
+                uint32_t vertex = nextCache[i];
+                vertexScore[vertex] = scoreVertex(i < LRU_CACHE_SIZE ? int(i) : -1, liveTriangles[vertex]);
+            }
+            best = -1;
+            float bestScore = -1.0f;
+            for (uint32_t vertex : nextCache)
+            {
+                for (uint32_t i = 0; i < liveTriangles[vertex]; i++)
+                {
+                    uint32_t t = vertexTriangles[firstTriangle[vertex] + i];
+                    float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                    if (score > bestScore)
+                    {
+                        bestScore = score;
+                        best = t;
+                    }
+                }
+            }
+            if (nextCache.size() > LRU_CACHE_SIZE)
+                nextCache.resize(LRU_CACHE_SIZE);
+            cache.swap(nextCache);
+        }
+        std::copy(result.begin(), result.end(), indices);
+    }
+
+private:
+    // entries of the LRU cache the reordering optimizes for
+    static constexpr size_t LRU_CACHE_SIZE = 32;
+
+    // Forsyth's scoring: the 3 most recently used vertices score the same (the triangle just emitted),
+    // older ones decay, and vertices with few triangles left get a boost so they are finished off
+    static float scoreVertex(int cachePosition, uint32_t liveTriangles)
+    {
+        const float CACHE_DECAY_POWER = 1.5f;
+        const float LAST_TRIANGLE_SCORE = 0.75f;
+        const float VALENCE_BOOST_SCALE = 2.0f;
+        const float VALENCE_BOOST_POWER = 0.5f;
+
+        if (liveTriangles == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+                score = LAST_TRIANGLE_SCORE;
+            else
+            {
+                float scaler = 1.0f / (LRU_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+        return score + VALENCE_BOOST_SCALE * std::pow(float(liveTriangles), -VALENCE_BOOST_POWER);
+    }
+
+    // a vertex compared attribute by attribute (the struct has padding, so no memcmp)
+    struct VertexKey {
+        Vertex vertex;
+
+        explicit VertexKey(const Vertex& vertex) : vertex(vertex) {}
+
+        bool operator==(const VertexKey& other) const
+        {
+            const Vertex& a = vertex;
+            const Vertex& b = other.vertex;
+            return a.x == b.x && a.y == b.y && a.z == b.z && a.r == b.r && a.g == b.g && a.b == b.b
+                && a.u == b.u && a.v == b.v && a.nx == b.nx && a.ny == b.ny && a.nz == b.nz;
+        }
+    };
+
+    struct VertexKeyHash {
+        size_t operator()(const VertexKey& key) const
+        {
+            const Vertex& v = key.vertex;
+            uint64_t hash = 14695981039346656037ull;
+            for (float value : { v.x, v.y, v.z, v.u, v.v, v.nx, v.ny, v.nz })
+                hash = (hash ^ floatBits(value)) * 1099511628211ull;
+            hash = (hash ^ (uint32_t(v.r) | uint32_t(v.g) << 8 | uint32_t(v.b) << 16)) * 1099511628211ull;
+            return size_t(hash);
+        }
+
+        // equal floats give equal bits, with -0 folded onto 0
+        static uint32_t floatBits(float value)
+        {
+            value += 0.0f;
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+    };
+};
+#endif
@@ -0,0 +1,466 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "LevelOfDetail.h"
+#include "VertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Quadric error metric simplification (Garland/Heckbert) of an indexed triangle mesh.
+// Vertices at the same position are welded into one position for the simplifier, and edges collapse from
+// one position onto another (half-edge collapses), so the kept vertices keep their exact attributes and
+// every level can index the mesh's original vertex buffer. A collapse moves every vertex of the removed
+// position onto the vertex of the kept position it shares a triangle with, which keeps UV seams and hard
+// normal edges (split vertices) intact: a collapse that would pull one side of a seam across the other is
+// rejected. Collapses are also rejected when they flip a triangle, bend a vertex normal too far, break the
+// manifold (link condition) or move an open border.
+class MeshSimplifier
+{
+public:
+    // each level keeps about this fraction of the triangles of the level before
+    static constexpr float LEVEL_RATIO = 0.5f;
+    static constexpr size_t MAX_LEVELS = 6;         // including the full detail level
+    static constexpr size_t MIN_TRIANGLES = 64;
+
+    MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+        : vertices(vertices)
+    {
+        weldPositions();
+        buildTriangles(indices);
+        buildQuadrics();
+        findBorders();
+        for (uint32_t position = 0; position < positions.size(); position++)
+            pushCollapses(position);
+    }
+
+    // collapses the cheapest edges until at most targetTriangles are left or no valid collapse remains
+    void simplify(size_t targetTriangles)
+    {
+        while (liveTriangles > targetTriangles && !candidates.empty())
+        {
+            Collapse collapse = candidates.top();
+            candidates.pop();
+            const Position& from = positions[collapse.from];
+            const Position& to = positions[collapse.to];
+            if (!from.alive || !to.alive || from.version != collapse.fromVersion || to.version != collapse.toVersion)
+                continue;
+            if (!tryCollapse(collapse.from, collapse.to))
+                continue;
+            maxCost = std::max(maxCost, collapse.cost);
+        }
+    }
+
+    size_t triangleCount() const
+    {
+        return liveTriangles;
+    }
+
+    // distance bound of the collapses so far, in mesh units: the square root of the largest quadric error,
+    // which is at least the distance to every original plane the collapsed vertices were on
+    float error() const
+    {
+        return float(std::sqrt(std::max(maxCost, 0.0)));
+    }
+
+    // appends the indices of the current triangles
+    void appendIndices(std::vector<GLuint>& out) const
+    {
+        for (const Triangle& triangle : triangles)
+        {
+            if (!triangle.removed)
+                out.insert(out.end(), triangle.v, triangle.v + 3);
+        }
+    }
+
+    // builds the LOD chain of a mesh: the simplified levels are appended to its index buffer, and lods gets
+    // one entry per level, the full detail level first. Levels stop when the mesh cannot be simplified any further.
+    static void buildLods(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices, std::vector<MeshLod>& lods)
+    {
+        lods.clear();
+        lods.push_back({ 0, uint32_t(indices.size()), 0.0f });
+        size_t triangles = indices.size() / 3;
+        if (triangles <= MIN_TRIANGLES)
+            return;
+
+        MeshSimplifier simplifier(vertices, indices);
+        while (lods.size() < MAX_LEVELS && triangles > MIN_TRIANGLES)
+        {
+            size_t target = std::max(MIN_TRIANGLES, size_t(float(triangles) * LEVEL_RATIO));
+            simplifier.simplify(target);
+            // a level that saves little is not worth its indices
+            if (simplifier.triangleCount() > triangles * 7 / 8)
+                break;
+            triangles = simplifier.triangleCount();
+            MeshLod lod;
+            lod.firstIndex = uint32_t(indices.size());
+            simplifier.appendIndices(indices);
+            lod.indexCount = uint32_t(indices.size()) - lod.firstIndex;
+            lod.error = simplifier.error();
+            lods.push_back(lod);
+        }
+    }
+
+private:
+    // symmetric 4x4 matrix of a sum of squared plane distances
+    struct Quadric {
+        double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+
+        static Quadric plane(const glm::dvec3& normal, double distance)
+        {
+            Quadric q;
+            q.xx = normal.x * normal.x; q.xy = normal.x * normal.y; q.xz = normal.x * normal.z; q.xw = normal.x * distance;
+            q.yy = normal.y * normal.y; q.yz = normal.y * normal.z; q.yw = normal.y * distance;
+            q.zz = normal.z * normal.z; q.zw = normal.z * distance;
+            q.ww = distance * distance;
+            return q;
+        }
+
+        void add(const Quadric& q)
+        {
+            xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+            yy += q.yy; yz += q.yz; yw += q.yw;
+            zz += q.zz; zw += q.zw;
+            ww += q.ww;
+        }
+
+        double evaluate(const glm::dvec3& p) const
+        {
+            return xx * p.x * p.x + 2.0 * xy * p.x * p.y + 2.0 * xz * p.x * p.z + 2.0 * xw * p.x
+                + yy * p.y * p.y + 2.0 * yz * p.y * p.z + 2.0 * yw * p.y
+                + zz * p.z * p.z + 2.0 * zw * p.z + ww;
+        }
+    };
+
+    struct Position {
+        glm::dvec3 point;
+        Quadric quadric;
+        std::vector<uint32_t> triangles;    // incident triangles, removed ones are dropped lazily
+        uint32_t version = 0;               // bumped whenever the quadric grows, to spot stale candidates
+        bool alive = true;
+        bool locked = false;                // on an open border or a non-manifold edge
+    };
+
+    struct Triangle {
+        GLuint v[3];
+        bool removed = false;
+    };
+
+    struct Collapse {
+        double cost;
+        uint32_t from, to;
+        uint32_t fromVersion, toVersion;
+
+        bool operator<(const Collapse& other) const
+        {
+            return cost > other.cost;   // cheapest on top
+        }
+    };
+
+    // the dot product of the two vertex normals of a collapse must stay above this
+    static constexpr float NORMAL_LIMIT = 0.5f;
+    // and every moved triangle must keep its facing within this (cosine of the angle)
+    static constexpr double FLIP_LIMIT = 0.2;
+
+    const std::vector<Vertex>& vertices;
+    std::vector<uint32_t> positionOf;   // per vertex
+    std::vector<Position> positions;
+    std::vector<Triangle> triangles;
+    std::priority_queue<Collapse> candidates;
+    size_t liveTriangles = 0;
+    double maxCost = 0.0;
+
+    // scratch of tryCollapse
+    std::vector<std::pair<GLuint, GLuint>> remap;
+    std::vector<uint32_t> fromNeighbours, toNeighbours;
+
+    void weldPositions()
+    {
+        struct Key {
+            float x, y, z;
+            bool operator==(const Key& other) const
+            {
+                return std::memcmp(this, &other, sizeof(Key)) == 0;
+            }
+        };
+        struct KeyHash {
+            size_t operator()(const Key& key) const
+            {
+                uint32_t bits[3];
+                std::memcpy(bits, &key, sizeof(bits));
+                return (size_t(bits[0]) * 73856093u) ^ (size_t(bits[1]) * 19349663u) ^ (size_t(bits[2]) * 83492791u);
+            }
+        };
+
+        std::unordered_map<Key, uint32_t, KeyHash> welded;
+        welded.reserve(vertices.size());
+        positionOf.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            Key key = { vertices[i].x, vertices[i].y, vertices[i].z };
+            auto found = welded.emplace(key, uint32_t(positions.size()));
+            if (found.second)
+            {
+                positions.push_back(Position());
+                positions.back().point = glm::dvec3(key.x, key.y, key.z);
+            }
+            positionOf[i] = found.first->second;
+        }
+    }
+
+    void buildTriangles(const std::vector<GLuint>& indices)
+    {
+        triangles.reserve(indices.size() / 3);
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            Triangle triangle;
+            std::copy(indices.begin() + i, indices.begin() + i + 3, triangle.v);
+            uint32_t a = positionOf[triangle.v[0]], b = positionOf[triangle.v[1]], c = positionOf[triangle.v[2]];
+            // triangles that are already degenerate in position space would only get in the way
+            if (a == b || b == c || c == a)
+                continue;
+            uint32_t index = uint32_t(triangles.size());
+            triangles.push_back(triangle);
+            positions[a].triangles.push_back(index);
+            positions[b].triangles.push_back(index);
+            positions[c].triangles.push_back(index);
+        }
+        liveTriangles = triangles.size();
+    }
+
+    // every position starts with the planes of its triangles
+    void buildQuadrics()
+    {
+        for (const Triangle& triangle : triangles)
+        {
+            glm::dvec3 p0 = pointOf(triangle.v[0]), p1 = pointOf(triangle.v[1]), p2 = pointOf(triangle.v[2]);
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(normal);
+            if (length <= 0.0)
+                continue;
+            normal /= length;
+            Quadric plane = Quadric::plane(normal, -glm::dot(normal, p0));
+            for (GLuint vertex : triangle.v)
+                positions[positionOf[vertex]].quadric.add(plane);
+        }
+    }
+
+    // locks the ends of every edge that does not have exactly two triangles
+    void findBorders()
+    {
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        edgeUses.reserve(triangles.size() * 3);
+        for (const Triangle& triangle : triangles)
+        {
+            for (int corner = 0; corner < 3; corner++)
+                edgeUses[edgeKey(positionOf[triangle.v[corner]], positionOf[triangle.v[(corner + 1) % 3]])]++;
+        }
+        for (const auto& edge : edgeUses)
+        {
+            if (edge.second == 2)
+                continue;
+            positions[uint32_t(edge.first >> 32)].locked = true;
+            positions[uint32_t(edge.first & 0xFFFFFFFFu)].locked = true;
+        }
+    }
+
+    static uint64_t edgeKey(uint32_t a, uint32_t b)
+    {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+
+    glm::dvec3 pointOf(GLuint vertex) const
+    {
+        return positions[positionOf[vertex]].point;
+    }
+
+    static glm::vec3 normalOf(const Vertex& vertex)
+    {
+        return glm::vec3(vertex.nx, vertex.ny, vertex.nz);
+    }
+
+    // drops the removed triangles from a position's list
+    void compact(uint32_t position)
+    {
+        std::vector<uint32_t>& list = positions[position].triangles;
+        list.erase(std::remove_if(list.begin(), list.end(), [this](uint32_t t) { return triangles[t].removed; }), list.end());
+    }
+
+    // distinct positions sharing a triangle with a position
+    void neighbours(uint32_t position, std::vector<uint32_t>& out)
+    {
+        out.clear();
+        for (uint32_t t : positions[position].triangles)
+        {
+            for (GLuint vertex : triangles[t].v)
+            {
+                uint32_t other = positionOf[vertex];
+                if (other != position)
+                    out.push_back(other);
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // queues the collapses of a position onto each of its neighbours and of each neighbour onto it
+    void pushCollapses(uint32_t position)
+    {
+        compact(position);
+        neighbours(position, toNeighbours);
+        for (uint32_t other : toNeighbours)
+        {
+            pushCollapse(position, other);
+            pushCollapse(other, position);
+        }
+    }
+
+    void pushCollapse(uint32_t from, uint32_t to)
+    {
+        const Position& source = positions[from];
+        const Position& target = positions[to];
+        if (source.locked)
+            return;
+        Quadric combined = source.quadric;
+        combined.add(target.quadric);
+        candidates.push({ std::max(0.0, combined.evaluate(target.point)), from, to, source.version, target.version });
+    }
+
+    bool tryCollapse(uint32_t from, uint32_t to)
+    {
+        compact(from);
+        compact(to);
+        Position& source = positions[from];
+        Position& target = positions[to];
+
+        // the vertex of the kept position every vertex of the removed one moves to, from the triangles on the edge
+        remap.clear();
+        size_t edgeTriangles = 0;
+        for (uint32_t t : source.triangles)
+        {
+            const Triangle& triangle = triangles[t];
+            GLuint fromVertex = 0, toVertex = 0;
+            bool onEdge = false;
+            for (GLuint vertex : triangle.v)
+            {
+                if (positionOf[vertex] == from)
+                    fromVertex = vertex;
+                else if (positionOf[vertex] == to)
+                {
+                    toVertex = vertex;
+                    onEdge = true;
+                }
+            }
+            if (!onEdge)
+                continue;
+            edgeTriangles++;
+            for (const auto& pair : remap)
+            {
+                // one side of a seam would end up on two vertices
+                if (pair.first == fromVertex && pair.second != toVertex)
+                    return false;
+            }
+            remap.push_back({ fromVertex, toVertex });
+        }
+        if (edgeTriangles == 0)
+            return false;
+
+        for (const auto& pair : remap)
+        {
+            if (glm::dot(normalOf(vertices[pair.first]), normalOf(vertices[pair.second])) < NORMAL_LIMIT)
+                return false;
+        }
+
+        // every other triangle must have its vertex remapped and keep facing the same way
+        for (uint32_t t : source.triangles)
+        {
+            const Triangle& triangle = triangles[t];
+            int corner = -1;
+            bool onEdge = false;
+            for (int i = 0; i < 3; i++)
+            {
+                uint32_t position = positionOf[triangle.v[i]];
+                if (position == from)
+                    corner = i;
+                else if (position == to)
+                    onEdge = true;
+            }
+            if (onEdge)
+                continue;
+            GLuint moved;
+            if (!findTarget(triangle.v[corner], moved))
+                return false;
+
+            glm::dvec3 p[3] = { pointOf(triangle.v[0]), pointOf(triangle.v[1]), pointOf(triangle.v[2]) };
+            glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            p[corner] = target.point;
+            glm::dvec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+            double lengths = glm::length(before) * glm::length(after);
+            if (lengths <= 0.0 || glm::dot(before, after) < FLIP_LIMIT * lengths)
+                return false;
+        }
+
+        // link condition: the two positions may only share the neighbours across the edge's triangles
+        neighbours(from, fromNeighbours);
+        neighbours(to, toNeighbours);
+        size_t shared = 0;
+        for (uint32_t position : fromNeighbours)
+        {
+            if (std::binary_search(toNeighbours.begin(), toNeighbours.end(), position))
+                shared++;
+        }
+        if (shared > edgeTriangles)
+            return false;
+
+        // apply
+        for (uint32_t t : source.triangles)
+        {
+            Triangle& triangle = triangles[t];
+            bool onEdge = false;
+            for (GLuint vertex : triangle.v)
+                onEdge = onEdge || positionOf[vertex] == to;
+            if (onEdge)
+            {
+                triangle.removed = true;
+                liveTriangles--;
+                continue;
+            }
+            for (GLuint& vertex : triangle.v)
+            {
+                if (positionOf[vertex] == from)
+                    findTarget(vertex, vertex);
+            }
+            target.triangles.push_back(t);
+        }
+        source.triangles.clear();
+        source.alive = false;
+        target.quadric.add(source.quadric);
+        target.version++;
+        pushCollapses(to);
+        return true;
+    }
+
+    // the vertex of the kept position that a vertex of the removed one moves to
+    bool findTarget(GLuint vertex, GLuint& moved) const
+    {
+        for (const auto& pair : remap)
+        {
+            if (pair.first == vertex)
+            {
+                moved = pair.second;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+#endif
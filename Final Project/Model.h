@@ -14,7 +14,20 @@
 
 #include "Shader.h"
 #include "Mesh.h"
+#include "AssetLoader.h"
+#include "GpuCulling.h"
+#include "JobSystem.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Profiler.h"
+#include "TextureContainer.h"
+#include "TextureManager.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 #include <fstream>
@@ -22,16 +35,20 @@
 #include <iostream>
 #include <map>
 
-GLuint TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
-
 class Model
 {
 public:
     // model data 
-    std::vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     std::vector<Mesh>    meshes;
     std::string directory;
+    std::string name;       // the last directory of the path, names the model's draws in the profiler
     bool gammaCorrection;
+    bool ready = false;     // meshes are uploaded and the model can be drawn
+    AABB bounds;            // of all meshes, in model space; valid once ready
+    BoundingSphere sphere;
+
+    // post-processing applied by ASSIMP. Part of the mesh cache key, so changing it invalidates every baked model.
+    static const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_GenBoundingBoxes;
 
     // constructor, expects a filepath to a 3D model.
     Model(std::string const& path, bool gamma = false) : gammaCorrection(gamma)
@@ -39,35 +56,327 @@ public:
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader& shader)
+    // asynchronous constructor. Returns immediately; the mesh data is read on one of the loader's worker
+    // threads, uploaded later on the render thread, and the textures stream in behind white placeholders.
+    // The model draws nothing until its meshes are uploaded. The loader must be shut down before the model is destroyed.
+    Model(std::string const& path, AssetLoader& assetLoader, bool gamma = false) : gammaCorrection(gamma), loader(&assetLoader)
+    {
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+        name = directory.substr(directory.find_last_of('/') + 1);
+
+        auto start = std::chrono::steady_clock::now();
+        loader->enqueue([this, path, start]() {
+            std::shared_ptr<std::vector<MeshData>> meshData = std::make_shared<std::vector<MeshData>>();
+            bool fromCache = false;
+            if (!readMeshData(path, *meshData, fromCache))
+                return;
+            loader->enqueueMainThread([this, path, start, meshData, fromCache]() {
+                createMeshes(*meshData);
+                std::cout << "Loaded " << path << (fromCache ? " from mesh cache" : " with ASSIMP") << " in background, ready after " << millisecondsSince(start) << " ms" << std::endl;
+                reportVertexMemory();
+            });
+        });
+    }
+
+    // draws the model, and thus all its meshes, each at the level of detail the detail scale asks for
+    void Draw(Shader& shader, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (!ready)
+            return;
+        ProfileScope scope(name, true);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(shader, detailScale);
+    }
+
+    // draws every mesh with the variant for its own shader features plus the pass features, e.g. the shadow
+    // filter's. Each variant is made current and handed to setup the first time a mesh of this call uses it.
+    void Draw(ShaderVariants& variants, uint32_t passFeatures, const ShaderSetup& setup, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (!ready)
+            return;
+        ProfileScope scope(name, true);
+        VariantSwitch current(variants, passFeatures, setup);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(current.use(meshes[i]), detailScale);
+    }
+
+    // draws every mesh once per instance in the buffer with the INSTANCED variants, as Draw picks them
+    void DrawInstanced(ShaderVariants& variants, uint32_t passFeatures, const ShaderSetup& setup, const InstanceBuffer& instances, GLuint repeat = 1, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (!ready)
+            return;
+        ProfileScope scope(name + " instances", true);
+        VariantSwitch current(variants, passFeatures | SHADER_FEATURE_INSTANCED, setup);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            meshes[i].DrawInstanced(current.use(meshes[i]), instances, repeat, detailScale);
+    }
+
+    // draws every mesh once per instance in the buffer. The shader must be one of the instanced variants,
+    // which take the model matrix from the instance buffer instead of the modelMatrix uniform.
+    void DrawInstanced(Shader& shader, const InstanceBuffer& instances, GLuint repeat = 1, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (!ready)
+            return;
+        ProfileScope scope(name + " instances", true);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            meshes[i].DrawInstanced(shader, instances, repeat, detailScale);
+    }
+
+    // draws the instances the last culling.cull() over this model's meshes left visible in a view, one
+    // multi-draw per mesh, with the INSTANCED and INDIRECT_INSTANCES variants as Draw picks them
+    void DrawIndirect(ShaderVariants& variants, uint32_t passFeatures, const ShaderSetup& setup, GpuCulling& culling, int view)
+    {
+        if (!ready || !culling.culled(view))
+            return;
+        ProfileScope scope(name + " indirect", true);
+        VariantSwitch current(variants, passFeatures | SHADER_FEATURE_INSTANCED | SHADER_FEATURE_INDIRECT_INSTANCES, setup);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            culling.draw(meshes[i], i, view, current.use(meshes[i]));
+    }
+
+    // the same with one shader, which must be an INSTANCED and INDIRECT_INSTANCES one and already current
+    void DrawIndirect(Shader& shader, GpuCulling& culling, int view)
     {
+        if (!ready || !culling.culled(view))
+            return;
+        ProfileScope scope(name + " indirect", true);
         for (GLuint i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            culling.draw(meshes[i], i, view, shader);
+    }
+
+    // draws instanceCount copies of the model, for shaders that place the copies by gl_InstanceID
+    void DrawCopies(Shader& shader, GLsizei instanceCount, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (!ready)
+            return;
+        ProfileScope scope(name, true);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            meshes[i].DrawCopies(shader, instanceCount, detailScale);
+    }
+
+    // releases the model's geometry ranges and texture references. The geometry arena reuses the
+    // space for the next model loaded, so models can be unloaded and loaded again at runtime.
+    void unload()
+    {
+        ready = false;
+        meshes.clear();
+        bounds = AABB();
+        sphere = BoundingSphere();
+    }
+
+    // offline bake step: imports the model with ASSIMP and writes its mesh cache, then bakes every texture it
+    // references into a texture container (block compressed unless compressTextures is false). Needs no OpenGL context.
+    static bool Bake(std::string const& path, bool compressTextures = true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<MeshData> meshData;
+        if (!importModel(path, meshData))
+            return false;
+
+        std::string cachePath = MeshCache::cachePathFor(path);
+        if (!MeshCache::write(cachePath, MeshCache::sourceStamp(path), IMPORT_FLAGS, meshData))
+        {
+            std::cout << "ERROR::MESHCACHE:: could not write " << cachePath << std::endl;
+            return false;
+        }
+        std::cout << "Baked " << path << " -> " << cachePath << " in " << millisecondsSince(start) << " ms" << std::endl;
+
+        // every texture once, baked in parallel; the reports are printed in order afterwards
+        std::string modelDirectory = path.substr(0, path.find_last_of('/'));
+        std::vector<TextureRef> textures;
+        for (const MeshData& data : meshData)
+        {
+            for (const TextureRef& ref : data.textures)
+            {
+                auto samePath = [&ref](const TextureRef& other) { return other.path == ref.path; };
+                if (std::find_if(textures.begin(), textures.end(), samePath) == textures.end())
+                    textures.push_back(ref);
+            }
+        }
+        std::vector<std::string> reports(textures.size());
+        std::vector<char> succeeded(textures.size(), 0);
+        JobSystem::instance().parallelFor(textures.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                auto textureStart = std::chrono::steady_clock::now();
+                std::string imagePath = modelDirectory + '/' + textures[i].path;
+                TextureContainer::Compression compression = compressTextures ? TextureContainer::compressionFor(textures[i].type) : TextureContainer::COMPRESS_NONE;
+                std::ostringstream report;
+                succeeded[i] = TextureContainer::bake(imagePath, compression);
+                if (succeeded[i])
+                    report << "Baked " << imagePath << " -> " << TextureContainer::containerPathFor(imagePath) << " in " << millisecondsSince(textureStart) << " ms";
+                else
+                    report << "ERROR::TEXTURECONTAINER:: could not bake " << imagePath;
+                reports[i] = report.str();
+            }
+        });
+        bool success = true;
+        for (size_t i = 0; i < textures.size(); i++)
+        {
+            std::cout << reports[i] << std::endl;
+            success = success && succeeded[i];
+        }
+        return success;
     }
 
 private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    AssetLoader* loader = nullptr;  // set when the model loads asynchronously
+
+    // the variant the meshes of a draw call are using; it only changes, and is set up, when a mesh needs another one
+    struct VariantSwitch {
+        ShaderVariants& variants;
+        uint32_t passFeatures;
+        const ShaderSetup& setup;
+        Shader* current = nullptr;
+
+        VariantSwitch(ShaderVariants& variants, uint32_t passFeatures, const ShaderSetup& setup)
+            : variants(variants), passFeatures(passFeatures), setup(setup)
+        {
+        }
+
+        Shader& use(const Mesh& mesh)
+        {
+            Shader& shader = variants.get(passFeatures | mesh.shaderFeatures);
+            if (&shader != current)
+            {
+                shader.use();
+                setup(shader);
+                current = &shader;
+            }
+            return shader;
+        }
+    };
+
+    // loads a model from its mesh cache if the cache is up to date, otherwise imports it with ASSIMP
+    // (and refreshes the cache), then stores the resulting meshes in the meshes vector.
     void loadModel(std::string const& path)
+    {
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+        name = directory.substr(directory.find_last_of('/') + 1);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<MeshData> meshData;
+        bool fromCache = false;
+        if (!readMeshData(path, meshData, fromCache))
+            return;
+        createMeshes(meshData);
+
+        std::cout << "Loaded " << path << (fromCache ? " from mesh cache" : " with ASSIMP") << " in " << millisecondsSince(start) << " ms" << std::endl;
+        reportVertexMemory();
+    }
+
+    // reads the CPU-side mesh data from the mesh cache, or via ASSIMP when the cache is stale (refreshing it).
+    // Does not touch OpenGL, so it is safe to call from a worker thread.
+    static bool readMeshData(std::string const& path, std::vector<MeshData>& meshData, bool& fromCache)
+    {
+        std::string cachePath = MeshCache::cachePathFor(path);
+        uint64_t stamp = MeshCache::sourceStamp(path);
+        fromCache = MeshCache::read(cachePath, stamp, IMPORT_FLAGS, meshData);
+        if (fromCache)
+            return true;
+
+        if (!importModel(path, meshData))
+            return false;
+        if (!MeshCache::write(cachePath, stamp, IMPORT_FLAGS, meshData))
+            std::cout << "ERROR::MESHCACHE:: could not write " << cachePath << std::endl;
+        return true;
+    }
+
+    // uploads the mesh data and resolves its textures. Render thread only.
+    void createMeshes(const std::vector<MeshData>& meshData)
+    {
+        for (const MeshData& data : meshData)
+        {
+            std::vector<Texture> textures;
+            for (const TextureRef& ref : data.textures)
+                textures.push_back(loadTexture(ref));
+            meshes.push_back(Mesh(data.vertices, data.indices, textures, data.bounds, data.lods));
+            bounds.extend(meshes.back().bounds);
+        }
+        sphere = BoundingSphere::fromAABB(bounds);
+        ready = true;
+    }
+
+    // prints the vertex memory of the uploaded layouts against the 32 bit float reference layout
+    void reportVertexMemory() const
+    {
+        size_t vertexCount = 0, packedBytes = 0;
+        GLsizei stride = 0;
+        for (const Mesh& mesh : meshes)
+        {
+            stride = VertexFormat::get(mesh.layout).stride;
+            vertexCount += mesh.vertices.size();
+            packedBytes += mesh.vertices.size() * stride;
+        }
+        GLsizei referenceStride = VertexFormat::get(VERTEX_LAYOUT_FLOAT).stride;
+        std::cout << "  " << vertexCount << " vertices, " << referenceStride << " -> " << stride << " bytes per vertex ("
+            << vertexCount * referenceStride / 1024 << " -> " << packedBytes / 1024 << " KiB)" << std::endl;
+
+        // 16 bit indices against 32 bit ones
+        size_t indexCount = 0, indexBytes = 0, shortMeshes = 0;
+        for (const Mesh& mesh : meshes)
+        {
+            bool isShort = mesh.indexType == GL_UNSIGNED_SHORT;
+            indexCount += mesh.indices.size();
+            indexBytes += mesh.indices.size() * (isShort ? sizeof(GLushort) : sizeof(GLuint));
+            shortMeshes += isShort ? 1 : 0;
+        }
+        std::cout << "  " << indexCount << " indices, " << shortMeshes << " of " << meshes.size() << " meshes with 16 bit indices ("
+            << indexCount * sizeof(GLuint) / 1024 << " -> " << indexBytes / 1024 << " KiB)" << std::endl;
+
+        for (const Mesh& mesh : meshes)
+        {
+            std::cout << "  LODs:";
+            for (const MeshLod& lod : mesh.lods)
+                std::cout << " " << lod.indexCount / 3 << " (" << lod.error << ")";
+            std::cout << " triangles (error)" << std::endl;
+        }
+    }
+
+    static double millisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // reads a model file via ASSIMP into CPU-side mesh data. Does not touch OpenGL.
+    static bool importModel(std::string const& path, std::vector<MeshData>& meshData)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, IMPORT_FLAGS);
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
-            return;
+            return false;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        processNode(scene->mRootNode, scene, meshData);
+
+        // welded vertices, simplified levels of detail and cache friendly orders, all baked into the mesh cache.
+        // The meshes are independent, so they are processed in parallel
+        std::vector<MeshOptimizer::Stats> meshStats(meshData.size());
+        JobSystem::instance().parallelFor(meshData.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                MeshData& data = meshData[i];
+                MeshOptimizer::weld(data.vertices, data.indices, meshStats[i]);
+                MeshSimplifier::buildLods(data.vertices, data.indices, data.lods);
+                MeshOptimizer::reorder(data.vertices, data.indices, data.lods, meshStats[i]);
+            }
+        });
+        MeshOptimizer::Stats stats;
+        for (const MeshOptimizer::Stats& mesh : meshStats)
+            stats += mesh;
+        MeshOptimizer::printStats(stats);
+        return true;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    static void processNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData)
     {
         // process each mesh located at the current node
         for (GLuint i = 0; i < node->mNumMeshes; i++)
@@ -75,22 +384,22 @@ private:
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            meshData.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (GLuint i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, meshData);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    static MeshData processMesh(aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        std::vector<Vertex> vertices;
-        std::vector<GLuint> indices;
-        std::vector<Texture> textures;
+        MeshData data;
+        std::vector<Vertex>& vertices = data.vertices;
+        std::vector<GLuint>& indices = data.indices;
 
         // walk through each of the mesh's vertices
         for (GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -101,15 +410,12 @@ private:
             vertex.y = mesh->mVertices[i].y;
             vertex.z = mesh->mVertices[i].z;
 
-            // vertex color
-            if (mesh->GetNumColorChannels() > 0 && mesh->HasVertexColors(i))
+            // vertex color (assimp stores it as floats in [0, 1])
+            if (mesh->HasVertexColors(0))
             {
-                for (GLuint j = 0; j < mesh->mNumVertices; j++)
-                {
-                    vertex.r = mesh->mColors[0][j].r;
-                    vertex.g = mesh->mColors[0][j].g;
-                    vertex.b = mesh->mColors[0][j].b;
-                }
+                vertex.r = GLubyte(std::clamp(mesh->mColors[0][i].r, 0.0f, 1.0f) * 255.0f + 0.5f);
+                vertex.g = GLubyte(std::clamp(mesh->mColors[0][i].g, 0.0f, 1.0f) * 255.0f + 0.5f);
+                vertex.b = GLubyte(std::clamp(mesh->mColors[0][i].b, 0.0f, 1.0f) * 255.0f + 0.5f);
             }
             else 
             {
@@ -159,94 +465,48 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
         // 2. specular maps
-        std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        collectMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        collectMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", data.textures);
+
+        // bounds, from aiProcess_GenBoundingBoxes
+        data.bounds = AABB(glm::vec3(mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z),
+            glm::vec3(mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z));
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return the extracted mesh data
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+    // records every material texture of a given type. Loading happens later in loadTexture, so the
+    // references can be baked into the mesh cache as they are.
+    static void collectMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName, std::vector<TextureRef>& textures)
     {
-        std::vector<Texture> textures;
         for (GLuint i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (GLuint j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            TextureRef ref;
+            ref.type = typeName;
+            ref.path = str.C_Str();
+            textures.push_back(ref);
         }
-        return textures;
     }
-};
-
-
-GLuint TextureFromFile(const char* path, const std::string& directory, bool gamma)
-{
-    std::string filename = std::string(path);
-    filename = directory + '/' + filename;
 
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    // resolves a material texture through the process-wide TextureManager, which only loads it
+    // if no model has loaded it before. The required info is returned as a Texture struct.
+    Texture loadTexture(const TextureRef& ref)
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        Texture texture;
+        texture.handle = TextureManager::instance().acquire(ref.path, this->directory, gammaCorrection, loader);
+        texture.id = texture.handle.id();
+        texture.type = ref.type;
+        texture.path = ref.path;
+        return texture;
     }
+};
 
-    return textureID;
-}
 #endif
\ No newline at end of file
@@ -0,0 +1,410 @@
+#ifndef ORBIT_ENGINE_H
+#define ORBIT_ENGINE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "JobSystem.h"
+
+// The AVX2 kernel is compiled for x86 whatever the build's target, and picked at run time if the CPU has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ORBIT_ENGINE_AVX2 1
+#define ORBIT_ENGINE_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define ORBIT_ENGINE_AVX2 1
+#define ORBIT_ENGINE_AVX2_TARGET
+#else
+#define ORBIT_ENGINE_AVX2 0
+#endif
+
+// Keplerian elements of one body. The reference plane is the scene's XZ plane, with Y up.
+struct OrbitalElements {
+    float semiMajorAxis;
+    float eccentricity;         // 0 is a circle; clamped below MAX_ECCENTRICITY
+    float inclination;          // radians against the XZ plane
+    float ascendingNode;        // longitude of the ascending node, radians
+    float argumentOfPeriapsis;  // radians
+    float meanAnomaly;          // at time 0, radians
+    float meanMotion;           // radians per second
+    float scale;                // of the body's model
+    float spinSpeed;            // radians per second around the body's Y axis
+    float spinPhase;            // radians at time 0
+};
+
+// Propagates many bodies on Kepler orbits and writes their model matrices.
+// The elements are stored as structure of arrays, with the orbit's orientation and size folded into two
+// perifocal vectors, so a body's position is cos(E) * P + sin(E) * Q + C for its eccentric anomaly E.
+// Kepler's equation M = E - e sin(E) is solved with a fixed number of Newton steps, enough for the most
+// eccentric body, so 8 bodies go through the AVX2 kernel in lockstep; sine and cosine are one polynomial
+// evaluation shared by both paths, so the scalar fallback gives the same positions. The bodies are split
+// into slices run with the JobSystem's parallelFor, and the matrices go straight to the output, which can
+// be a mapped instance buffer (see InstanceBuffer::map).
+class OrbitEngine
+{
+public:
+    static constexpr float MAX_ECCENTRICITY = 0.95f;
+    // probe points whose nearest body propagate() finds along the way
+    static constexpr size_t MAX_PROBES = 4;
+    // slices smaller than this are not worth another thread
+    static constexpr size_t MIN_BODIES_PER_THREAD = 4096;
+    static constexpr unsigned int MAX_SLICES = 256;
+
+    OrbitEngine()
+    {
+        useAvx2 = avx2Supported();
+    }
+
+    void reserve(size_t count)
+    {
+        for (std::vector<float>* column : columns())
+            column->reserve(count);
+    }
+
+    void add(const OrbitalElements& elements)
+    {
+        float e = std::min(std::max(elements.eccentricity, 0.0f), MAX_ECCENTRICITY);
+        float a = elements.semiMajorAxis;
+        float b = a * std::sqrt(1.0f - e * e);
+
+        // perifocal axes, towards periapsis and 90 degrees ahead, rotated by the node, inclination and
+        // argument of periapsis; z up in the textbook frame is y up here
+        float cosNode = std::cos(elements.ascendingNode), sinNode = std::sin(elements.ascendingNode);
+        float cosInclination = std::cos(elements.inclination), sinInclination = std::sin(elements.inclination);
+        float cosPeriapsis = std::cos(elements.argumentOfPeriapsis), sinPeriapsis = std::sin(elements.argumentOfPeriapsis);
+        glm::vec3 p(cosNode * cosPeriapsis - sinNode * sinPeriapsis * cosInclination,
+            sinPeriapsis * sinInclination,
+            sinNode * cosPeriapsis + cosNode * sinPeriapsis * cosInclination);
+        glm::vec3 q(-cosNode * sinPeriapsis - sinNode * cosPeriapsis * cosInclination,
+            cosPeriapsis * sinInclination,
+            -sinNode * sinPeriapsis + cosNode * cosPeriapsis * cosInclination);
+
+        meanAnomaly.push_back(elements.meanAnomaly);
+        meanMotion.push_back(elements.meanMotion);
+        eccentricity.push_back(e);
+        px.push_back(a * p.x); py.push_back(a * p.y); pz.push_back(a * p.z);
+        qx.push_back(b * q.x); qy.push_back(b * q.y); qz.push_back(b * q.z);
+        cx.push_back(-a * e * p.x); cy.push_back(-a * e * p.y); cz.push_back(-a * e * p.z);
+        scale.push_back(elements.scale);
+        spinSpeed.push_back(elements.spinSpeed);
+        spinPhase.push_back(elements.spinPhase);
+
+        maxEccentricity = std::max(maxEccentricity, e);
+        maxApoapsis = std::max(maxApoapsis, a * (1.0f + e));
+        maxHeight = std::max(maxHeight, a * (1.0f + e) * std::abs(sinInclination));
+        maxScale = std::max(maxScale, elements.scale);
+    }
+
+    size_t size() const
+    {
+        return meanAnomaly.size();
+    }
+
+    // farthest any body gets from the origin, and from the XZ plane
+    float apoapsisBound() const { return maxApoapsis; }
+    float heightBound() const { return maxHeight; }
+    float scaleBound() const { return maxScale; }
+
+    // Newton steps per solve: from Danby's starting guess these reach float precision for the eccentricity
+    int newtonIterations() const
+    {
+        return maxEccentricity <= 0.1f ? 3 : maxEccentricity <= 0.5f ? 4 : 6;
+    }
+
+    static bool avx2Supported()
+    {
+#if ORBIT_ENGINE_AVX2 && defined(__GNUC__)
+        return __builtin_cpu_supports("avx2");
+#elif ORBIT_ENGINE_AVX2
+        // AVX2 in the CPU and the YMM registers saved by the OS
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    // picks the kernel; AVX2 is only used where the CPU supports it
+    void setUseAvx2(bool enabled) { useAvx2 = enabled && avx2Supported(); }
+    bool usingAvx2() const { return useAvx2; }
+
+    // most threads a propagation is split across; 0 (the default) uses every thread of the JobSystem
+    void setActiveThreads(unsigned int count) { activeThreads = count; }
+
+    // Writes the model matrices of the first count bodies at the given time to out (from the JobSystem's
+    // threads, so out must not be read while this runs). For every probe point the distance to the nearest body's
+    // position is stored in nearest, FLT_MAX when count is 0.
+    void propagate(float time, size_t count, glm::mat4* out, const glm::vec3* probes = nullptr, float* nearest = nullptr, size_t probeCount = 0)
+    {
+        Job next;
+        next.time = time;
+        next.count = std::min(count, size());
+        next.out = out;
+        next.probes = probes;
+        next.probeCount = std::min(probeCount, MAX_PROBES);
+        next.iterations = newtonIterations();
+
+        // slices of whole 8 body batches, one per thread, and no more slices than are worth it
+        unsigned int threads = activeThreads > 0 ? activeThreads : JobSystem::instance().threadCount();
+        size_t slices = std::min<size_t>(std::min(threads, MAX_SLICES), std::max<size_t>(1, next.count / MIN_BODIES_PER_THREAD));
+        size_t batches = (next.count + 7) / 8;
+        next.batchesPerSlice = (batches + slices - 1) / slices;
+        next.slices = slices;
+        for (size_t slice = 0; slice < slices; slice++)
+            std::fill(sliceNearest[slice], sliceNearest[slice] + MAX_PROBES, FLT_MAX);
+
+        job = next;
+        JobSystem::instance().parallelFor(slices, 1, [this](size_t begin, size_t end) {
+            for (size_t slice = begin; slice < end; slice++)
+                runSlice(slice);
+        });
+
+        for (size_t probe = 0; probe < next.probeCount; probe++)
+        {
+            float nearestSquared = FLT_MAX;
+            for (size_t slice = 0; slice < slices; slice++)
+                nearestSquared = std::min(nearestSquared, sliceNearest[slice][probe]);
+            nearest[probe] = nearestSquared == FLT_MAX ? FLT_MAX : std::sqrt(nearestSquared);
+        }
+    }
+
+    // sine and cosine as both kernels compute them: reduced to a quarter turn around the nearest multiple
+    // of pi/2 (Cody-Waite, three parts) and evaluated with Cephes' minimax polynomials
+    static void sinCos(float x, float& sine, float& cosine)
+    {
+        float quadrant = std::nearbyint(x * TWO_OVER_PI);
+        float r = x - quadrant * PI_OVER_TWO_1 - quadrant * PI_OVER_TWO_2 - quadrant * PI_OVER_TWO_3;
+        int32_t q = int32_t(quadrant);
+        float r2 = r * r;
+        float s = r + r * r2 * (SIN_1 + r2 * (SIN_2 + r2 * SIN_3));
+        float c = 1.0f - 0.5f * r2 + r2 * r2 * (COS_1 + r2 * (COS_2 + r2 * COS_3));
+        bool swap = (q & 1) != 0;
+        sine = swap ? c : s;
+        cosine = swap ? s : c;
+        if (q & 2)
+            sine = -sine;
+        if ((q + 1) & 2)
+            cosine = -cosine;
+    }
+
+private:
+    static constexpr float TWO_OVER_PI = 0.636619772367581343f;
+    static constexpr float PI_OVER_TWO_1 = 1.5703125f;
+    static constexpr float PI_OVER_TWO_2 = 4.837512969970703125e-4f;
+    static constexpr float PI_OVER_TWO_3 = 7.54978995489188216e-8f;
+    static constexpr float SIN_1 = -1.6666654611e-1f;
+    static constexpr float SIN_2 = 8.3321608736e-3f;
+    static constexpr float SIN_3 = -1.9515295891e-4f;
+    static constexpr float COS_1 = 4.166664568298827e-2f;
+    static constexpr float COS_2 = -1.388731625493765e-3f;
+    static constexpr float COS_3 = 2.443315711809948e-5f;
+    static constexpr float DANBY = 0.85f;
+
+    // one structure of arrays column per element
+    std::vector<float> meanAnomaly, meanMotion, eccentricity;
+    std::vector<float> px, py, pz, qx, qy, qz, cx, cy, cz;
+    std::vector<float> scale, spinSpeed, spinPhase;
+    float maxEccentricity = 0.0f;
+    float maxApoapsis = 0.0f;
+    float maxHeight = 0.0f;
+    float maxScale = 0.0f;
+    bool useAvx2 = false;
+
+    std::vector<std::vector<float>*> columns()
+    {
+        return { &meanAnomaly, &meanMotion, &eccentricity, &px, &py, &pz, &qx, &qy, &qz, &cx, &cy, &cz, &scale, &spinSpeed, &spinPhase };
+    }
+
+    // the propagation being run, shared with the workers
+    struct Job {
+        float time = 0.0f;
+        size_t count = 0;
+        glm::mat4* out = nullptr;
+        const glm::vec3* probes = nullptr;
+        size_t probeCount = 0;
+        int iterations = 0;
+        size_t slices = 1;
+        size_t batchesPerSlice = 0;
+    };
+    Job job;
+    // squared distance to the nearest body, per slice and probe
+    float sliceNearest[MAX_SLICES][MAX_PROBES];
+
+    unsigned int activeThreads = 0;
+
+    void runSlice(size_t slice)
+    {
+        size_t begin = std::min(job.count, slice * job.batchesPerSlice * 8);
+        size_t end = std::min(job.count, begin + job.batchesPerSlice * 8);
+        float* nearestSquared = sliceNearest[slice];
+#if ORBIT_ENGINE_AVX2
+        if (useAvx2)
+            begin = propagateAvx2(begin, end, nearestSquared);
+#endif
+        propagateScalar(begin, end, nearestSquared);
+    }
+
+    // mean anomaly (or any angle) at a time, wrapped into [-pi, pi] so the float keeps its precision
+    static float wrapAngle(float angle)
+    {
+        return angle - glm::two_pi<float>() * std::nearbyint(angle * glm::one_over_two_pi<float>());
+    }
+
+    void propagateScalar(size_t begin, size_t end, float* nearestSquared) const
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            float e = eccentricity[i];
+            float m = wrapAngle(meanAnomaly[i] + meanMotion[i] * job.time);
+            float anomaly = m + std::copysign(DANBY * e, m);
+            float sine, cosine;
+            for (int step = 0; step < job.iterations; step++)
+            {
+                sinCos(anomaly, sine, cosine);
+                anomaly -= (anomaly - e * sine - m) / (1.0f - e * cosine);
+            }
+            sinCos(anomaly, sine, cosine);
+            glm::vec3 position(cosine * px[i] + sine * qx[i] + cx[i],
+                cosine * py[i] + sine * qy[i] + cy[i],
+                cosine * pz[i] + sine * qz[i] + cz[i]);
+
+            float spinSine, spinCosine;
+            sinCos(wrapAngle(spinPhase[i] + spinSpeed[i] * job.time), spinSine, spinCosine);
+            float s = scale[i];
+            job.out[i] = glm::mat4(glm::vec4(spinCosine * s, 0.0f, -spinSine * s, 0.0f), glm::vec4(0.0f, s, 0.0f, 0.0f),
+                glm::vec4(spinSine * s, 0.0f, spinCosine * s, 0.0f), glm::vec4(position, 1.0f));
+
+            for (size_t probe = 0; probe < job.probeCount; probe++)
+            {
+                glm::vec3 offset = position - job.probes[probe];
+                nearestSquared[probe] = std::min(nearestSquared[probe], glm::dot(offset, offset));
+            }
+        }
+    }
+
+#if ORBIT_ENGINE_AVX2
+    ORBIT_ENGINE_AVX2_TARGET static void sinCos8(__m256 x, __m256& sine, __m256& cosine)
+    {
+        __m256 quadrant = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(quadrant, _mm256_set1_ps(PI_OVER_TWO_1)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(quadrant, _mm256_set1_ps(PI_OVER_TWO_2)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(quadrant, _mm256_set1_ps(PI_OVER_TWO_3)));
+        __m256i q = _mm256_cvtps_epi32(quadrant);
+        __m256 r2 = _mm256_mul_ps(r, r);
+
+        __m256 s = _mm256_add_ps(_mm256_set1_ps(SIN_2), _mm256_mul_ps(r2, _mm256_set1_ps(SIN_3)));
+        s = _mm256_add_ps(_mm256_set1_ps(SIN_1), _mm256_mul_ps(r2, s));
+        s = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), s));
+        __m256 c = _mm256_add_ps(_mm256_set1_ps(COS_2), _mm256_mul_ps(r2, _mm256_set1_ps(COS_3)));
+        c = _mm256_add_ps(_mm256_set1_ps(COS_1), _mm256_mul_ps(r2, c));
+        c = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)), _mm256_mul_ps(_mm256_mul_ps(r2, r2), c));
+
+        // odd quadrants swap sine and cosine; bit 1 of q (and of q + 1) is the sign, moved to the sign bit
+        __m256i one = _mm256_set1_epi32(1);
+        __m256i two = _mm256_set1_epi32(2);
+        __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+        __m256 sineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, two), 30));
+        __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, one), two), 30));
+        sine = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sineSign);
+        cosine = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cosineSign);
+    }
+
+    ORBIT_ENGINE_AVX2_TARGET static __m256 wrapAngle8(__m256 angle)
+    {
+        __m256 turns = _mm256_round_ps(_mm256_mul_ps(angle, _mm256_set1_ps(glm::one_over_two_pi<float>())), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        return _mm256_sub_ps(angle, _mm256_mul_ps(turns, _mm256_set1_ps(glm::two_pi<float>())));
+    }
+
+    // whole batches of 8 from begin; returns where the scalar kernel takes over
+    ORBIT_ENGINE_AVX2_TARGET size_t propagateAvx2(size_t begin, size_t end, float* nearestSquared) const
+    {
+        const __m256 time = _mm256_set1_ps(job.time);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 signBit = _mm256_set1_ps(-0.0f);
+        __m256 probeX[MAX_PROBES], probeY[MAX_PROBES], probeZ[MAX_PROBES], probeNearest[MAX_PROBES];
+        for (size_t probe = 0; probe < job.probeCount; probe++)
+        {
+            probeX[probe] = _mm256_set1_ps(job.probes[probe].x);
+            probeY[probe] = _mm256_set1_ps(job.probes[probe].y);
+            probeZ[probe] = _mm256_set1_ps(job.probes[probe].z);
+            probeNearest[probe] = _mm256_set1_ps(FLT_MAX);
+        }
+
+        alignas(32) float lanes[6][8];
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 e = _mm256_loadu_ps(&eccentricity[i]);
+            __m256 m = wrapAngle8(_mm256_add_ps(_mm256_loadu_ps(&meanAnomaly[i]), _mm256_mul_ps(_mm256_loadu_ps(&meanMotion[i]), time)));
+            __m256 start = _mm256_or_ps(_mm256_mul_ps(_mm256_set1_ps(DANBY), e), _mm256_and_ps(m, signBit));
+            __m256 anomaly = _mm256_add_ps(m, start);
+            __m256 sine, cosine;
+            for (int step = 0; step < job.iterations; step++)
+            {
+                sinCos8(anomaly, sine, cosine);
+                __m256 f = _mm256_sub_ps(_mm256_sub_ps(anomaly, _mm256_mul_ps(e, sine)), m);
+                __m256 slope = _mm256_sub_ps(one, _mm256_mul_ps(e, cosine));
+                anomaly = _mm256_sub_ps(anomaly, _mm256_div_ps(f, slope));
+            }
+            sinCos8(anomaly, sine, cosine);
+
+            __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cosine, _mm256_loadu_ps(&px[i])), _mm256_mul_ps(sine, _mm256_loadu_ps(&qx[i]))), _mm256_loadu_ps(&cx[i]));
+            __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cosine, _mm256_loadu_ps(&py[i])), _mm256_mul_ps(sine, _mm256_loadu_ps(&qy[i]))), _mm256_loadu_ps(&cy[i]));
+            __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cosine, _mm256_loadu_ps(&pz[i])), _mm256_mul_ps(sine, _mm256_loadu_ps(&qz[i]))), _mm256_loadu_ps(&cz[i]));
+
+            __m256 spinSine, spinCosine;
+            sinCos8(wrapAngle8(_mm256_add_ps(_mm256_loadu_ps(&spinPhase[i]), _mm256_mul_ps(_mm256_loadu_ps(&spinSpeed[i]), time))), spinSine, spinCosine);
+            __m256 s = _mm256_loadu_ps(&scale[i]);
+
+            for (size_t probe = 0; probe < job.probeCount; probe++)
+            {
+                __m256 dx = _mm256_sub_ps(x, probeX[probe]);
+                __m256 dy = _mm256_sub_ps(y, probeY[probe]);
+                __m256 dz = _mm256_sub_ps(z, probeZ[probe]);
+                __m256 squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+                probeNearest[probe] = _mm256_min_ps(probeNearest[probe], squared);
+            }
+
+            // the matrices are array of structures: transpose through the stack, one column store at a time
+            _mm256_store_ps(lanes[0], _mm256_mul_ps(spinCosine, s));
+            _mm256_store_ps(lanes[1], _mm256_mul_ps(spinSine, s));
+            _mm256_store_ps(lanes[2], s);
+            _mm256_store_ps(lanes[3], x);
+            _mm256_store_ps(lanes[4], y);
+            _mm256_store_ps(lanes[5], z);
+            float* matrix = &job.out[i][0][0];
+            for (int lane = 0; lane < 8; lane++, matrix += 16)
+            {
+                _mm_storeu_ps(matrix, _mm_setr_ps(lanes[0][lane], 0.0f, -lanes[1][lane], 0.0f));
+                _mm_storeu_ps(matrix + 4, _mm_setr_ps(0.0f, lanes[2][lane], 0.0f, 0.0f));
+                _mm_storeu_ps(matrix + 8, _mm_setr_ps(lanes[1][lane], 0.0f, lanes[0][lane], 0.0f));
+                _mm_storeu_ps(matrix + 12, _mm_setr_ps(lanes[3][lane], lanes[4][lane], lanes[5][lane], 1.0f));
+            }
+        }
+
+        for (size_t probe = 0; probe < job.probeCount; probe++)
+        {
+            alignas(32) float squared[8];
+            _mm256_store_ps(squared, probeNearest[probe]);
+            nearestSquared[probe] = std::min(nearestSquared[probe], *std::min_element(squared, squared + 8));
+        }
+        return i;
+    }
+#endif
+};
+#endif
@@ -0,0 +1,555 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Frame profiler.
+// Scopes nest and are named; every scope is timed on the CPU, and scopes opened with gpu = true are also timed
+// on the GPU with GL_TIME_ELAPSED queries. Those queries cannot nest, so a GPU scope that opens inside another
+// one ends its parent's query and starts its own, and the parent starts a new one when the child closes; a
+// scope's GPU time is the span of its queries laid end to end, its children's included. The queries of a frame
+// are read back two frames later, when their slot comes around again (the queries are double buffered), so
+// reading them never waits for the GPU unless it is more than a frame behind.
+// Every scope keeps the per frame times of the last HISTORY_FRAMES (or setHistoryLength) frames for average, median and 99th
+// percentile statistics, which can be drawn as an overlay, printed, or written as CSV. The frames themselves
+// can be recorded and written as a Chrome trace (chrome://tracing or ui.perfetto.dev).
+class Profiler
+{
+public:
+    static const size_t HISTORY_FRAMES = 300;   // default frames of the rolling statistics
+    static const size_t MAX_TRACE_FRAMES = 2000;    // most recent frames kept for the trace
+    static constexpr float OVERLAY_PIXELS_PER_MS = 24.0f;
+
+    struct Summary {
+        double average = 0.0;
+        double p50 = 0.0;
+        double p99 = 0.0;
+    };
+
+    // the statistics of one scope
+    struct ScopeStats {
+        std::string path;   // scope names from the frame down, separated by '/'
+        size_t frames;      // frames in the statistics
+        bool timesGpu;
+        Summary cpu, gpu;
+    };
+
+    static Profiler& instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // switches profiling on or off from the next frame on, so no scope straddles the switch
+    void setEnabled(bool enabled)
+    {
+        requested = enabled;
+    }
+
+    bool enabled() const
+    {
+        return requested;
+    }
+
+    // frames the rolling statistics cover; restarts them
+    void setHistoryLength(size_t frames)
+    {
+        historyLength = std::max<size_t>(frames, 1);
+        resetStatistics();
+    }
+
+    // forgets the statistics so far, the frames still in flight included; they restart with the next frame
+    void resetStatistics()
+    {
+        for (Path& path : paths)
+            path.cpu = path.gpu = History();
+        statisticsStart = frameNumber + 1;
+    }
+
+    // keeps every profiled frame (up to MAX_TRACE_FRAMES) for writeTrace
+    void setTraceCapture(bool capture)
+    {
+        captureTrace = capture;
+    }
+
+    // closes the current frame and starts the next one. Reads back the queries of the frame that used the
+    // slot the new frame is going to use.
+    void beginFrame()
+    {
+        Clock::time_point now = Clock::now();
+        Frame& finished = frames[frameNumber % 2];
+        if (finished.profiled)
+        {
+            closeOpenScopes();
+            finished.cpuMs = millisecondsBetween(finished.start, now);
+        }
+
+        frameNumber++;
+        Frame& frame = frames[frameNumber % 2];
+        if (frame.profiled)
+            resolve(frame);
+        frame = Frame();
+        frame.profiled = requested;
+        frame.number = frameNumber;
+        frame.start = now;
+        if (frameNumber == 1)
+            epoch = now;
+    }
+
+    // opens a scope inside the current one
+    void beginScope(const std::string& name, bool gpu = false)
+    {
+        Frame& frame = current();
+        if (!frame.profiled)
+            return;
+        Sample sample;
+        sample.path = childPath(stack.empty() ? ROOT_PATH : frame.samples[stack.back()].path, name, gpu);
+        sample.cpuStart = millisecondsBetween(frame.start, Clock::now());
+        sample.gpu = gpu;
+        uint32_t index = uint32_t(frame.samples.size());
+        frame.samples.push_back(sample);
+        if (gpu)
+            frame.samples[index].firstSegment = beginSegment(frame);
+        stack.push_back(index);
+    }
+
+    // closes the innermost open scope
+    void endScope()
+    {
+        Frame& frame = current();
+        if (!frame.profiled || stack.empty())
+            return;
+        uint32_t index = stack.back();
+        stack.pop_back();
+        Sample& sample = frame.samples[index];
+        sample.cpuEnd = millisecondsBetween(frame.start, Clock::now());
+        if (!sample.gpu)
+            return;
+
+        glEndQuery(GL_TIME_ELAPSED);
+        sample.lastSegment = openSegment;
+        openSegment = NONE;
+        // the nearest enclosing GPU scope goes on timing
+        for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+        {
+            if (frame.samples[*it].gpu)
+            {
+                beginSegment(frame);
+                break;
+            }
+        }
+    }
+
+    // statistics of every scope over the last frames it ran in, in ms per frame, the whole frame first
+    std::vector<ScopeStats> scopeStats() const
+    {
+        std::vector<ScopeStats> stats;
+        for (const Path& path : paths)
+            stats.push_back({ path.path, path.cpu.count, path.timesGpu, summarize(path.cpu), summarize(path.gpu) });
+        return stats;
+    }
+
+    // one line of average frame, CPU and GPU times for the window title, top level scopes as cpu/gpu
+    std::string summaryText() const
+    {
+        std::ostringstream text;
+        text.setf(std::ios::fixed);
+        text.precision(2);
+        const Path& root = paths[ROOT_PATH];
+        text << "frame " << average(root.cpu) << " ms, GPU " << average(root.gpu) << " ms";
+        for (uint32_t child : root.children)
+        {
+            const Path& path = paths[child];
+            text << " | " << path.name << " " << average(path.cpu);
+            if (path.timesGpu)
+                text << "/" << average(path.gpu);
+        }
+        return text.str();
+    }
+
+    // draws the average times as bars in the bottom left corner: the frame, then every top level scope, each
+    // with its CPU time over its GPU time. The grey ticks are 1 ms apart, the red one is at 16.7 ms.
+    // Drawn with scissored clears, so it needs no shader and leaves no state behind but the clear color,
+    // which it restores.
+    void drawOverlay(int viewportWidth) const
+    {
+        const int MARGIN = 8, BAR_HEIGHT = 5, ROW_HEIGHT = 2 * BAR_HEIGHT + 4;
+        static const float palette[][3] = {
+            { 0.90f, 0.90f, 0.90f }, { 0.95f, 0.60f, 0.20f }, { 0.30f, 0.70f, 0.95f }, { 0.40f, 0.85f, 0.40f },
+            { 0.90f, 0.40f, 0.70f }, { 0.95f, 0.90f, 0.30f }, { 0.60f, 0.50f, 0.95f }, { 0.40f, 0.90f, 0.85f }
+        };
+
+        std::vector<uint32_t> rows = { ROOT_PATH };
+        rows.insert(rows.end(), paths[ROOT_PATH].children.begin(), paths[ROOT_PATH].children.end());
+        int panelWidth = std::min(viewportWidth - 2 * MARGIN, int(34.0f * OVERLAY_PIXELS_PER_MS));
+        int panelHeight = int(rows.size()) * ROW_HEIGHT + 4;
+
+        GLfloat clearColor[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+        glEnable(GL_SCISSOR_TEST);
+        fill(MARGIN - 2, MARGIN - 2, panelWidth + 4, panelHeight, 0.05f, 0.05f, 0.05f);
+        for (int ms = 1; ms * OVERLAY_PIXELS_PER_MS < panelWidth; ms++)
+            fill(MARGIN + int(ms * OVERLAY_PIXELS_PER_MS), MARGIN - 2, 1, panelHeight, 0.25f, 0.25f, 0.25f);
+        fill(MARGIN + int(16.7f * OVERLAY_PIXELS_PER_MS), MARGIN - 2, 1, panelHeight, 0.8f, 0.1f, 0.1f);
+
+        for (size_t row = 0; row < rows.size(); row++)
+        {
+            const Path& path = paths[rows[row]];
+            const float* color = palette[row % (sizeof(palette) / sizeof(palette[0]))];
+            int y = MARGIN + int(rows.size() - 1 - row) * ROW_HEIGHT;
+            int cpuWidth = std::min(panelWidth, int(average(path.cpu) * OVERLAY_PIXELS_PER_MS + 0.5));
+            int gpuWidth = std::min(panelWidth, int(average(path.gpu) * OVERLAY_PIXELS_PER_MS + 0.5));
+            fill(MARGIN, y + BAR_HEIGHT + 1, cpuWidth, BAR_HEIGHT, color[0], color[1], color[2]);
+            fill(MARGIN, y, gpuWidth, BAR_HEIGHT, color[0] * 0.6f, color[1] * 0.6f, color[2] * 0.6f);
+        }
+        glDisable(GL_SCISSOR_TEST);
+        glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    }
+
+    void printStats() const
+    {
+        if (paths[ROOT_PATH].cpu.count == 0)
+            return;
+        std::cout << "Profile, ms per frame over the last " << paths[ROOT_PATH].cpu.count << " frames (avg / p50 / p99):" << std::endl;
+        for (uint32_t id = 0; id < paths.size(); id++)
+        {
+            const Path& path = paths[id];
+            Summary cpu = summarize(path.cpu);
+            std::cout << "  " << std::string(2 * path.depth, ' ') << path.name << ": CPU " << cpu.average << " / " << cpu.p50 << " / " << cpu.p99;
+            if (path.timesGpu)
+            {
+                Summary gpu = summarize(path.gpu);
+                std::cout << ", GPU " << gpu.average << " / " << gpu.p50 << " / " << gpu.p99;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    // writes the rolling statistics of every scope, one row per scope
+    bool writeCsv(const std::string& filePath) const
+    {
+        std::ofstream out(filePath);
+        if (!out)
+            return false;
+        out.setf(std::ios::fixed);
+        out.precision(4);
+        out << "scope,frames,cpu avg ms,cpu p50 ms,cpu p99 ms,gpu avg ms,gpu p50 ms,gpu p99 ms\n";
+        for (const ScopeStats& scope : scopeStats())
+        {
+            out << scope.path << "," << scope.frames << "," << scope.cpu.average << "," << scope.cpu.p50 << "," << scope.cpu.p99;
+            if (scope.timesGpu)
+                out << "," << scope.gpu.average << "," << scope.gpu.p50 << "," << scope.gpu.p99 << "\n";
+            else
+                out << ",,,\n";
+        }
+        return bool(out);
+    }
+
+    // writes the recorded frames in the Chrome trace event format: the CPU scopes on one track, the GPU
+    // scopes on another. The GPU track has no clock of its own; every frame's GPU scopes start at the
+    // frame's CPU start and follow each other without the idle gaps between them.
+    bool writeTrace(const std::string& filePath) const
+    {
+        std::ofstream out(filePath);
+        if (!out)
+            return false;
+        out.setf(std::ios::fixed);
+        out.precision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+        for (const Frame& frame : trace)
+        {
+            double frameStart = millisecondsBetween(epoch, frame.start);
+            writeEvent(out, "Frame " + std::to_string(frame.number), 1, frameStart, frame.cpuMs);
+            for (const Sample& sample : frame.samples)
+            {
+                writeEvent(out, paths[sample.path].name, 1, frameStart + sample.cpuStart, sample.cpuEnd - sample.cpuStart);
+                if (sample.gpu)
+                    writeEvent(out, paths[sample.path].name, 2, frameStart + sample.gpuStart, sample.gpuMs);
+            }
+        }
+        out << "\n]}\n";
+        return bool(out);
+    }
+
+    // reads back the frames still in flight and deletes the queries. Call while the GL context is current.
+    void shutdown()
+    {
+        Frame& last = frames[frameNumber % 2];
+        if (last.profiled)
+        {
+            closeOpenScopes();
+            last.cpuMs = millisecondsBetween(last.start, Clock::now());
+        }
+        for (uint64_t number : { frameNumber + 1, frameNumber })
+        {
+            Frame& frame = frames[number % 2];
+            if (frame.profiled)
+                resolve(frame);
+            frame = Frame();
+        }
+        if (!freeQueries.empty())
+            glDeleteQueries(GLsizei(freeQueries.size()), freeQueries.data());
+        freeQueries.clear();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static const uint32_t ROOT_PATH = 0;
+    static const uint32_t NONE = 0xFFFFFFFFu;
+
+    // the per frame times of a scope over the last frames it ran in
+    struct History {
+        std::vector<float> times;
+        size_t next = 0;
+        size_t count = 0;
+        double sum = 0.0;
+
+        void add(double ms, size_t length)
+        {
+            if (times.size() < length)
+                times.push_back(float(ms));
+            else
+            {
+                sum -= times[next];
+                times[next] = float(ms);
+            }
+            sum += float(ms);
+            next = (next + 1) % length;
+            count = times.size();
+        }
+    };
+
+    // a scope name under its parent scope; scopes of the same path are summed per frame
+    struct Path {
+        std::string name;
+        std::string path;   // names from the root down, separated by '/'
+        uint32_t depth = 0;
+        bool timesGpu = false;
+        std::vector<uint32_t> children;
+        History cpu, gpu;
+    };
+
+    struct Sample {
+        uint32_t path = ROOT_PATH;
+        bool gpu = false;
+        double cpuStart = 0.0, cpuEnd = 0.0;    // ms since the frame started
+        uint32_t firstSegment = NONE, lastSegment = NONE;
+        double gpuStart = 0.0, gpuMs = 0.0;     // filled in when the frame is resolved
+    };
+
+    // one GL_TIME_ELAPSED query, timing part of a GPU scope
+    struct Segment {
+        GLuint query;
+        double start = 0.0, ms = 0.0;
+    };
+
+    struct Frame {
+        bool profiled = false;
+        uint64_t number = 0;
+        Clock::time_point start;
+        double cpuMs = 0.0;
+        std::vector<Sample> samples;
+        std::vector<Segment> segments;
+    };
+
+    bool requested = false;
+    bool captureTrace = false;
+    uint64_t frameNumber = 0;
+    uint64_t statisticsStart = 0;   // first frame in the statistics
+    size_t historyLength = HISTORY_FRAMES;
+    Clock::time_point epoch;
+    Frame frames[2];                // the frame being recorded and the one before it, its queries in flight
+    std::vector<uint32_t> stack;    // open scopes of the current frame, as sample indices
+    uint32_t openSegment = NONE;    // the query running right now
+    std::vector<GLuint> freeQueries;
+    std::vector<Path> paths = std::vector<Path>(1, rootPath());
+    std::deque<Frame> trace;
+
+    Profiler() = default;
+
+    static Path rootPath()
+    {
+        Path root;
+        root.name = root.path = "Frame";
+        root.timesGpu = true;
+        return root;
+    }
+
+    static double millisecondsBetween(Clock::time_point from, Clock::time_point to)
+    {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    Frame& current()
+    {
+        return frames[frameNumber % 2];
+    }
+
+    uint32_t childPath(uint32_t parent, const std::string& name, bool gpu)
+    {
+        for (uint32_t child : paths[parent].children)
+        {
+            if (paths[child].name == name)
+            {
+                paths[child].timesGpu = paths[child].timesGpu || gpu;
+                return child;
+            }
+        }
+        Path path;
+        path.name = name;
+        path.path = paths[parent].path + "/" + name;
+        path.depth = paths[parent].depth + 1;
+        path.timesGpu = gpu;
+        uint32_t id = uint32_t(paths.size());
+        paths.push_back(path);
+        paths[parent].children.push_back(id);
+        return id;
+    }
+
+    // ends the running query and starts the next one
+    uint32_t beginSegment(Frame& frame)
+    {
+        if (openSegment != NONE)
+            glEndQuery(GL_TIME_ELAPSED);
+        Segment segment;
+        if (freeQueries.empty())
+            glGenQueries(1, &segment.query);
+        else
+        {
+            segment.query = freeQueries.back();
+            freeQueries.pop_back();
+        }
+        glBeginQuery(GL_TIME_ELAPSED, segment.query);
+        openSegment = uint32_t(frame.segments.size());
+        frame.segments.push_back(segment);
+        return openSegment;
+    }
+
+    // closes the scopes the current frame left open
+    void closeOpenScopes()
+    {
+        while (!stack.empty())
+            endScope();
+    }
+
+    // reads the frame's queries, lays its GPU scopes out and adds the frame to the statistics and the trace
+    void resolve(Frame& frame)
+    {
+        double gpuTime = 0.0;
+        for (Segment& segment : frame.segments)
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(segment.query, GL_QUERY_RESULT, &nanoseconds);
+            segment.start = gpuTime;
+            segment.ms = double(nanoseconds) / 1e6;
+            gpuTime += segment.ms;
+            freeQueries.push_back(segment.query);
+        }
+
+        std::vector<double> cpuTimes(paths.size(), 0.0), gpuTimes(paths.size(), 0.0);
+        std::vector<bool> ran(paths.size(), false);
+        for (Sample& sample : frame.samples)
+        {
+            if (sample.gpu && sample.lastSegment != NONE)
+            {
+                const Segment& last = frame.segments[sample.lastSegment];
+                sample.gpuStart = frame.segments[sample.firstSegment].start;
+                sample.gpuMs = last.start + last.ms - sample.gpuStart;
+            }
+            ran[sample.path] = true;
+            cpuTimes[sample.path] += sample.cpuEnd - sample.cpuStart;
+            gpuTimes[sample.path] += sample.gpuMs;
+        }
+        if (frame.number >= statisticsStart)
+        {
+            paths[ROOT_PATH].cpu.add(frame.cpuMs, historyLength);
+            paths[ROOT_PATH].gpu.add(gpuTime, historyLength);
+            for (uint32_t id = 1; id < ran.size(); id++)
+            {
+                if (!ran[id])
+                    continue;
+                paths[id].cpu.add(cpuTimes[id], historyLength);
+                if (paths[id].timesGpu)
+                    paths[id].gpu.add(gpuTimes[id], historyLength);
+            }
+        }
+
+        if (captureTrace)
+        {
+            frame.segments.clear();
+            trace.push_back(std::move(frame));
+            if (trace.size() > MAX_TRACE_FRAMES)
+                trace.pop_front();
+        }
+    }
+
+    static double average(const History& history)
+    {
+        return history.count > 0 ? history.sum / history.count : 0.0;
+    }
+
+    static Summary summarize(const History& history)
+    {
+        Summary summary;
+        if (history.count == 0)
+            return summary;
+        std::vector<float> sorted(history.times);
+        std::sort(sorted.begin(), sorted.end());
+        summary.average = average(history);
+        summary.p50 = sorted[(sorted.size() - 1) / 2];
+        summary.p99 = sorted[std::min(sorted.size() - 1, size_t(sorted.size() * 0.99))];
+        return summary;
+    }
+
+    static void fill(int x, int y, int width, int height, float r, float g, float b)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        glScissor(x, y, width, height);
+        glClearColor(r, g, b, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    static void writeEvent(std::ostream& out, const std::string& name, int track, double startMs, double durationMs)
+    {
+        std::string escaped;
+        for (char c : name)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        out << ",\n{\"name\":\"" << escaped << "\",\"cat\":\"" << (track == 1 ? "cpu" : "gpu") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track
+            << ",\"ts\":" << startMs * 1000.0 << ",\"dur\":" << durationMs * 1000.0 << "}";
+    }
+};
+
+// Profiles the enclosing block as one scope.
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const std::string& name, bool gpu = false)
+    {
+        Profiler::instance().beginScope(name, gpu);
+    }
+    ~ProfileScope()
+    {
+        Profiler::instance().endScope();
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+#endif
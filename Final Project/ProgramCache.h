@@ -0,0 +1,230 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "GLCapabilities.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// program binaries are core in 4.1 (ARB_get_program_binary); defined here for 3.3 headers
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// Linked program cache (ShaderCache/<key>.progbin).
+// Holds the driver's binary of every linked program, read back with glProgramBinary so later launches skip
+// compiling and linking. The key hashes the stage sources together with GL_VENDOR, GL_RENDERER and
+// GL_VERSION, so editing a shader or changing GPU or driver picks a different file; a binary the driver
+// still rejects (glProgramBinary fails to link) is recompiled from source and replaced.
+//
+// File layout (little endian):
+//   ProgramCacheHeader
+//   char binary[binaryLength]
+namespace ProgramCache
+{
+    // bump whenever the layout above or the key changes
+    const uint32_t VERSION = 1;
+    const char MAGIC[4] = { 'G', 'P', 'R', 'G' };
+
+    struct ProgramCacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t binaryFormat;      // as returned by glGetProgramBinary
+        uint32_t binaryLength;
+    };
+
+    struct Stats {
+        uint64_t hits = 0;          // programs loaded from a binary
+        uint64_t misses = 0;        // programs compiled from source
+        uint64_t rejected = 0;      // of the misses, binaries the driver refused
+    };
+
+    typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+    typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+    struct EntryPoints {
+        GetProgramBinaryProc getProgramBinary = nullptr;
+        ProgramBinaryProc programBinary = nullptr;
+        ProgramParameteriProc programParameteri = nullptr;
+        bool supported = false;
+    };
+
+    // the binary functions of the current context; read on the first call, so only call this once it is current
+    inline const EntryPoints& entryPoints()
+    {
+        static const EntryPoints entries = []() {
+            EntryPoints loaded;
+            loaded.getProgramBinary = GLCapabilities::loadFunction<GetProgramBinaryProc>("glGetProgramBinary");
+            loaded.programBinary = GLCapabilities::loadFunction<ProgramBinaryProc>("glProgramBinary");
+            loaded.programParameteri = GLCapabilities::loadFunction<ProgramParameteriProc>("glProgramParameteri");
+            GLint formats = 0;
+            if (loaded.getProgramBinary != nullptr && loaded.programBinary != nullptr && loaded.programParameteri != nullptr)
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            loaded.supported = formats > 0;
+            return loaded;
+        }();
+        return entries;
+    }
+
+    // turned off by --no-program-cache, or to time compiles in --benchmark-shaders
+    inline bool& enabled()
+    {
+        static bool on = true;
+        return on;
+    }
+
+    inline Stats& stats()
+    {
+        static Stats counters;
+        return counters;
+    }
+
+    // folder of the cache files, relative to the working directory like the shader sources
+    inline std::string& directory()
+    {
+        static std::string folder = "ShaderCache";
+        return folder;
+    }
+
+    // true if programs are read from and written to the cache
+    inline bool active()
+    {
+        return enabled() && entryPoints().supported;
+    }
+
+    // FNV-1a over the driver strings and the type and source of every stage
+    inline uint64_t key(const GLenum* stageTypes, const std::string* sources, size_t stageCount)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* bytes, size_t size) {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= static_cast<const unsigned char*>(bytes)[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        mix(&VERSION, sizeof(VERSION));
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const GLubyte* text = glGetString(name);
+            if (text != nullptr)
+                mix(text, std::strlen(reinterpret_cast<const char*>(text)) + 1);
+        }
+        for (size_t i = 0; i < stageCount; i++)
+        {
+            uint32_t type = stageTypes[i];
+            uint64_t length = sources[i].size();
+            mix(&type, sizeof(type));
+            mix(&length, sizeof(length));
+            mix(sources[i].data(), sources[i].size());
+        }
+        return hash;
+    }
+
+    inline std::string pathFor(uint64_t key)
+    {
+        std::ostringstream name;
+        name << directory() << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".progbin";
+        return name.str();
+    }
+
+    // asks the driver to keep the binary of a program that is about to be linked, so store() can read it
+    inline void prepare(GLuint program)
+    {
+        if (active())
+            entryPoints().programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // loads the cached binary into program. Returns false if there is none or the driver rejects it,
+    // in which case the program must be compiled from source.
+    inline bool load(GLuint program, uint64_t key)
+    {
+        if (!active())
+            return false;
+        std::ifstream in(pathFor(key), std::ios::binary);
+        ProgramCacheHeader header;
+        if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION || header.key != key)
+        {
+            stats().misses++;
+            return false;
+        }
+        std::vector<char> binary(header.binaryLength);
+        if (!in.read(binary.data(), static_cast<std::streamsize>(binary.size())))
+        {
+            stats().misses++;
+            return false;
+        }
+
+        entryPoints().programBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint linkStatus = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+        if (linkStatus != GL_TRUE)
+        {
+            stats().misses++;
+            stats().rejected++;
+            return false;
+        }
+        stats().hits++;
+        return true;
+    }
+
+    // writes the binary of a linked program. Returns false if the driver has none or the file could not be written.
+    inline bool store(GLuint program, uint64_t key)
+    {
+        if (!active())
+            return false;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return false;
+        std::vector<char> binary(static_cast<size_t>(length));
+        GLenum format = 0;
+        GLsizei written = 0;
+        entryPoints().getProgramBinary(program, length, &written, &format, binary.data());
+        if (written <= 0)
+            return false;
+
+        ProgramCacheHeader header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.key = key;
+        header.binaryFormat = format;
+        header.binaryLength = static_cast<uint32_t>(written);
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory(), ec);
+        // write to a temporary file first so a crash mid-write never leaves a truncated binary behind
+        std::string cachePath = pathFor(key);
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(binary.data(), written);
+            if (!out)
+                return false;
+        }
+        std::filesystem::rename(tempPath, cachePath, ec);
+        return !ec;
+    }
+}
+#endif
@@ -0,0 +1,155 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SCENE_GRAPH_SSE 1
+#else
+#define SCENE_GRAPH_SSE 0
+#endif
+
+// Transform hierarchy.
+// Nodes live in contiguous arrays (parent index, local matrix, world matrix, dirty flag). A parent is always
+// created before its children, so one update() per frame walks the arrays once to find the nodes whose local
+// transform or any ancestor changed, then recomputes their world matrices depth level by depth level with
+// SIMD 4x4 multiplies. Every pass of the frame reads the same cached world matrices.
+class SceneGraph
+{
+public:
+    static const uint32_t NO_PARENT = 0xFFFFFFFFu;
+
+    // adds a node below parent (or a root) and returns its index
+    uint32_t addNode(const std::string& name, uint32_t parent = NO_PARENT, const glm::mat4& local = glm::mat4(1.0f))
+    {
+        uint32_t node = static_cast<uint32_t>(parents.size());
+        names.push_back(name);
+        parents.push_back(parent);
+        depths.push_back(parent == NO_PARENT ? 0 : depths[parent] + 1);
+        locals.push_back(local);
+        worlds.push_back(local);
+        dirty.push_back(1);
+        return node;
+    }
+
+    // replaces the local transform of a node, relative to its parent
+    void setLocal(uint32_t node, const glm::mat4& local)
+    {
+        locals[node] = local;
+        dirty[node] = 1;
+    }
+
+    const glm::mat4& local(uint32_t node) const
+    {
+        return locals[node];
+    }
+
+    // world transform as of the last update()
+    const glm::mat4& world(uint32_t node) const
+    {
+        return worlds[node];
+    }
+
+    const std::string& name(uint32_t node) const
+    {
+        return names[node];
+    }
+
+    size_t size() const
+    {
+        return parents.size();
+    }
+
+    // world matrices recomputed by the last update()
+    size_t lastUpdateCount() const
+    {
+        return updatedCount;
+    }
+
+    // recomputes the world matrix of every node whose local transform, or an ancestor's, changed since the last update
+    void update()
+    {
+        // a node is stale if it or any ancestor was changed; parents come first, so one forward pass settles it
+        for (std::vector<uint32_t>& level : levels)
+            level.clear();
+        for (size_t node = 0; node < parents.size(); node++)
+        {
+            uint32_t parent = parents[node];
+            if (parent != NO_PARENT && dirty[parent])
+                dirty[node] = 1;
+            if (!dirty[node])
+                continue;
+            if (levels.size() <= depths[node])
+                levels.resize(depths[node] + 1);
+            levels[depths[node]].push_back(static_cast<uint32_t>(node));
+        }
+
+        updatedCount = 0;
+        for (const std::vector<uint32_t>& level : levels)
+        {
+            multiplyBatch(level.data(), level.size());
+            updatedCount += level.size();
+        }
+
+        std::fill(dirty.begin(), dirty.end(), static_cast<uint8_t>(0));
+    }
+
+    // out = a * b for column-major 4x4 matrices. out must not alias a or b.
+    static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+    {
+#if SCENE_GRAPH_SSE
+        const float* left = glm::value_ptr(a);
+        const float* right = glm::value_ptr(b);
+        float* result = glm::value_ptr(out);
+        __m128 column0 = _mm_loadu_ps(left);
+        __m128 column1 = _mm_loadu_ps(left + 4);
+        __m128 column2 = _mm_loadu_ps(left + 8);
+        __m128 column3 = _mm_loadu_ps(left + 12);
+        for (int column = 0; column < 4; column++)
+        {
+            // each result column is a linear combination of the columns of a
+            const float* weights = right + column * 4;
+            __m128 sum = _mm_mul_ps(column0, _mm_set1_ps(weights[0]));
+            sum = _mm_add_ps(sum, _mm_mul_ps(column1, _mm_set1_ps(weights[1])));
+            sum = _mm_add_ps(sum, _mm_mul_ps(column2, _mm_set1_ps(weights[2])));
+            sum = _mm_add_ps(sum, _mm_mul_ps(column3, _mm_set1_ps(weights[3])));
+            _mm_storeu_ps(result + column * 4, sum);
+        }
+#else
+        out = a * b;
+#endif
+    }
+
+private:
+    std::vector<std::string> names;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> depths;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;
+
+    std::vector<std::vector<uint32_t>> levels;  // stale nodes per depth, reused between updates
+    size_t updatedCount = 0;
+
+    // world = parent world * local for a batch of nodes of one depth level; their parents are already up to date
+    void multiplyBatch(const uint32_t* batch, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t node = batch[i];
+            uint32_t parent = parents[node];
+            if (parent == NO_PARENT)
+                worlds[node] = locals[node];
+            else
+                multiply(worlds[parent], locals[node], worlds[node]);
+        }
+    }
+};
+#endif
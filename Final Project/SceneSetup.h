@@ -0,0 +1,87 @@
+#ifndef SCENE_SETUP_H
+#define SCENE_SETUP_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "AsteroidBelt.h"
+#include "Bounds.h"
+#include "LevelOfDetail.h"
+#include "LightClusters.h"
+#include "ShaderVariants.h"
+#include "UniformBlocks.h"
+#include "VertexFormat.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Pieces of the scene that the render loop and the benchmarks set up the same way.
+
+// the shadow cube map sampler of the lit programs
+constexpr UniformId shadowMapUniform("shadowMap");
+
+// the Sun's point light, in the frame's LightData block
+inline void SetPointLight(LightData& light)
+{
+    light.ambient = glm::vec3(0.1f, 0.1f, 0.1f);
+    light.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+    light.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+
+    light.position = glm::vec3(0.0f, 0.0f, 0.0f);
+}
+
+// Starts building the variants of the lit program the scene draws with first: with and without a specular
+// map, for the vertex layout of the models and the given shadow filter features, and if asked their instanced
+// versions for the asteroid belt and those of the GPU culled belt (see GpuCulling).
+inline void PrepareLitShaders(ShaderVariants& variants, uint32_t shadowFeatures, bool instanced, bool indirect, ShaderBatch* batch)
+{
+    uint32_t layoutFeatures = VertexFormat::get(VertexFormat::defaultLayout()).octahedralNormals ? SHADER_FEATURE_OCTAHEDRAL_NORMALS : 0u;
+    for (uint32_t materialFeatures : { 0u, uint32_t(SHADER_FEATURE_SPECULAR_MAP) })
+    {
+        variants.prepare(shadowFeatures | layoutFeatures | materialFeatures, batch);
+        if (instanced)
+            variants.prepare(shadowFeatures | layoutFeatures | materialFeatures | SHADER_FEATURE_INSTANCED, batch);
+        if (indirect)
+            variants.prepare(shadowFeatures | layoutFeatures | materialFeatures | SHADER_FEATURE_INSTANCED | SHADER_FEATURE_INDIRECT_INSTANCES, batch);
+    }
+}
+
+// small coloured point lights in a ring around the Sun, the same ones for the same count
+inline void ScatterLights(size_t count, std::vector<PointLightSource>& lights)
+{
+    // fixed seed, so every run and every benchmark step lights the scene the same way
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    lights.clear();
+    lights.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float angle = glm::two_pi<float>() * unit(random);
+        float distance = 2.0f + 8.0f * unit(random);
+        PointLightSource light;
+        light.position = glm::vec3(distance * std::cos(angle), 2.0f * unit(random) - 1.0f, distance * std::sin(angle));
+        light.radius = 0.75f + 1.25f * unit(random);
+        // saturated colours: one channel full, the others random
+        light.color = glm::vec3(unit(random), unit(random), unit(random));
+        light.color[i % 3] = 1.0f;
+        light.intensity = 2.0f + 2.0f * unit(random);
+        lights.push_back(light);
+    }
+}
+
+// Detail scale of the asteroid belt seen from a point (see LevelOfDetail). Every instance is drawn at the same
+// level, so it is the scale of the instance nearest to the point: nearestInstance is the distance to that
+// instance's position (FLT_MAX without instances) and bodySphere the instanced model's sphere in model space.
+inline float BeltDetailScale(float nearestInstance, const BoundingSphere& bodySphere, float projectionScaleY, float viewportHeight, float maxPixelError)
+{
+    if (nearestInstance == FLT_MAX || maxPixelError <= 0.0f)
+        return LevelOfDetail::FULL_DETAIL;
+
+    // no instance is scaled more than MAX_SCALE, so its sphere is at most that far from its position and that much larger
+    float nearest = nearestInstance - AsteroidBelt::MAX_SCALE * (glm::length(bodySphere.center) + bodySphere.radius);
+    return LevelOfDetail::detailScale(AsteroidBelt::MAX_SCALE, nearest, projectionScaleY, viewportHeight, maxPixelError);
+}
+#endif
@@ -3,81 +3,274 @@
 
 #include <glad/glad.h>
 
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GLCapabilities.h"
+#include "GLState.h"
+#include "ProgramCache.h"
+#include "UniformBlocks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// compute shaders are core in 4.3 (ARB_compute_shader); defined here for 3.3 headers
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+
+/// <summary>
+/// FNV-1a hash of a uniform name. Usable at compile time.
+/// </summary>
+/// <param name="name">Uniform name as written in GLSL, e.g. "pointLight.ambient" or "shadowMatrices[2]"</param>
+/// <returns>32 bit hash of the name</returns>
+constexpr uint32_t HashUniformName(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; ++name)
+	{
+		hash ^= static_cast<unsigned char>(*name);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/// <summary>
+/// Pre-hashed uniform name. Declare it constexpr to hash the name at compile time,
+/// e.g. constexpr UniformId modelMatrixUniform("modelMatrix");
+/// </summary>
+struct UniformId
+{
+	uint32_t hash;
+
+	constexpr UniformId(const char* name) : hash(HashUniformName(name)) {}
+	UniformId(const std::string& name) : hash(HashUniformName(name.c_str())) {}
+};
+
+/// <summary>
+/// A #define injected into the sources of a shader program, e.g. { "SHADOW_TAPS", "8" }. An empty value
+/// defines the name alone.
+/// </summary>
+struct ShaderDefine
+{
+	std::string name;
+	std::string value;
+};
+
+typedef std::vector<ShaderDefine> ShaderDefines;
+
+class Shader;
+
+/// <summary>
+/// Shader programs built together at startup. Every program added loads its binary from the ProgramCache or
+/// issues its compiles and its link right away, but no status is read until finish(), so the driver can build
+/// them all at once (on its own threads with KHR_parallel_shader_compile) while the caller carries on.
+/// </summary>
+class ShaderBatch
+{
+public:
+	ShaderBatch()
+		: start(std::chrono::steady_clock::now())
+	{
+		parallelCompile();
+	}
+
+	/// <summary>
+	/// Waits for every program of the batch and finishes it. The programs can't be used before this.
+	/// </summary>
+	void finish();
+
+	size_t programCount() const
+	{
+		return programs;
+	}
+
+	size_t cachedCount() const
+	{
+		return cached;
+	}
+
+	/// <summary>
+	/// Time from the batch's creation until finish() returned.
+	/// </summary>
+	double milliseconds() const
+	{
+		return elapsed;
+	}
+
+	/// <summary>
+	/// Lets the driver compile on as many threads as it likes, if it has KHR_parallel_shader_compile (or the ARB
+	/// version). Asked once; the context must be current.
+	/// </summary>
+	/// <returns>true if the driver compiles in parallel</returns>
+	static bool parallelCompile()
+	{
+		static const bool enabled = []() {
+			typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+			MaxShaderCompilerThreadsProc maxThreads = nullptr;
+			if (GLCapabilities::hasExtension("GL_KHR_parallel_shader_compile"))
+				maxThreads = GLCapabilities::loadFunction<MaxShaderCompilerThreadsProc>("glMaxShaderCompilerThreadsKHR");
+			else if (GLCapabilities::hasExtension("GL_ARB_parallel_shader_compile"))
+				maxThreads = GLCapabilities::loadFunction<MaxShaderCompilerThreadsProc>("glMaxShaderCompilerThreadsARB");
+			if (maxThreads == nullptr)
+				return false;
+			// 0xFFFFFFFF leaves the thread count to the driver
+			maxThreads(0xFFFFFFFFu);
+			return true;
+		}();
+		return enabled;
+	}
+
+private:
+	friend class Shader;
+
+	std::vector<Shader*> pending;
+	std::chrono::steady_clock::time_point start;
+	size_t programs = 0;
+	size_t cached = 0;
+	double elapsed = 0.0;
+
+	void add(Shader* shader)
+	{
+		pending.push_back(shader);
+	}
+};
 
 class Shader
 {
 public:
 	GLuint program;
+
+	/// <summary>
+	/// Uniform upload counters, summed over every shader.
+	/// </summary>
+	struct UniformStats
+	{
+		uint64_t uploaded = 0;
+		uint64_t skipped = 0;
+	};
+
+	/// <summary>
+	/// Texture unit and target a sampler uniform reads from. Fixed when the program is linked.
+	/// </summary>
+	struct SamplerBinding
+	{
+		GLint location = -1;
+		GLuint unit = 0;
+		GLenum target = 0;
+	};
+
 	/// <summary>
 	/// Creates a shader program based on the provided file paths for the vertex and fragment shaders.
 	/// </summary>
 	/// <param name="vertexShaderFilePath">Vertex shader file path</param>
 	/// <param name="fragmentShaderFilePath">Fragment shader file path</param>
-	Shader(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath)
+	/// <param name="batch">Batch to build the program in; without one it is ready when the constructor returns</param>
+	Shader(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath, ShaderBatch* batch = nullptr)
 	{
-		GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
-		GLuint fragmentShader = CreateShaderFromFile(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
+		const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		const std::string paths[] = { vertexShaderFilePath, fragmentShaderFilePath };
+		Build(types, paths, 2, ShaderDefines(), batch);
+	}
 
-		program = glCreateProgram();
-		glAttachShader(program, vertexShader);
-		glAttachShader(program, fragmentShader);
+	/// <summary>
+	/// Creates a variant of a shader program: the sources are compiled with the given defines (see PreprocessShader).
+	/// </summary>
+	/// <param name="vertexShaderFilePath">Vertex shader file path</param>
+	/// <param name="fragmentShaderFilePath">Fragment shader file path</param>
+	/// <param name="defines">Defines of the variant</param>
+	/// <param name="batch">Batch to build the program in; without one it is ready when the constructor returns</param>
+	Shader(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath, const ShaderDefines& defines, ShaderBatch* batch = nullptr)
+	{
+		const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		const std::string paths[] = { vertexShaderFilePath, fragmentShaderFilePath };
+		Build(types, paths, 2, defines, batch);
+	}
 
-		glLinkProgram(program);
+	Shader(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath, const std::string& geometryShaderFilePath, ShaderBatch* batch = nullptr)
+	{
+		const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+		const std::string paths[] = { vertexShaderFilePath, fragmentShaderFilePath, geometryShaderFilePath };
+		Build(types, paths, 3, ShaderDefines(), batch);
+	}
 
-		glDetachShader(program, vertexShader);
-		glDeleteShader(vertexShader);
-		glDetachShader(program, fragmentShader);
-		glDeleteShader(fragmentShader);
+	/// <summary>
+	/// Creates a compute program. The context must support compute shaders (OpenGL 4.3 or ARB_compute_shader).
+	/// </summary>
+	/// <param name="computeShaderFilePath">Compute shader file path</param>
+	/// <param name="batch">Batch to build the program in; without one it is ready when the constructor returns</param>
+	explicit Shader(const std::string& computeShaderFilePath, ShaderBatch* batch = nullptr)
+	{
+		const GLenum types[] = { GL_COMPUTE_SHADER };
+		const std::string paths[] = { computeShaderFilePath };
+		Build(types, paths, 1, ShaderDefines(), batch);
+	}
 
-		// Check shader program link status
-		GLint linkStatus;
-		glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-		if (linkStatus != GL_TRUE) 
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
+
+	/// <summary>
+	/// Reads a whole shader source file.
+	/// </summary>
+	/// <param name="shaderFilePath">Path to the file containing the shader source</param>
+	/// <param name="shaderSource">Receives the source</param>
+	/// <returns>false if the file could not be opened</returns>
+	static bool ReadShaderFile(const std::string& shaderFilePath, std::string& shaderSource)
+	{
+		std::ifstream shaderFile(shaderFilePath, std::ios::binary);
+		if (shaderFile.fail())
 		{
-			char infoLog[512];
-			GLsizei infoLogLen = sizeof(infoLog);
-			glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
-			std::cerr << "program link error: " << infoLog << std::endl;
+			std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
+			return false;
 		}
+
+		std::ostringstream contents;
+		contents << shaderFile.rdbuf();
+		shaderSource = contents.str();
+		return true;
 	}
 
-	Shader(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath, const std::string& geometryShaderFilePath)
+	/// <summary>
+	/// Reads a shader source file and prepares it for the compiler. Every #include "file" line is replaced by
+	/// that file, found next to the file including it; a file is only included once per stage, so included
+	/// files need no guards. Right after the #version line come a VERTEX_SHADER, FRAGMENT_SHADER,
+	/// GEOMETRY_SHADER or COMPUTE_SHADER define for the stage and then the given defines. #line directives keep the line numbers
+	/// of compile errors right: the source string number of a line is the index of its file in files.
+	/// </summary>
+	/// <param name="shaderFilePath">Path to the file containing the shader source</param>
+	/// <param name="shaderType">Shader type</param>
+	/// <param name="defines">Defines to inject</param>
+	/// <param name="shaderSource">Receives the expanded source</param>
+	/// <param name="files">Receives the file and every file it includes</param>
+	/// <returns>false if the file or one of its includes could not be read</returns>
+	static bool PreprocessShader(const std::string& shaderFilePath, GLenum shaderType, const ShaderDefines& defines, std::string& shaderSource, std::vector<std::string>& files)
 	{
-		GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
-		GLuint fragmentShader = CreateShaderFromFile(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
-		GLuint geometryShader = CreateShaderFromFile(GL_GEOMETRY_SHADER, geometryShaderFilePath);
+		std::ostringstream injected;
+		const char* stage = shaderType == GL_VERTEX_SHADER ? "VERTEX_SHADER" : shaderType == GL_GEOMETRY_SHADER ? "GEOMETRY_SHADER"
+			: shaderType == GL_COMPUTE_SHADER ? "COMPUTE_SHADER" : "FRAGMENT_SHADER";
+		injected << "#define " << stage << "\n";
+		for (const ShaderDefine& define : defines)
+			injected << "#define " << define.name << (define.value.empty() ? "" : " ") << define.value << "\n";
 
-		program = glCreateProgram();
-		glAttachShader(program, vertexShader);
-		glAttachShader(program, fragmentShader);
-		glAttachShader(program, geometryShader);
-
-		glLinkProgram(program);
-
-		glDetachShader(program, vertexShader);
-		glDeleteShader(vertexShader);
-		glDetachShader(program, fragmentShader);
-		glDeleteShader(fragmentShader);
-		glDetachShader(program, geometryShader);
-		glDeleteShader(geometryShader);
-
-		// Check shader program link status
-		GLint linkStatus;
-		glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-		if (linkStatus != GL_TRUE) 
-		{
-			char infoLog[512];
-			GLsizei infoLogLen = sizeof(infoLog);
-			glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
-			std::cerr << "program link error: " << infoLog << std::endl;
-		}
+		files.assign(1, shaderFilePath);
+		std::string source;
+		if (!ReadShaderFile(shaderFilePath, source))
+			return false;
+		std::ostringstream expanded;
+		if (!ExpandShaderSource(source, 0, injected.str(), files, expanded))
+			return false;
+		shaderSource = expanded.str();
+		return true;
 	}
 
-
 	/// <summary>
 	/// Creates a shader based on the provided shader type and the path to the file containing the shader source.
 	/// </summary>
@@ -86,21 +279,10 @@ public:
 	/// <returns>OpenGL handle to the created shader</returns>
 	GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath)
 	{
-		std::ifstream shaderFile(shaderFilePath);
-		if (shaderFile.fail())
-		{
-			std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
-			return 0;
-		}
-
 		std::string shaderSource;
-		std::string temp;
-		while (std::getline(shaderFile, temp))
-		{
-			shaderSource += temp + "\n";
-		}
-		shaderFile.close();
-
+		std::vector<std::string> files;
+		if (!PreprocessShader(shaderFilePath, shaderType, ShaderDefines(), shaderSource, files))
+			return 0;
 		return CreateShaderFromSource(shaderType, shaderSource);
 	}
 
@@ -112,12 +294,7 @@ public:
 	/// <returns>OpenGL handle to the created shader</returns>
 	GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource)
 	{
-		GLuint shader = glCreateShader(shaderType);
-
-		const char* shaderSourceCStr = shaderSource.c_str();
-		GLint shaderSourceLen = static_cast<GLint>(shaderSource.length());
-		glShaderSource(shader, 1, &shaderSourceCStr, &shaderSourceLen);
-		glCompileShader(shader);
+		GLuint shader = CompileShader(shaderType, shaderSource);
 
 		// Check compilation status
 		GLint compileStatus;
@@ -133,12 +310,20 @@ public:
 		return shader;
 	}
 
+	/// <summary>
+	/// True if the program was loaded from the program cache instead of compiled.
+	/// </summary>
+	bool loadedFromCache() const
+	{
+		return fromCache;
+	}
+
 	/// <summary>
 	/// Switches current shader program to this.
 	/// </summary>
 	void use() 
 	{
-		glUseProgram(program);
+		GLState::instance().useProgram(program);
 	}
 
 	/// <summary>
@@ -146,7 +331,496 @@ public:
 	/// </summary>
 	void clean()
 	{
+		GLState::instance().forgetProgram(program);
 		glDeleteProgram(program);
+		uniforms.clear();
+		uniformValues.clear();
+		uniformValueSet.clear();
+	}
+
+	/// <summary>
+	/// Reads every active uniform of the linked program into the uniform table. Array uniforms are
+	/// registered under their base name and under every element name ("shadowMatrices", "shadowMatrices[0]", ...).
+	/// Every sampler gets its own texture unit here, in declaration order, so samplers never need setting per draw,
+	/// and every uniform block UniformBlocks knows is attached to its binding point.
+	/// Called by the constructors; only needs calling again if the program is relinked.
+	/// </summary>
+	void ReflectUniforms()
+	{
+		uniforms.clear();
+		uniformValues.clear();
+		uniformValueSet.clear();
+
+		GLint uniformCount = 0, maxNameLength = 0, nextTextureUnit = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniformCount);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+		std::vector<char> nameBuffer(static_cast<size_t>(maxNameLength) + 1);
+
+		for (GLint i = 0; i < uniformCount; i++)
+		{
+			GLint arraySize = 0;
+			GLenum type = 0;
+			GLsizei nameLength = 0;
+			glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(nameBuffer.size()), &nameLength, &arraySize, &type, nameBuffer.data());
+			std::string name(nameBuffer.data(), static_cast<size_t>(nameLength));
+
+			// uniforms inside uniform blocks have no location
+			GLint location = glGetUniformLocation(program, name.c_str());
+			if (location < 0)
+				continue;
+
+			Uniform uniform;
+			uniform.type = type;
+			uniform.textureTarget = SamplerTarget(type);
+			uniform.elementBytes = UniformTypeBytes(type);
+			uniform.valueOffset = uniformValues.size();
+			uniform.valueSlot = uniformValueSet.size();
+			uniformValues.resize(uniformValues.size() + uniform.elementBytes * arraySize);
+			uniformValueSet.resize(uniformValueSet.size() + arraySize, false);
+
+			// arrays are reported as "name[0]"
+			std::string baseName = name;
+			bool isArray = baseName.size() > 3 && baseName.compare(baseName.size() - 3, 3, "[0]") == 0;
+			if (isArray)
+				baseName.erase(baseName.size() - 3);
+
+			for (GLint element = 0; element < arraySize; element++)
+			{
+				Uniform entry = uniform;
+				entry.location = element == 0 ? location : glGetUniformLocation(program, (baseName + "[" + std::to_string(element) + "]").c_str());
+				entry.arraySize = arraySize - element;
+				entry.valueOffset += static_cast<size_t>(element) * uniform.elementBytes;
+				entry.valueSlot += static_cast<size_t>(element);
+				if (entry.textureTarget != 0)
+				{
+					entry.textureUnit = nextTextureUnit++;
+					GLState::instance().useProgram(program);
+					glUniform1i(entry.location, entry.textureUnit);
+					std::memcpy(&uniformValues[entry.valueOffset], &entry.textureUnit, sizeof(GLint));
+					uniformValueSet[entry.valueSlot] = true;
+				}
+				if (isArray)
+					AddUniform(baseName + "[" + std::to_string(element) + "]", entry);
+				if (element == 0)
+					AddUniform(baseName, entry);
+			}
+		}
+
+		// block bindings are program state a binary from the program cache need not keep, so they are set every time
+		GLint blockCount = 0, maxBlockNameLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLength);
+		std::vector<char> blockName(static_cast<size_t>(maxBlockNameLength) + 1);
+		for (GLint i = 0; i < blockCount; i++)
+		{
+			GLsizei nameLength = 0;
+			glGetActiveUniformBlockName(program, static_cast<GLuint>(i), static_cast<GLsizei>(blockName.size()), &nameLength, blockName.data());
+			blockName[static_cast<size_t>(nameLength)] = '\0';
+			GLint binding = UniformBlocks::bindingPoint(blockName.data());
+			if (binding >= 0)
+				glUniformBlockBinding(program, static_cast<GLuint>(i), static_cast<GLuint>(binding));
+		}
+	}
+
+	/// <summary>
+	/// Looks up the texture unit and target of a sampler uniform.
+	/// </summary>
+	/// <param name="id">Hashed sampler name</param>
+	/// <param name="binding">Receives the sampler's location, unit and target</param>
+	/// <returns>false if the program has no such active sampler</returns>
+	bool findSampler(UniformId id, SamplerBinding& binding) const
+	{
+		auto found = uniforms.find(id.hash);
+		if (found == uniforms.end() || found->second.textureTarget == 0)
+			return false;
+		binding.location = found->second.location;
+		binding.unit = static_cast<GLuint>(found->second.textureUnit);
+		binding.target = found->second.textureTarget;
+		return true;
+	}
+
+	/// <summary>
+	/// Returns the location of a uniform from the uniform table, or -1 if the program has no such active uniform.
+	/// </summary>
+	/// <param name="id">Hashed uniform name</param>
+	GLint location(UniformId id) const
+	{
+		auto found = uniforms.find(id.hash);
+		return found != uniforms.end() ? found->second.location : -1;
+	}
+
+	// Typed setters. The program must be in use. A value identical to the one uploaded last is skipped;
+	// setting a uniform the program does not have is ignored, like glUniform* with location -1.
+
+	void setInt(UniformId id, GLint value)
+	{
+		if (const Uniform* uniform = NeedsUpload(id, &value, sizeof(value), 1))
+			glUniform1i(uniform->location, value);
+	}
+
+	void setBool(UniformId id, bool value)
+	{
+		setInt(id, value ? 1 : 0);
+	}
+
+	void setFloat(UniformId id, GLfloat value)
+	{
+		if (const Uniform* uniform = NeedsUpload(id, &value, sizeof(value), 1))
+			glUniform1f(uniform->location, value);
+	}
+
+	void setVec3(UniformId id, const glm::vec3& value)
+	{
+		if (const Uniform* uniform = NeedsUpload(id, glm::value_ptr(value), sizeof(value), 1))
+			glUniform3fv(uniform->location, 1, glm::value_ptr(value));
+	}
+
+	void setVec3(UniformId id, GLfloat x, GLfloat y, GLfloat z)
+	{
+		setVec3(id, glm::vec3(x, y, z));
+	}
+
+	void setMat4(UniformId id, const glm::mat4& value)
+	{
+		if (const Uniform* uniform = NeedsUpload(id, glm::value_ptr(value), sizeof(value), 1))
+			glUniformMatrix4fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	/// <summary>
+	/// Sets count consecutive elements of a mat4 array uniform, starting at the element id names.
+	/// </summary>
+	void setMat4Array(UniformId id, const glm::mat4* values, GLsizei count)
+	{
+		if (const Uniform* uniform = NeedsUpload(id, glm::value_ptr(values[0]), sizeof(glm::mat4), count))
+			glUniformMatrix4fv(uniform->location, std::min(count, uniform->arraySize), GL_FALSE, glm::value_ptr(values[0]));
+	}
+
+	/// <summary>
+	/// Starts a new frame of uniform counters. The counters of the finished frame are kept for lastFrameStats().
+	/// </summary>
+	static void beginFrame()
+	{
+		lastFrameStats() = frameStats();
+		totalStats().uploaded += frameStats().uploaded;
+		totalStats().skipped += frameStats().skipped;
+		totalStats().frames++;
+		frameStats() = UniformStats();
+	}
+
+	/// <summary>
+	/// Uniform uploads performed and skipped during the last complete frame.
+	/// </summary>
+	static UniformStats& lastFrameStats()
+	{
+		static UniformStats stats;
+		return stats;
+	}
+
+	/// <summary>
+	/// Prints the average uniform uploads performed and skipped per frame.
+	/// </summary>
+	static void printUniformStats()
+	{
+		const TotalUniformStats& total = totalStats();
+		if (total.frames == 0)
+			return;
+		std::cout << "Uniforms per frame: " << double(total.uploaded) / total.frames << " uploaded, "
+			<< double(total.skipped) / total.frames << " skipped (" << total.frames << " frames)" << std::endl;
+	}
+
+private:
+	friend class ShaderBatch;
+
+	struct Uniform
+	{
+		GLint location = -1;
+		GLenum type = 0;
+		GLsizei arraySize = 1;		// elements from this one to the end of the array
+		size_t elementBytes = 0;
+		size_t valueOffset = 0;		// last uploaded value in uniformValues
+		size_t valueSlot = 0;		// per element "has a value" flags in uniformValueSet
+		GLenum textureTarget = 0;	// samplers only
+		GLint textureUnit = -1;
+	};
+
+	struct TotalUniformStats : UniformStats
+	{
+		uint64_t frames = 0;
+	};
+
+	std::unordered_map<uint32_t, Uniform> uniforms;
+	std::vector<unsigned char> uniformValues;
+	std::vector<bool> uniformValueSet;
+
+	uint64_t cacheKey = 0;
+	bool fromCache = false;
+	struct PendingStage
+	{
+		GLuint shader;
+		std::vector<std::string> files;		// the file and its includes, for the error messages
+	};
+	std::vector<PendingStage> pendingStages;	// compiled and attached, not checked yet
+	bool pendingLink = false;
+
+	static GLuint CompileShader(GLenum shaderType, const std::string& shaderSource)
+	{
+		GLuint shader = glCreateShader(shaderType);
+		const char* shaderSourceCStr = shaderSource.c_str();
+		GLint shaderSourceLen = static_cast<GLint>(shaderSource.length());
+		glShaderSource(shader, 1, &shaderSourceCStr, &shaderSourceLen);
+		glCompileShader(shader);
+		return shader;
+	}
+
+	/// <summary>
+	/// Copies a source to out line by line, replacing its #include lines by the files they name and injecting
+	/// the defines after its #version line (see PreprocessShader).
+	/// </summary>
+	/// <param name="source">Source of files[fileIndex]</param>
+	static bool ExpandShaderSource(const std::string& source, size_t fileIndex, const std::string& injected, std::vector<std::string>& files, std::ostringstream& out)
+	{
+		std::string directory = files[fileIndex].substr(0, files[fileIndex].find_last_of("/\\") + 1);
+		std::istringstream lines(source);
+		std::string line;
+		for (int lineNumber = 1; std::getline(lines, line); lineNumber++)
+		{
+			size_t start = line.find_first_not_of(" \t");
+			if (start != std::string::npos && line.compare(start, 8, "#include") == 0)
+			{
+				size_t open = line.find('"', start + 8);
+				size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+				if (close == std::string::npos)
+				{
+					std::cerr << files[fileIndex] << ":" << lineNumber << ": #include needs a file name in quotes" << std::endl;
+					return false;
+				}
+				std::string includePath = directory + line.substr(open + 1, close - open - 1);
+				if (std::find(files.begin(), files.end(), includePath) != files.end())
+				{
+					out << "\n";
+					continue;
+				}
+
+				std::string included;
+				if (!ReadShaderFile(includePath, included))
+				{
+					std::cerr << "  included from " << files[fileIndex] << ":" << lineNumber << std::endl;
+					return false;
+				}
+				files.push_back(includePath);
+				out << "#line 1 " << files.size() - 1 << "\n";
+				if (!ExpandShaderSource(included, files.size() - 1, std::string(), files, out))
+					return false;
+				out << "\n#line " << lineNumber + 1 << " " << fileIndex << "\n";
+			}
+			else if (!injected.empty() && start != std::string::npos && line.compare(start, 8, "#version") == 0)
+				out << line << "\n" << injected << "#line " << lineNumber + 1 << " " << fileIndex << "\n";
+			else
+				out << line << "\n";
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Loads the program from the program cache, or issues the compiles of its stages and its link without
+	/// waiting for them. Without a batch the program is finished right away. If a source can't be read the
+	/// program is left empty and unlinked, like a program that failed to link, and nothing goes to the cache.
+	/// </summary>
+	void Build(const GLenum* types, const std::string* paths, size_t stageCount, const ShaderDefines& defines, ShaderBatch* batch)
+	{
+		std::vector<std::string> sources(stageCount);
+		std::vector<std::vector<std::string>> files(stageCount);
+		bool preprocessed = true;
+		for (size_t i = 0; i < stageCount && preprocessed; i++)
+		{
+			preprocessed = PreprocessShader(paths[i], types[i], defines, sources[i], files[i]);
+			if (!preprocessed)
+				std::cerr << "shader program not built: " << paths[i] << " could not be preprocessed" << std::endl;
+		}
+
+		program = glCreateProgram();
+		if (preprocessed)
+		{
+			cacheKey = ProgramCache::key(types, sources.data(), stageCount);
+			fromCache = ProgramCache::load(program, cacheKey);
+		}
+		if (preprocessed && !fromCache)
+		{
+			// a rejected binary leaves the program in an undefined state, so start over
+			if (ProgramCache::active())
+			{
+				glDeleteProgram(program);
+				program = glCreateProgram();
+			}
+			for (size_t i = 0; i < stageCount; i++)
+			{
+				GLuint shader = CompileShader(types[i], sources[i]);
+				glAttachShader(program, shader);
+				pendingStages.push_back({ shader, files[i] });
+			}
+			ProgramCache::prepare(program);
+			glLinkProgram(program);
+			pendingLink = true;
+		}
+
+		if (batch != nullptr)
+			batch->add(this);
+		else
+			FinishBuild();
+	}
+
+	/// <summary>
+	/// Waits for the compiles and the link, reports their errors, stores the binary in the program cache
+	/// and reads the uniforms.
+	/// </summary>
+	void FinishBuild()
+	{
+		for (const PendingStage& stage : pendingStages)
+		{
+			// Check compilation status
+			GLint compileStatus;
+			glGetShaderiv(stage.shader, GL_COMPILE_STATUS, &compileStatus);
+			if (compileStatus == GL_FALSE)
+			{
+				char infoLog[512];
+				GLsizei infoLogLen = sizeof(infoLog);
+				glGetShaderInfoLog(stage.shader, infoLogLen, &infoLogLen, infoLog);
+				std::cerr << "shader compilation error in " << stage.files[0] << ": " << infoLog << std::endl;
+				for (size_t i = 1; i < stage.files.size(); i++)
+					std::cerr << "  source string " << i << ": " << stage.files[i] << std::endl;
+			}
+			glDetachShader(program, stage.shader);
+			glDeleteShader(stage.shader);
+		}
+		pendingStages.clear();
+
+		if (pendingLink)
+		{
+			// Check shader program link status
+			GLint linkStatus;
+			glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+			if (linkStatus != GL_TRUE)
+			{
+				char infoLog[512];
+				GLsizei infoLogLen = sizeof(infoLog);
+				glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
+				std::cerr << "program link error: " << infoLog << std::endl;
+			}
+			else
+				ProgramCache::store(program, cacheKey);
+			pendingLink = false;
+		}
+
+		ReflectUniforms();
+	}
+
+	static UniformStats& frameStats()
+	{
+		static UniformStats stats;
+		return stats;
+	}
+
+	static TotalUniformStats& totalStats()
+	{
+		static TotalUniformStats stats;
+		return stats;
+	}
+
+	void AddUniform(const std::string& name, const Uniform& uniform)
+	{
+		if (!uniforms.emplace(HashUniformName(name.c_str()), uniform).second)
+			std::cerr << "ERROR::SHADER:: uniform name hash collision on " << name << std::endl;
+	}
+
+	/// <summary>
+	/// Compares a value against the last one uploaded to the uniform and records it if it differs.
+	/// </summary>
+	/// <returns>The uniform to upload to, or nullptr if the uniform does not exist or already holds the value</returns>
+	const Uniform* NeedsUpload(UniformId id, const void* value, size_t elementBytes, GLsizei count)
+	{
+		auto found = uniforms.find(id.hash);
+		if (found == uniforms.end())
+			return nullptr;
+		const Uniform& uniform = found->second;
+		count = std::min(count, uniform.arraySize);
+		size_t bytes = std::min(elementBytes, uniform.elementBytes) * static_cast<size_t>(count);
+
+		bool known = true;
+		for (GLsizei i = 0; i < count; i++)
+			known = known && uniformValueSet[uniform.valueSlot + i];
+		unsigned char* cached = &uniformValues[uniform.valueOffset];
+		if (known && elementBytes == uniform.elementBytes && std::memcmp(cached, value, bytes) == 0)
+		{
+			frameStats().skipped++;
+			return nullptr;
+		}
+
+		// a value of a different size than the uniform can't be compared later, so forget the cached one
+		bool cacheable = elementBytes == uniform.elementBytes;
+		if (cacheable)
+			std::memcpy(cached, value, bytes);
+		for (GLsizei i = 0; i < count; i++)
+			uniformValueSet[uniform.valueSlot + i] = cacheable;
+		frameStats().uploaded++;
+		return &uniform;
+	}
+
+	/// <summary>
+	/// Texture target a sampler type reads, or 0 if the type is not a sampler.
+	/// </summary>
+	static GLenum SamplerTarget(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_SAMPLER_2D: case GL_SAMPLER_2D_SHADOW: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+			return GL_TEXTURE_2D;
+		case GL_SAMPLER_CUBE: case GL_SAMPLER_CUBE_SHADOW: case GL_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+			return GL_TEXTURE_CUBE_MAP;
+		case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_ARRAY_SHADOW:
+			return GL_TEXTURE_2D_ARRAY;
+		case GL_SAMPLER_3D:
+			return GL_TEXTURE_3D;
+		case GL_SAMPLER_BUFFER: case GL_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+			return GL_TEXTURE_BUFFER;
+		default:
+			return 0;
+		}
+	}
+
+	/// <summary>
+	/// Size of one element of a uniform type, as stored in the value cache.
+	/// </summary>
+	static size_t UniformTypeBytes(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2:
+			return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3:
+			return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2:
+			return 16;
+		case GL_FLOAT_MAT3:
+			return 36;
+		case GL_FLOAT_MAT4:
+			return 64;
+		default:
+			// scalars and samplers
+			return 4;
+		}
 	}
 };
-#endif
\ No newline at end of file
+
+inline void ShaderBatch::finish()
+{
+	for (Shader* shader : pending)
+	{
+		shader->FinishBuild();
+		programs++;
+		if (shader->fromCache)
+			cached++;
+	}
+	pending.clear();
+	elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+#endif
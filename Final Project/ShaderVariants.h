@@ -0,0 +1,106 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "Shader.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Features a variant of a shader program is specialized for. Each one becomes a #define of the sources,
+// so a variant only holds the code its draws need.
+enum ShaderFeature : uint32_t {
+    SHADER_FEATURE_SPECULAR_MAP = 1u << 0,          // HAS_SPECULAR_MAP: the material has a specular map
+    SHADER_FEATURE_INSTANCED = 1u << 1,             // INSTANCED: model matrices come from the instance buffer
+    SHADER_FEATURE_OCTAHEDRAL_NORMALS = 1u << 2,    // OCTAHEDRAL_NORMALS: the vertex layout packs normals octahedrally
+    SHADER_FEATURE_SHADOW_EARLY_OUT = 1u << 3,      // SHADOW_EARLY_OUT: the shadow filter stops when the probe taps agree
+    // bits 4 to 8 hold the shadow filter's tap count (SHADOW_TAPS), see shadowTapsFeature
+    SHADER_FEATURE_INDIRECT_INSTANCES = 1u << 9,    // INDIRECT_INSTANCES: instanced, with the culled instance lists of GpuCulling
+};
+
+// sets the uniforms of a program that was just made current, before a model draws with it
+typedef std::function<void(Shader&)> ShaderSetup;
+
+// Permutation cache of one vertex and fragment shader pair: one program per feature mask, built the first
+// time it is asked for. Meshes combine the features of their material and vertex layout with the features
+// of the pass (see Model::Draw), so every draw runs the cheapest program that still does everything it needs.
+class ShaderVariants
+{
+public:
+    static constexpr uint32_t SHADOW_TAPS_SHIFT = 4;
+    static constexpr uint32_t SHADOW_TAPS_MASK = 0x1fu << SHADOW_TAPS_SHIFT;
+
+    ShaderVariants(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath)
+        : vertexPath(vertexShaderFilePath), fragmentPath(fragmentShaderFilePath)
+    {
+    }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    // the feature bits of a shadow filter tap count
+    static uint32_t shadowTapsFeature(int taps)
+    {
+        return (uint32_t(taps) << SHADOW_TAPS_SHIFT) & SHADOW_TAPS_MASK;
+    }
+
+    // the defines the sources are compiled with for a feature mask
+    static ShaderDefines defines(uint32_t features)
+    {
+        ShaderDefines result;
+        if (features & SHADER_FEATURE_SPECULAR_MAP)
+            result.push_back({ "HAS_SPECULAR_MAP", "" });
+        if (features & SHADER_FEATURE_INSTANCED)
+            result.push_back({ "INSTANCED", "" });
+        if (features & SHADER_FEATURE_OCTAHEDRAL_NORMALS)
+            result.push_back({ "OCTAHEDRAL_NORMALS", "" });
+        if (features & SHADER_FEATURE_SHADOW_EARLY_OUT)
+            result.push_back({ "SHADOW_EARLY_OUT", "" });
+        if (features & SHADER_FEATURE_INDIRECT_INSTANCES)
+            result.push_back({ "INDIRECT_INSTANCES", "" });
+        if (features & SHADOW_TAPS_MASK)
+            result.push_back({ "SHADOW_TAPS", std::to_string((features & SHADOW_TAPS_MASK) >> SHADOW_TAPS_SHIFT) });
+        return result;
+    }
+
+    // the variant for a feature mask, compiled (or loaded from the program cache) on first use
+    Shader& get(uint32_t features)
+    {
+        std::unique_ptr<Shader>& variant = variants[features];
+        if (!variant)
+            variant.reset(new Shader(vertexPath, fragmentPath, defines(features)));
+        return *variant;
+    }
+
+    // starts building a variant in a batch, so it is ready without a stall once the batch is finished.
+    // get() must not be called for it before then.
+    void prepare(uint32_t features, ShaderBatch* batch)
+    {
+        std::unique_ptr<Shader>& variant = variants[features];
+        if (!variant)
+            variant.reset(new Shader(vertexPath, fragmentPath, defines(features), batch));
+    }
+
+    // number of variants built so far
+    size_t count() const
+    {
+        return variants.size();
+    }
+
+    // deletes every variant's program
+    void clean()
+    {
+        for (auto& variant : variants)
+            variant.second->clean();
+        variants.clear();
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+};
+#endif
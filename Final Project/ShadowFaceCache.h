@@ -0,0 +1,147 @@
+#ifndef SHADOW_FACE_CACHE_H
+#define SHADOW_FACE_CACHE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Bounds.h"
+
+#include <cstdint>
+#include <iostream>
+
+// Per-face culling and caching for the omnidirectional (cube map) shadow pass.
+// Every frame the casters are registered first: each one is tested against the six face frustums, which
+// gives the faces it has to be drawn into, and is hashed into the signature of those faces together with
+// its transform. A face whose signature matches last frame's (same casters, same transforms, same light)
+// still holds the right depth and is neither cleared nor drawn. Then each caster is drawn only into the
+// faces of drawMask().
+class ShadowFaceCache
+{
+public:
+    static const int FACE_COUNT = 6;
+    static const uint8_t ALL_FACES = (1 << FACE_COUNT) - 1;
+
+    struct Stats {
+        uint64_t faceDraws = 0;     // caster x face draws issued
+        uint64_t culled = 0;        // caster x face draws skipped because the caster is outside the face
+        uint64_t cached = 0;        // caster x face draws skipped because the face did not change
+        uint64_t facesRendered = 0; // faces cleared and redrawn
+    };
+
+    // starts the frame's caster list (and a new frame of counters) for the six face view projection
+    // matrices of a light
+    void beginFrame(const glm::mat4* faceMatrices, const glm::vec3& lightPos, float farPlane)
+    {
+        lastFrame = frame;
+        total.faceDraws += frame.faceDraws;
+        total.culled += frame.culled;
+        total.cached += frame.cached;
+        total.facesRendered += frame.facesRendered;
+        frames++;
+        frame = Stats();
+
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            faces[face] = Frustum(faceMatrices[face]);
+            uint64_t signature = hash(FNV_OFFSET, glm::value_ptr(faceMatrices[face]), sizeof(glm::mat4));
+            signature = hash(signature, glm::value_ptr(lightPos), sizeof(glm::vec3));
+            signatures[face] = hash(signature, &farPlane, sizeof(farPlane));
+        }
+        dirty = 0;
+    }
+
+    // registers a caster and returns the faces it overlaps. version changes whenever the caster's
+    // geometry changes without its transform changing (e.g. new instance data).
+    uint8_t addCaster(uint32_t id, const AABB& worldBounds, const glm::mat4& transform, uint64_t version = 0)
+    {
+        uint8_t overlapped = 0;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            if (!faces[face].intersects(worldBounds))
+                continue;
+            overlapped |= 1 << face;
+            uint64_t signature = hash(signatures[face], &id, sizeof(id));
+            signature = hash(signature, glm::value_ptr(transform), sizeof(glm::mat4));
+            signatures[face] = hash(signature, &version, sizeof(version));
+        }
+        frame.culled += FACE_COUNT - bitCount(overlapped);
+        return overlapped;
+    }
+
+    // after all casters are added: the faces that must be cleared and redrawn this frame
+    uint8_t endCasters()
+    {
+        dirty = 0;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            if (!valid || signatures[face] != lastSignatures[face])
+                dirty |= 1 << face;
+            lastSignatures[face] = signatures[face];
+        }
+        valid = true;
+        frame.facesRendered += bitCount(dirty);
+        return dirty;
+    }
+
+    // the faces a caster with the given overlap mask is drawn into this frame
+    uint8_t drawMask(uint8_t overlapped)
+    {
+        uint8_t mask = overlapped & dirty;
+        frame.faceDraws += bitCount(mask);
+        frame.cached += bitCount(overlapped) - bitCount(mask);
+        return mask;
+    }
+
+    // forget the cached faces, e.g. after the shadow map was reallocated or drawn to by other code
+    void invalidate()
+    {
+        valid = false;
+    }
+
+    // counters of the last finished frame
+    Stats getLastFrameStats() const
+    {
+        return lastFrame;
+    }
+
+    void printStats() const
+    {
+        if (frames == 0)
+            return;
+        std::cout << "Shadow faces per frame: " << double(total.facesRendered) / frames << " of " << FACE_COUNT << " rendered, "
+            << double(total.faceDraws) / frames << " face draws, " << double(total.culled) / frames << " culled, "
+            << double(total.cached) / frames << " cached (" << frames << " frames)" << std::endl;
+    }
+
+private:
+    static const uint64_t FNV_OFFSET = 1469598103934665603ull;
+
+    Frustum faces[FACE_COUNT];
+    uint64_t signatures[FACE_COUNT] = {};
+    uint64_t lastSignatures[FACE_COUNT] = {};
+    bool valid = false;
+    uint8_t dirty = 0;
+    Stats frame, lastFrame, total;
+    uint64_t frames = 0;
+
+    // FNV-1a
+    static uint64_t hash(uint64_t seed, const void* bytes, size_t size)
+    {
+        const unsigned char* data = static_cast<const unsigned char*>(bytes);
+        for (size_t i = 0; i < size; i++)
+        {
+            seed ^= data[i];
+            seed *= 1099511628211ull;
+        }
+        return seed;
+    }
+
+    static int bitCount(uint8_t mask)
+    {
+        int count = 0;
+        for (; mask != 0; mask &= mask - 1)
+            count++;
+        return count;
+    }
+};
+#endif
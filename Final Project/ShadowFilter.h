@@ -0,0 +1,107 @@
+#ifndef SHADOW_FILTER_H
+#define SHADOW_FILTER_H
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "ShaderVariants.h"
+
+#include <string>
+
+enum ShadowQuality {
+    SHADOW_QUALITY_HARD,        // 1 tap
+    SHADOW_QUALITY_LOW,         // 4 taps
+    SHADOW_QUALITY_MEDIUM,      // 8 taps
+    SHADOW_QUALITY_HIGH,        // 20 taps, the original kernel
+    SHADOW_QUALITY_COUNT
+};
+
+// Percentage closer filtering of the point light's shadow cube map.
+// The cube map is sampled through a samplerCubeShadow with hardware depth compares and linear filtering,
+// so every tap already returns the lit fraction of a 2x2 texel footprint. The quality tier picks how many
+// taps main.fsh takes around the light direction. With the early-out on, the 8 and 20 tap kernels first
+// take the 4 probe taps, and if those agree (fully lit or fully shadowed) the rest of the kernel is skipped;
+// only fragments near a shadow edge pay for all taps.
+class ShadowFilter
+{
+public:
+    static const int PROBE_TAPS = 4;
+
+    explicit ShadowFilter(ShadowQuality quality = SHADOW_QUALITY_HIGH, bool earlyOut = true)
+        : tier(quality), probes(earlyOut)
+    {
+    }
+
+    // number of taps of a tier
+    static int taps(ShadowQuality quality)
+    {
+        static const int tapCounts[SHADOW_QUALITY_COUNT] = { 1, 4, 8, 20 };
+        return quality < SHADOW_QUALITY_COUNT ? tapCounts[quality] : tapCounts[SHADOW_QUALITY_HIGH];
+    }
+
+    // parses a tier given by its tap count
+    static bool parseQuality(const std::string& text, ShadowQuality& quality)
+    {
+        for (int i = 0; i < SHADOW_QUALITY_COUNT; i++)
+        {
+            if (text == std::to_string(taps(ShadowQuality(i))))
+            {
+                quality = ShadowQuality(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // sets up a depth cube map for filtered depth compares: a tap passes where the reference (the
+    // fragment's distance to the light over the far plane) is at most the stored depth
+    static void configure(GLuint cubeMap)
+    {
+        GLState::instance().bindTextureForUpdate(GL_TEXTURE_CUBE_MAP, cubeMap);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+
+    ShadowQuality quality() const
+    {
+        return tier;
+    }
+
+    void setQuality(ShadowQuality quality)
+    {
+        tier = quality;
+    }
+
+    // steps to the next tier, from 20 taps back to 1
+    void cycleQuality()
+    {
+        tier = ShadowQuality((tier + 1) % SHADOW_QUALITY_COUNT);
+    }
+
+    bool earlyOut() const
+    {
+        return probes;
+    }
+
+    void setEarlyOut(bool enabled)
+    {
+        probes = enabled;
+    }
+
+    // the shader features of the lit programs for this filter (see ShaderVariants). Only kernels past the
+    // probe taps have an early-out, so the smaller ones share a variant either way.
+    uint32_t features() const
+    {
+        uint32_t features = ShaderVariants::shadowTapsFeature(taps(tier));
+        if (probes && taps(tier) > PROBE_TAPS)
+            features |= SHADER_FEATURE_SHADOW_EARLY_OUT;
+        return features;
+    }
+
+private:
+    ShadowQuality tier;
+    bool probes;
+};
+#endif
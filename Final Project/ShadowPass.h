@@ -0,0 +1,352 @@
+#ifndef SHADOW_PASS_H
+#define SHADOW_PASS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLCapabilities.h"
+#include "GpuCulling.h"
+#include "InstanceBuffer.h"
+#include "Model.h"
+#include "Shader.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum ShadowBackend {
+    SHADOW_BACKEND_GEOMETRY_SHADER,     // one draw per caster, shadow.gsh copies every triangle into its faces (reference)
+    SHADOW_BACKEND_LAYERED,             // one instanced draw per caster with one instance per face, gl_Layer set in the vertex shader
+    SHADOW_BACKEND_SIX_PASS,            // every face attached and drawn on its own, one draw per caster and face
+    SHADOW_BACKEND_COUNT
+};
+
+// Renders the omnidirectional shadow cube map with one of the shadow back-ends.
+// Casters are collected for the frame with the faces they are drawn into (see ShadowFaceCache), then
+// render() clears the requested faces and draws them the back-end's way. The face matrices, the light
+// position and the far plane come from the ShadowData uniform block (see UniformBlocks.h). The layered back-end needs
+// ARB_shader_viewport_layer_array or AMD_vertex_shader_layer; without either it falls back to six passes.
+// Casters culled on the GPU (see GpuCulling) are drawn face by face whatever the back-end, one multi-draw
+// per mesh and face, since each face has its own visible list.
+class ShadowPass
+{
+public:
+    static const int FACE_COUNT = 6;
+
+    // builds the back-end's programs in batch if one is given (see ShaderBatch), right away otherwise, and the
+    // program of the GPU culled casters if there are going to be any
+    explicit ShadowPass(ShadowBackend requested, ShaderBatch* batch = nullptr, bool gpuCulledCasters = false)
+    {
+        mode = requested;
+        if (!supported(mode))
+        {
+            std::cout << "Shadow back-end " << name(mode) << " is not supported, using " << name(SHADOW_BACKEND_SIX_PASS) << std::endl;
+            mode = SHADOW_BACKEND_SIX_PASS;
+        }
+
+        switch (mode)
+        {
+        case SHADOW_BACKEND_GEOMETRY_SHADER:
+            casterShader.reset(new Shader("shadow.vsh", "shadow.fsh", "shadow.gsh", batch));
+            instancedShader.reset(new Shader("shadow_instanced.vsh", "shadow.fsh", "shadow.gsh", batch));
+            break;
+        case SHADOW_BACKEND_LAYERED:
+            casterShader.reset(new Shader("shadow_layered.vsh", "shadow.fsh", batch));
+            instancedShader.reset(new Shader("shadow_instanced_layered.vsh", "shadow.fsh", batch));
+            break;
+        default:
+            casterShader.reset(new Shader("shadow_face.vsh", "shadow.fsh", batch));
+            instancedShader.reset(new Shader("shadow_instanced_face.vsh", "shadow.fsh", batch));
+            break;
+        }
+        if (gpuCulledCasters)
+            indirectShader.reset(new Shader("shadow_instanced_face.vsh", "shadow.fsh", ShaderDefines{ { "INDIRECT_INSTANCES", "" } }, batch));
+    }
+
+    ShadowBackend backend() const
+    {
+        return mode;
+    }
+
+    static const char* name(ShadowBackend backend)
+    {
+        switch (backend)
+        {
+        case SHADOW_BACKEND_GEOMETRY_SHADER: return "gs";
+        case SHADOW_BACKEND_LAYERED: return "layered";
+        case SHADOW_BACKEND_SIX_PASS: return "six-pass";
+        default: return "unknown";
+        }
+    }
+
+    // parses a back-end name as printed by name()
+    static bool parseBackend(const std::string& text, ShadowBackend& backend)
+    {
+        for (int i = 0; i < SHADOW_BACKEND_COUNT; i++)
+        {
+            if (text == name(ShadowBackend(i)))
+            {
+                backend = ShadowBackend(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // whether the current context can run a back-end
+    static bool supported(ShadowBackend backend)
+    {
+        if (backend == SHADOW_BACKEND_LAYERED)
+            return GLCapabilities::hasExtension("GL_ARB_shader_viewport_layer_array") || GLCapabilities::hasExtension("GL_AMD_vertex_shader_layer");
+        return backend < SHADOW_BACKEND_COUNT;
+    }
+
+    // view projection matrices of the six cube faces of a point light, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+    static void faceMatrices(const glm::vec3& lightPos, float nearPlane, float farPlane, glm::mat4* out)
+    {
+        static const glm::vec3 directions[FACE_COUNT] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+        };
+        static const glm::vec3 ups[FACE_COUNT] = {
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+            glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+        };
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+        for (int face = 0; face < FACE_COUNT; face++)
+            out[face] = projection * glm::lookAt(lightPos, lightPos + directions[face], ups[face]);
+    }
+
+    // starts the frame's caster list
+    void begin()
+    {
+        casters.clear();
+        indirectCasters.clear();
+    }
+
+    // a model drawn with a model matrix into the faces in the mask, at the level of detail of the
+    // detail scale (see LevelOfDetail; measured from the light, in shadow map texels)
+    void addCaster(Model& model, const glm::mat4& modelMatrix, uint8_t faces, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (faces != 0)
+            casters.push_back({ &model, modelMatrix, nullptr, faces, detailScale });
+    }
+
+    // a model drawn once per instance of the buffer into the faces in the mask
+    void addCaster(Model& model, const InstanceBuffer& instances, uint8_t faces, float detailScale = LevelOfDetail::FULL_DETAIL)
+    {
+        if (faces != 0 && instances.count() > 0)
+            casters.push_back({ &model, glm::mat4(1.0f), &instances, faces, detailScale });
+    }
+
+    // a model whose instances culling.cull() culled for the faces in the mask (views GpuCulling::VIEW_FIRST_FACE
+    // and on). The pass must have been built for GPU culled casters.
+    void addCaster(Model& model, GpuCulling& culling, uint8_t faces)
+    {
+        if (faces == 0 || !indirectShader)
+            return;
+        indirectCasters.push_back({ &model, &culling, faces });
+    }
+
+    // clears the faces of clearFaces and draws the casters. The shadow framebuffer must be bound, with the
+    // whole cube map attached as its depth attachment, and it is left that way; the frame's ShadowData block
+    // must be bound too.
+    void render(GLuint cubeMap, uint8_t clearFaces)
+    {
+        drawCalls = 0;
+        if (mode == SHADOW_BACKEND_SIX_PASS)
+        {
+            renderSixPass(cubeMap, clearFaces);
+            return;
+        }
+
+        clear(cubeMap, clearFaces);
+        for (const Caster& caster : casters)
+        {
+            if (mode == SHADOW_BACKEND_GEOMETRY_SHADER)
+                drawGeometryShader(caster);
+            else
+                drawLayered(caster);
+        }
+        if (indirectCasters.empty())
+            return;
+
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            if (!hasIndirectCaster(face))
+                continue;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubeMap, 0);
+            drawIndirect(face);
+        }
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+    }
+
+    // draw calls issued by the last render(), counting every mesh
+    size_t lastDrawCalls() const
+    {
+        return drawCalls;
+    }
+
+    void clean()
+    {
+        casterShader->clean();
+        instancedShader->clean();
+        if (indirectShader)
+            indirectShader->clean();
+    }
+
+private:
+    struct Caster {
+        Model* model;
+        glm::mat4 modelMatrix;
+        const InstanceBuffer* instances;    // null for a single copy at modelMatrix
+        uint8_t faces;
+        float detailScale;
+    };
+
+    struct IndirectCaster {
+        Model* model;
+        GpuCulling* culling;
+        uint8_t faces;
+    };
+
+    static constexpr UniformId modelMatrixUniform = UniformId("modelMatrix");
+    static constexpr UniformId shadowFaceUniform = UniformId("shadowFace");
+    static constexpr UniformId culledFacesUniform = UniformId("culledFaces");
+    static constexpr UniformId layerCountUniform = UniformId("layerCount");
+    static constexpr UniformId layerFacesUniforms[FACE_COUNT] = {
+        UniformId("layerFaces[0]"), UniformId("layerFaces[1]"), UniformId("layerFaces[2]"),
+        UniformId("layerFaces[3]"), UniformId("layerFaces[4]"), UniformId("layerFaces[5]")
+    };
+
+    ShadowBackend mode;
+    std::unique_ptr<Shader> casterShader;       // single copies
+    std::unique_ptr<Shader> instancedShader;    // instance buffers
+    std::unique_ptr<Shader> indirectShader;     // GPU culled instances, one face at a time
+    std::vector<Caster> casters;
+    std::vector<IndirectCaster> indirectCasters;
+    size_t drawCalls = 0;
+
+    static bool hasFace(uint8_t faces, int face)
+    {
+        return (faces & (1 << face)) != 0;
+    }
+
+    // clears the faces of the layered attachment, all at once if possible
+    static void clear(GLuint cubeMap, uint8_t faces)
+    {
+        if (faces == (1 << FACE_COUNT) - 1)
+        {
+            glClear(GL_DEPTH_BUFFER_BIT);
+            return;
+        }
+        if (faces == 0)
+            return;
+
+        // attach the faces one at a time to clear only them
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            if (!hasFace(faces, face))
+                continue;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubeMap, 0);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+    }
+
+    void drawGeometryShader(const Caster& caster)
+    {
+        Shader& shader = caster.instances != nullptr ? *instancedShader : *casterShader;
+        shader.use();
+        shader.setInt(culledFacesUniform, ((1 << FACE_COUNT) - 1) & ~caster.faces);
+        draw(shader, caster, 1);
+    }
+
+    // one instance per face, the vertex shader routes instance i to face layerFaces[i]
+    void drawLayered(const Caster& caster)
+    {
+        Shader& shader = caster.instances != nullptr ? *instancedShader : *casterShader;
+        shader.use();
+        GLuint layerCount = 0;
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            if (hasFace(caster.faces, face))
+                shader.setInt(layerFacesUniforms[layerCount++], face);
+        }
+        shader.setInt(layerCountUniform, GLint(layerCount));
+        draw(shader, caster, layerCount);
+    }
+
+    // face by face: attach, clear if requested, draw the casters of that face
+    void renderSixPass(GLuint cubeMap, uint8_t clearFaces)
+    {
+        for (int face = 0; face < FACE_COUNT; face++)
+        {
+            bool drawn = hasIndirectCaster(face);
+            for (const Caster& caster : casters)
+                drawn = drawn || hasFace(caster.faces, face);
+            if (!drawn && !hasFace(clearFaces, face))
+                continue;
+
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubeMap, 0);
+            if (hasFace(clearFaces, face))
+                glClear(GL_DEPTH_BUFFER_BIT);
+
+            for (const Caster& caster : casters)
+            {
+                if (!hasFace(caster.faces, face))
+                    continue;
+                Shader& shader = caster.instances != nullptr ? *instancedShader : *casterShader;
+                shader.use();
+                shader.setInt(shadowFaceUniform, face);
+                draw(shader, caster, 1);
+            }
+            drawIndirect(face);
+        }
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+    }
+
+    bool hasIndirectCaster(int face) const
+    {
+        for (const IndirectCaster& caster : indirectCasters)
+        {
+            if (hasFace(caster.faces, face))
+                return true;
+        }
+        return false;
+    }
+
+    // draws the GPU culled casters of a face into the attached face
+    void drawIndirect(int face)
+    {
+        for (const IndirectCaster& caster : indirectCasters)
+        {
+            if (!hasFace(caster.faces, face))
+                continue;
+            indirectShader->use();
+            indirectShader->setInt(shadowFaceUniform, face);
+            caster.model->DrawIndirect(*indirectShader, *caster.culling, GpuCulling::VIEW_FIRST_FACE + face);
+            drawCalls += caster.model->meshes.size();
+        }
+    }
+
+    // draws a caster with copies draws per instance (1 unless it is drawn layered)
+    void draw(Shader& shader, const Caster& caster, GLuint copies)
+    {
+        if (caster.instances != nullptr)
+            caster.model->DrawInstanced(shader, *caster.instances, copies, caster.detailScale);
+        else
+        {
+            shader.setMat4(modelMatrixUniform, caster.modelMatrix);
+            if (mode == SHADOW_BACKEND_LAYERED)
+                caster.model->DrawCopies(shader, GLsizei(copies), caster.detailScale);
+            else
+                caster.model->Draw(shader, caster.detailScale);
+        }
+        drawCalls += caster.model->meshes.size();
+    }
+};
+#endif
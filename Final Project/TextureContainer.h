@@ -0,0 +1,575 @@
+#ifndef TEXTURE_CONTAINER_H
+#define TEXTURE_CONTAINER_H
+
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include "GLState.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Pre-baked texture container (*.gtex).
+// Stores a texture together with its whole mip chain, either as plain 8 bit texels or block compressed
+// (BC1 for opaque colour, BC3 for colour with alpha, BC5 for two channel data such as normal maps).
+// The runtime loader hands every level straight to OpenGL: no image decode and no glGenerateMipmap.
+//
+// File layout (little endian):
+//   TextureContainerHeader
+//   TextureContainerLevel[levelCount]
+//   level data, each level starting on an 8 byte boundary
+namespace TextureContainer
+{
+    // bump whenever the layout or the encoders change
+    const uint32_t VERSION = 1;
+    const char MAGIC[4] = { 'G', 'T', 'E', 'X' };
+
+    enum Format : uint32_t {
+        FORMAT_R8 = 0,
+        FORMAT_RGB8,
+        FORMAT_RGBA8,
+        FORMAT_BC1,
+        FORMAT_BC3,
+        FORMAT_BC5
+    };
+
+    enum Compression {
+        COMPRESS_NONE,  // keep 8 bit texels
+        COMPRESS_COLOR, // BC1, or BC3 when the image has alpha
+        COMPRESS_RG     // BC5 (red and green channels only)
+    };
+
+    struct TextureContainerHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t format;
+        uint32_t width, height;
+        uint32_t levelCount;
+        uint64_t sourceStamp;   // size and write time of the source image
+    };
+
+    struct TextureContainerLevel {
+        uint64_t offset, size;  // from the start of the file
+        uint32_t width, height;
+    };
+
+    // a container read back into memory, ready for upload
+    struct BakedTexture {
+        Format format = FORMAT_RGBA8;
+        uint32_t width = 0, height = 0;
+        std::vector<TextureContainerLevel> levels;  // offsets are relative to data
+        std::vector<unsigned char> data;
+    };
+
+    // container that belongs to a source image, e.g. textures/material_baseColor.png -> textures/material_baseColor.gtex
+    inline std::string containerPathFor(const std::string& imagePath)
+    {
+        std::string::size_type dot = imagePath.find_last_of('.');
+        std::string::size_type slash = imagePath.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return imagePath + ".gtex";
+        return imagePath.substr(0, dot) + ".gtex";
+    }
+
+    inline uint64_t sourceStamp(const std::string& imagePath)
+    {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(imagePath, ec);
+        if (ec)
+            return 0;
+        auto time = std::filesystem::last_write_time(imagePath, ec);
+        if (ec)
+            return 0;
+        return (uint64_t(size) * 1099511628211ull) ^ uint64_t(time.time_since_epoch().count());
+    }
+
+    inline bool isCompressed(Format format)
+    {
+        return format == FORMAT_BC1 || format == FORMAT_BC3 || format == FORMAT_BC5;
+    }
+
+    inline size_t levelSize(Format format, uint32_t width, uint32_t height)
+    {
+        size_t blocks = size_t((width + 3) / 4) * ((height + 3) / 4);
+        switch (format)
+        {
+        case FORMAT_R8: return size_t(width) * height;
+        case FORMAT_RGB8: return size_t(width) * height * 3;
+        case FORMAT_RGBA8: return size_t(width) * height * 4;
+        case FORMAT_BC1: return blocks * 8;
+        case FORMAT_BC3:
+        case FORMAT_BC5: return blocks * 16;
+        }
+        return 0;
+    }
+
+    // --- CPU block encoders ---
+
+    // BC4 block (also the alpha half of BC3 and each half of BC5): two 8 bit endpoints and 16 3-bit indices
+    // into the 8 value ramp between them.
+    inline void encodeBC4Block(const unsigned char values[16], unsigned char* out)
+    {
+        unsigned char high = values[0], low = values[0];
+        for (int i = 1; i < 16; i++)
+        {
+            high = std::max(high, values[i]);
+            low = std::min(low, values[i]);
+        }
+
+        out[0] = high;
+        out[1] = low;
+        uint64_t bits = 0;
+        if (high != low)
+        {
+            int ramp[8];
+            ramp[0] = high;
+            ramp[1] = low;
+            for (int i = 2; i < 8; i++)
+                ramp[i] = ((8 - i) * high + (i - 1) * low) / 7;
+
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestError = 256;
+                for (int j = 0; j < 8; j++)
+                {
+                    int error = std::abs(ramp[j] - values[i]);
+                    if (error < bestError)
+                    {
+                        best = j;
+                        bestError = error;
+                    }
+                }
+                bits |= uint64_t(best) << (3 * i);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+
+    inline uint16_t packRGB565(const float color[3])
+    {
+        int r = std::clamp(int(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+        int g = std::clamp(int(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+        int b = std::clamp(int(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpackRGB565(uint16_t packed, int color[3])
+    {
+        color[0] = ((packed >> 11) & 31) * 255 / 31;
+        color[1] = ((packed >> 5) & 63) * 255 / 63;
+        color[2] = (packed & 31) * 255 / 31;
+    }
+
+    // BC1 block: endpoints are the extremes of the block's colours along their principal axis,
+    // every texel then picks the nearest of the four colours on the ramp between them.
+    inline void encodeBC1Block(const unsigned char rgba[16 * 4], unsigned char* out)
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                mean[c] += rgba[i * 4 + c] / 16.0f;
+
+        float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+        {
+            float r = rgba[i * 4 + 0] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+            covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+            covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+        }
+
+        // a few power iterations are plenty to find the dominant axis of a 3x3 covariance matrix
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+        }
+
+        float minProjection = 1e30f, maxProjection = -1e30f;
+        for (int i = 0; i < 16; i++)
+        {
+            float projection = (rgba[i * 4 + 0] - mean[0]) * axis[0] + (rgba[i * 4 + 1] - mean[1]) * axis[1] + (rgba[i * 4 + 2] - mean[2]) * axis[2];
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+        float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float end0[3], end1[3];
+        for (int c = 0; c < 3; c++)
+        {
+            end0[c] = mean[c] + axis[c] * maxProjection / std::max(axisLengthSquared, 1e-6f);
+            end1[c] = mean[c] + axis[c] * minProjection / std::max(axisLengthSquared, 1e-6f);
+        }
+
+        uint16_t color0 = packRGB565(end0);
+        uint16_t color1 = packRGB565(end1);
+        // color0 > color1 selects the opaque four colour mode
+        if (color0 < color1)
+            std::swap(color0, color1);
+
+        uint32_t bits = 0;
+        if (color0 != color1)
+        {
+            int palette[4][3];
+            unpackRGB565(color0, palette[0]);
+            unpackRGB565(color1, palette[1]);
+            for (int c = 0; c < 3; c++)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestError = 1 << 30;
+                for (int j = 0; j < 4; j++)
+                {
+                    int dr = palette[j][0] - rgba[i * 4 + 0], dg = palette[j][1] - rgba[i * 4 + 1], db = palette[j][2] - rgba[i * 4 + 2];
+                    int error = dr * dr + dg * dg + db * db;
+                    if (error < bestError)
+                    {
+                        best = j;
+                        bestError = error;
+                    }
+                }
+                bits |= uint32_t(best) << (2 * i);
+            }
+        }
+
+        out[0] = static_cast<unsigned char>(color0);
+        out[1] = static_cast<unsigned char>(color0 >> 8);
+        out[2] = static_cast<unsigned char>(color1);
+        out[3] = static_cast<unsigned char>(color1 >> 8);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+
+    // compresses one RGBA8 level into BC1/BC3/BC5 blocks. Edge blocks repeat the last row/column.
+    inline std::vector<unsigned char> compressLevel(const std::vector<unsigned char>& rgba, uint32_t width, uint32_t height, Format format)
+    {
+        std::vector<unsigned char> out(levelSize(format, width, height));
+        unsigned char* block = out.data();
+        for (uint32_t by = 0; by < height; by += 4)
+        {
+            for (uint32_t bx = 0; bx < width; bx += 4)
+            {
+                unsigned char texels[16 * 4];
+                for (uint32_t y = 0; y < 4; y++)
+                {
+                    for (uint32_t x = 0; x < 4; x++)
+                    {
+                        uint32_t sx = std::min(bx + x, width - 1), sy = std::min(by + y, height - 1);
+                        std::memcpy(&texels[(y * 4 + x) * 4], &rgba[(size_t(sy) * width + sx) * 4], 4);
+                    }
+                }
+
+                if (format == FORMAT_BC1)
+                {
+                    encodeBC1Block(texels, block);
+                    block += 8;
+                }
+                else if (format == FORMAT_BC3)
+                {
+                    unsigned char alpha[16];
+                    for (int i = 0; i < 16; i++)
+                        alpha[i] = texels[i * 4 + 3];
+                    encodeBC4Block(alpha, block);
+                    encodeBC1Block(texels, block + 8);
+                    block += 16;
+                }
+                else
+                {
+                    unsigned char red[16], green[16];
+                    for (int i = 0; i < 16; i++)
+                    {
+                        red[i] = texels[i * 4 + 0];
+                        green[i] = texels[i * 4 + 1];
+                    }
+                    encodeBC4Block(red, block);
+                    encodeBC4Block(green, block + 8);
+                    block += 16;
+                }
+            }
+        }
+        return out;
+    }
+
+    // next mip level with a 2x2 box filter (odd edges reuse the last texel)
+    inline std::vector<unsigned char> downsample(const std::vector<unsigned char>& pixels, uint32_t width, uint32_t height, int components)
+    {
+        uint32_t newWidth = std::max(1u, width / 2), newHeight = std::max(1u, height / 2);
+        std::vector<unsigned char> out(size_t(newWidth) * newHeight * components);
+        for (uint32_t y = 0; y < newHeight; y++)
+        {
+            uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+            for (uint32_t x = 0; x < newWidth; x++)
+            {
+                uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                for (int c = 0; c < components; c++)
+                {
+                    int sum = pixels[(size_t(y0) * width + x0) * components + c] + pixels[(size_t(y0) * width + x1) * components + c]
+                        + pixels[(size_t(y1) * width + x0) * components + c] + pixels[(size_t(y1) * width + x1) * components + c];
+                    out[(size_t(y) * newWidth + x) * components + c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+        return out;
+    }
+
+    // offline bake: decodes the source image once, builds the full mip chain and (optionally) block compresses it.
+    inline bool bake(const std::string& imagePath, Compression compression)
+    {
+        // the block encoders work on four channels, single channel images stay R8
+        int width, height, components;
+        if (!stbi_info(imagePath.c_str(), &width, &height, &components))
+        {
+            std::cout << "Texture failed to load at path: " << imagePath << std::endl;
+            return false;
+        }
+        int workComponents = 3;
+        if (components == 1)
+            workComponents = 1;
+        else if (compression != COMPRESS_NONE || components == 2 || components == 4)
+            workComponents = 4;
+
+        unsigned char* data = stbi_load(imagePath.c_str(), &width, &height, &components, workComponents);
+        if (data == nullptr)
+        {
+            std::cout << "Texture failed to load at path: " << imagePath << std::endl;
+            return false;
+        }
+        std::vector<unsigned char> level(data, data + size_t(width) * height * workComponents);
+        stbi_image_free(data);
+
+        bool hasAlpha = false;
+        if (workComponents == 4)
+            for (size_t i = 0; i < size_t(width) * height && !hasAlpha; i++)
+                hasAlpha = level[i * 4 + 3] != 255;
+
+        Format format;
+        if (workComponents == 1)
+            format = FORMAT_R8;
+        else if (compression == COMPRESS_RG)
+            format = FORMAT_BC5;
+        else if (compression == COMPRESS_COLOR)
+            format = hasAlpha ? FORMAT_BC3 : FORMAT_BC1;
+        else
+            format = workComponents == 3 ? FORMAT_RGB8 : FORMAT_RGBA8;
+
+        std::vector<TextureContainerLevel> levels;
+        std::vector<std::vector<unsigned char>> levelData;
+        uint32_t levelWidth = width, levelHeight = height;
+        for (;;)
+        {
+            levelData.push_back(isCompressed(format) ? compressLevel(level, levelWidth, levelHeight, format) : level);
+            TextureContainerLevel entry;
+            entry.offset = 0;
+            entry.size = levelData.back().size();
+            entry.width = levelWidth;
+            entry.height = levelHeight;
+            levels.push_back(entry);
+
+            if (levelWidth == 1 && levelHeight == 1)
+                break;
+            level = downsample(level, levelWidth, levelHeight, workComponents);
+            levelWidth = std::max(1u, levelWidth / 2);
+            levelHeight = std::max(1u, levelHeight / 2);
+        }
+
+        TextureContainerHeader header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.format = format;
+        header.width = width;
+        header.height = height;
+        header.levelCount = static_cast<uint32_t>(levels.size());
+        header.sourceStamp = sourceStamp(imagePath);
+
+        uint64_t offset = alignTo8(sizeof(header) + levels.size() * sizeof(TextureContainerLevel));
+        for (TextureContainerLevel& entry : levels)
+        {
+            entry.offset = offset;
+            offset = alignTo8(offset + entry.size);
+        }
+
+        std::string containerPath = containerPathFor(imagePath);
+        std::string tempPath = containerPath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+            const char padding[8] = {};
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(levels.data()), static_cast<std::streamsize>(levels.size() * sizeof(TextureContainerLevel)));
+            uint64_t headerBytes = sizeof(header) + levels.size() * sizeof(TextureContainerLevel);
+            out.write(padding, static_cast<std::streamsize>(alignTo8(headerBytes) - headerBytes));
+            for (size_t i = 0; i < levels.size(); i++)
+            {
+                out.write(reinterpret_cast<const char*>(levelData[i].data()), static_cast<std::streamsize>(levelData[i].size()));
+                out.write(padding, static_cast<std::streamsize>(alignTo8(levels[i].size) - levels[i].size));
+            }
+            if (!out)
+                return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tempPath, containerPath, ec);
+        return !ec;
+    }
+
+    // reads a container into memory. Returns false if it is missing, corrupt or older than its source image.
+    // Does not touch OpenGL, so it is safe to call from a worker thread.
+    inline bool read(const std::string& imagePath, BakedTexture& texture)
+    {
+        uint64_t stamp = sourceStamp(imagePath);
+        if (stamp == 0)
+            return false;
+
+        MappedFile file(containerPathFor(imagePath));
+        if (file.data == nullptr || file.size < sizeof(TextureContainerHeader))
+            return false;
+
+        TextureContainerHeader header;
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+            || header.format > FORMAT_BC5 || header.sourceStamp != stamp || header.levelCount == 0
+            || sizeof(header) + uint64_t(header.levelCount) * sizeof(TextureContainerLevel) > file.size)
+            return false;
+
+        const TextureContainerLevel* levels = reinterpret_cast<const TextureContainerLevel*>(file.data + sizeof(header));
+        uint64_t dataStart = alignTo8(sizeof(header) + uint64_t(header.levelCount) * sizeof(TextureContainerLevel));
+        if (levels[0].offset != dataStart)
+            return false;
+
+        // every level must lie inside the file, or a truncated container would be read past its end
+        uint64_t dataEnd = dataStart;
+        for (uint32_t i = 0; i < header.levelCount; i++)
+        {
+            const TextureContainerLevel& level = levels[i];
+            if (level.offset < dataStart || level.size > file.size || level.offset > file.size - level.size)
+                return false;
+            dataEnd = std::max(dataEnd, level.offset + level.size);
+        }
+
+        texture.format = static_cast<Format>(header.format);
+        texture.width = header.width;
+        texture.height = header.height;
+        texture.levels.assign(levels, levels + header.levelCount);
+        for (TextureContainerLevel& level : texture.levels)
+        {
+            if (level.size != levelSize(texture.format, level.width, level.height))
+                return false;
+            level.offset -= dataStart;
+        }
+        texture.data.assign(file.data + dataStart, file.data + dataEnd);
+        return true;
+    }
+
+    inline bool hasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (extension != nullptr && std::strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // whether the driver can sample the given format. BC5 (RGTC) is core, BC1/BC3 need S3TC.
+    inline bool isSupported(Format format)
+    {
+        if (format != FORMAT_BC1 && format != FORMAT_BC3)
+            return true;
+        static const bool s3tc = hasExtension("GL_EXT_texture_compression_s3tc");
+        return s3tc;
+    }
+
+    // uploads every stored level into the texture. Returns false when the driver lacks the format,
+    // in which case the caller should fall back to decoding the source image.
+    inline bool upload(GLuint textureID, const BakedTexture& texture)
+    {
+        if (!isSupported(texture.format))
+            return false;
+
+        GLenum internalFormat = GL_RGBA8, format = GL_RGBA;
+        switch (texture.format)
+        {
+        case FORMAT_R8: internalFormat = GL_R8; format = GL_RED; break;
+        case FORMAT_RGB8: internalFormat = GL_RGB8; format = GL_RGB; break;
+        case FORMAT_RGBA8: internalFormat = GL_RGBA8; format = GL_RGBA; break;
+        case FORMAT_BC1: internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+        case FORMAT_BC3: internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+        case FORMAT_BC5: internalFormat = GL_COMPRESSED_RG_RGTC2; break;
+        }
+
+        GLState::instance().bindTextureForUpdate(GL_TEXTURE_2D, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < texture.levels.size(); i++)
+        {
+            const TextureContainerLevel& level = texture.levels[i];
+            const unsigned char* pixels = texture.data.data() + level.offset;
+            if (isCompressed(texture.format))
+                glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), internalFormat, level.width, level.height, 0, GLsizei(level.size), pixels);
+            else
+                glTexImage2D(GL_TEXTURE_2D, GLint(i), internalFormat, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(texture.levels.size() - 1));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return true;
+    }
+
+    // bytes of texture memory the container occupies once uploaded (all levels)
+    inline size_t gpuBytes(const BakedTexture& texture)
+    {
+        size_t total = 0;
+        for (const TextureContainerLevel& level : texture.levels)
+            total += levelSize(texture.format, level.width, level.height);
+        return total;
+    }
+
+    // estimated bytes of an 8 bit texture with a full mip chain as the stb_image path uploads it.
+    // RGB8 is counted at 4 bytes per texel since that's how drivers store it, and the mips add a third.
+    inline size_t mippedTextureBytes(int width, int height, int components)
+    {
+        return size_t(width) * height * (components == 3 ? 4 : components) * 4 / 3;
+    }
+
+    // compression that suits a material texture slot
+    inline Compression compressionFor(const std::string& textureType)
+    {
+        return textureType == "texture_normal" ? COMPRESS_RG : COMPRESS_COLOR;
+    }
+}
+#endif
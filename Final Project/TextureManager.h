@@ -0,0 +1,391 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include "AssetLoader.h"
+#include "GLState.h"
+#include "TextureContainer.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <list>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+GLuint TextureFromFile(const char* path, const std::string& directory, bool gamma = false, size_t* gpuBytes = nullptr);
+
+class TextureManager;
+
+// Reference counted handle to a texture owned by the TextureManager.
+// The texture stays resident while at least one handle refers to it; once the last handle is gone
+// it becomes a candidate for eviction but stays cached until the memory budget needs the space.
+class TextureHandle
+{
+public:
+    TextureHandle() = default;
+    TextureHandle(const TextureHandle& other);
+    TextureHandle(TextureHandle&& other) noexcept;
+    TextureHandle& operator=(TextureHandle other) noexcept;
+    ~TextureHandle();
+
+    // OpenGL texture name, 0 for an empty handle
+    GLuint id() const;
+
+    explicit operator bool() const
+    {
+        return manager != nullptr;
+    }
+
+private:
+    friend class TextureManager;
+
+    TextureHandle(TextureManager* manager, uint32_t slot) : manager(manager), slot(slot) {}
+
+    TextureManager* manager = nullptr;
+    uint32_t slot = 0;
+};
+
+// Process-wide texture cache.
+// Textures are keyed by a hash of their canonical path plus the load parameters, so every model that
+// refers to the same image shares one GL texture. Unreferenced textures are kept in LRU order and evicted
+// once the resident bytes exceed the budget. Render thread only.
+class TextureManager
+{
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t residentBytes = 0;
+        size_t residentTextures = 0;
+        size_t budgetBytes = 0;
+    };
+
+    static TextureManager& instance()
+    {
+        static TextureManager manager;
+        return manager;
+    }
+
+    TextureManager(const TextureManager&) = delete;
+    TextureManager& operator=(const TextureManager&) = delete;
+
+    // GPU memory the cache may hold before it starts evicting unreferenced textures
+    void setBudget(size_t bytes)
+    {
+        stats.budgetBytes = bytes;
+        enforceBudget();
+    }
+
+    // returns a handle to the texture at directory/path, loading it on a miss. With a loader the texture
+    // streams in asynchronously behind a placeholder, otherwise it is loaded right away.
+    TextureHandle acquire(const std::string& path, const std::string& directory, bool gamma = false, AssetLoader* loader = nullptr)
+    {
+        TextureKey key = makeKey(directory + '/' + path, gamma);
+        auto found = lookup.find(key);
+        if (found != lookup.end())
+        {
+            stats.hits++;
+            retain(found->second);
+            return TextureHandle(this, found->second);
+        }
+
+        stats.misses++;
+        uint32_t slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            slot = static_cast<uint32_t>(entries.size());
+            entries.emplace_back();
+        }
+
+        Entry& entry = entries[slot];
+        entry = Entry();
+        entry.key = key;
+        entry.refCount = 1;
+        entry.used = true;
+        if (loader != nullptr)
+        {
+            entry.pending = true;
+            entry.bytes = 4;    // 1x1 placeholder until the real image is uploaded
+            entry.id = loader->loadTexture(path.c_str(), directory, [this, slot](size_t bytes) { uploaded(slot, bytes); });
+        }
+        else
+        {
+            entry.id = TextureFromFile(path.c_str(), directory, gamma, &entry.bytes);
+        }
+        lookup[key] = slot;
+        stats.residentBytes += entry.bytes;
+        stats.residentTextures++;
+
+        enforceBudget();
+        return TextureHandle(this, slot);
+    }
+
+    GLuint id(uint32_t slot) const
+    {
+        return entries[slot].id;
+    }
+
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+    void printStats() const
+    {
+        std::cout << "Texture cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, "
+            << stats.residentTextures << " textures / " << stats.residentBytes / 1024 << " KiB resident (budget "
+            << stats.budgetBytes / (1024 * 1024) << " MiB)" << std::endl;
+    }
+
+    // deletes every texture. Call while the GL context is still current; handles released afterwards are ignored.
+    void shutdown()
+    {
+        for (Entry& entry : entries)
+        {
+            if (entry.used)
+            {
+                GLState::instance().forgetTexture(entry.id);
+                glDeleteTextures(1, &entry.id);
+            }
+        }
+        entries.clear();
+        freeSlots.clear();
+        lookup.clear();
+        unreferenced.clear();
+        stats.residentBytes = 0;
+        stats.residentTextures = 0;
+        isShutDown = true;
+    }
+
+private:
+    friend class TextureHandle;
+
+    struct TextureKey {
+        uint64_t hash;
+        std::string path;   // canonical
+        bool gamma;
+
+        bool operator==(const TextureKey& other) const
+        {
+            return hash == other.hash && gamma == other.gamma && path == other.path;
+        }
+    };
+
+    struct TextureKeyHash {
+        size_t operator()(const TextureKey& key) const
+        {
+            return static_cast<size_t>(key.hash);
+        }
+    };
+
+    struct Entry {
+        TextureKey key;
+        GLuint id = 0;
+        size_t bytes = 0;
+        uint32_t refCount = 0;
+        bool used = false;      // slot holds a texture
+        bool pending = false;   // asynchronous upload not finished yet, must not be evicted
+        bool failed = false;    // the image could not be loaded, dropped as soon as nothing refers to it
+        std::list<uint32_t>::iterator lruPosition;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<TextureKey, uint32_t, TextureKeyHash> lookup;
+    std::list<uint32_t> unreferenced;   // least recently released first
+    Stats stats;
+    bool isShutDown = false;
+
+    TextureManager()
+    {
+        stats.budgetBytes = size_t(512) * 1024 * 1024;
+    }
+
+    // FNV-1a of the canonical path and the load parameters
+    static TextureKey makeKey(const std::string& filename, bool gamma)
+    {
+        std::error_code ec;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(filename, ec);
+        TextureKey key;
+        key.path = ec ? filename : canonical.generic_string();
+        key.gamma = gamma;
+        key.hash = 14695981039346656037ull;
+        for (char c : key.path)
+        {
+            key.hash ^= static_cast<unsigned char>(c);
+            key.hash *= 1099511628211ull;
+        }
+        key.hash ^= gamma ? 1 : 0;
+        key.hash *= 1099511628211ull;
+        return key;
+    }
+
+    void retain(uint32_t slot)
+    {
+        Entry& entry = entries[slot];
+        if (entry.refCount++ == 0)
+            unreferenced.erase(entry.lruPosition);
+    }
+
+    void release(uint32_t slot)
+    {
+        if (isShutDown)
+            return;
+        Entry& entry = entries[slot];
+        if (--entry.refCount == 0)
+        {
+            entry.lruPosition = unreferenced.insert(unreferenced.end(), slot);
+            if (entry.failed)
+                evict(slot);
+            enforceBudget();
+        }
+    }
+
+    // 0 bytes means the load failed: the entry keeps its placeholder until it is released, and is then dropped
+    // rather than cached so that the next acquire tries the file again
+    void uploaded(uint32_t slot, size_t bytes)
+    {
+        if (slot >= entries.size() || !entries[slot].used)
+            return;
+        Entry& entry = entries[slot];
+        entry.pending = false;
+        if (bytes == 0)
+        {
+            entry.failed = true;
+            if (entry.refCount == 0)
+                evict(slot);
+            return;
+        }
+        stats.residentBytes = stats.residentBytes - entry.bytes + bytes;
+        entry.bytes = bytes;
+        enforceBudget();
+    }
+
+    // evicts unreferenced textures, oldest first, until the cache fits the budget
+    void enforceBudget()
+    {
+        auto it = unreferenced.begin();
+        while (stats.residentBytes > stats.budgetBytes && it != unreferenced.end())
+        {
+            uint32_t slot = *it;
+            Entry& entry = entries[slot];
+            if (entry.pending)
+            {
+                ++it;
+                continue;
+            }
+
+            ++it;
+            evict(slot);
+        }
+    }
+
+    // deletes an unreferenced texture and frees its slot
+    void evict(uint32_t slot)
+    {
+        Entry& entry = entries[slot];
+        unreferenced.erase(entry.lruPosition);
+        GLState::instance().forgetTexture(entry.id);
+        glDeleteTextures(1, &entry.id);
+        lookup.erase(entry.key);
+        stats.residentBytes -= entry.bytes;
+        stats.residentTextures--;
+        stats.evictions++;
+        entry = Entry();
+        freeSlots.push_back(slot);
+    }
+};
+
+inline TextureHandle::TextureHandle(const TextureHandle& other) : manager(other.manager), slot(other.slot)
+{
+    if (manager != nullptr)
+        manager->retain(slot);
+}
+
+inline TextureHandle::TextureHandle(TextureHandle&& other) noexcept : manager(other.manager), slot(other.slot)
+{
+    other.manager = nullptr;
+}
+
+inline TextureHandle& TextureHandle::operator=(TextureHandle other) noexcept
+{
+    std::swap(manager, other.manager);
+    std::swap(slot, other.slot);
+    return *this;
+}
+
+inline TextureHandle::~TextureHandle()
+{
+    if (manager != nullptr)
+        manager->release(slot);
+}
+
+inline GLuint TextureHandle::id() const
+{
+    return manager != nullptr ? manager->id(slot) : 0;
+}
+
+
+GLuint TextureFromFile(const char* path, const std::string& directory, bool gamma, size_t* gpuBytes)
+{
+    std::string filename = std::string(path);
+    filename = directory + '/' + filename;
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+
+    // prefer the pre-baked container: levels go straight to the GPU without a decode
+    TextureContainer::BakedTexture baked;
+    if (TextureContainer::read(filename, baked) && TextureContainer::upload(textureID, baked))
+    {
+        if (gpuBytes != nullptr)
+            *gpuBytes = TextureContainer::gpuBytes(baked);
+        return textureID;
+    }
+
+    int width, height, nrComponents;
+    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    if (data)
+    {
+        GLenum format;
+        if (nrComponents == 1)
+            format = GL_RED;
+        else if (nrComponents == 3)
+            format = GL_RGB;
+        else if (nrComponents == 4)
+            format = GL_RGBA;
+
+        GLState::instance().bindTextureForUpdate(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        if (gpuBytes != nullptr)
+            *gpuBytes = TextureContainer::mippedTextureBytes(width, height, nrComponents);
+        stbi_image_free(data);
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        stbi_image_free(data);
+    }
+
+    return textureID;
+}
+#endif
@@ -0,0 +1,192 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Per-frame data shared by every program through std140 uniform blocks (uniform_blocks.glsl).
+// Each block has a fixed binding point that Shader::ReflectUniforms attaches it to when a program is linked or
+// loaded, so programs never upload camera, light or shadow uniforms of their own. The structs below mirror
+// the GLSL blocks byte for byte: vec3s take 16 bytes unless a float fills their last 4.
+enum UniformBlockBinding : GLuint {
+    UNIFORM_BLOCK_FRAME,
+    UNIFORM_BLOCK_LIGHT,
+    UNIFORM_BLOCK_SHADOW,
+    UNIFORM_BLOCK_COUNT
+};
+
+// camera of the main pass
+struct FrameData {
+    glm::mat4 viewMatrix = glm::mat4(1.0f);
+    glm::mat4 projectionMatrix = glm::mat4(1.0f);
+    glm::mat4 viewProjectionMatrix = glm::mat4(1.0f);
+    glm::vec3 eyePos = glm::vec3(0.0f);
+    float pad0 = 0.0f;
+};
+
+// the shadowed point light and the lookup of the clustered lights (see LightClusters::writeLookup)
+struct LightData {
+    glm::vec3 ambient = glm::vec3(0.0f);
+    float pad0 = 0.0f;
+    glm::vec3 diffuse = glm::vec3(0.0f);
+    float pad1 = 0.0f;
+    glm::vec3 specular = glm::vec3(0.0f);
+    float pad2 = 0.0f;
+    glm::vec3 position = glm::vec3(0.0f);
+    float pad3 = 0.0f;
+    glm::vec2 clusterTileScale = glm::vec2(0.0f);  // tiles per pixel
+    float clusterSliceScale = 0.0f;                 // slices / log(far / near)
+    float clusterNear = 0.0f;
+    float clusterFar = 0.0f;
+    float pad4[3] = {};
+};
+
+// the shadow cube map: face view projections, the light they look out from and the far plane
+// the stored distances are divided by
+struct ShadowData {
+    glm::mat4 shadowMatrices[6] = {};
+    glm::vec3 lightPos = glm::vec3(0.0f);
+    float farPlane = 1.0f;
+};
+
+static_assert(sizeof(FrameData) == 208 && offsetof(FrameData, eyePos) == 192, "FrameData must match its std140 block");
+static_assert(sizeof(LightData) == 96 && offsetof(LightData, position) == 48 && offsetof(LightData, clusterTileScale) == 64
+    && offsetof(LightData, clusterFar) == 80, "LightData must match its std140 block");
+static_assert(sizeof(ShadowData) == 400 && offsetof(ShadowData, lightPos) == 384 && offsetof(ShadowData, farPlane) == 396,
+    "ShadowData must match its std140 block");
+
+// Streams the three blocks. Every update() writes all of them into the next slot of a ring in one mapped
+// write and binds the slot's ranges to the binding points. The slots the GPU may still read are never touched:
+// writes go to fresh ranges with GL_MAP_UNSYNCHRONIZED_BIT, and when the ring is full its storage is orphaned
+// and writing starts over at the front, so the CPU never waits for the GPU. Render thread only.
+class UniformBlocks
+{
+public:
+    static const GLsizeiptr RING_SLOTS = 64;
+
+    struct Stats {
+        uint64_t updates = 0;
+        uint64_t orphans = 0;   // times the ring wrapped and got new storage
+    };
+
+    // binding point of a GLSL block name, -1 for blocks without one
+    static GLint bindingPoint(const char* blockName)
+    {
+        static const char* names[UNIFORM_BLOCK_COUNT] = { "FrameData", "LightData", "ShadowData" };
+        for (GLint binding = 0; binding < GLint(UNIFORM_BLOCK_COUNT); binding++)
+        {
+            if (std::strcmp(blockName, names[binding]) == 0)
+                return binding;
+        }
+        return -1;
+    }
+
+    UniformBlocks()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        align = alignment > 0 ? GLsizeiptr(alignment) : 256;
+
+        const GLsizeiptr sizes[UNIFORM_BLOCK_COUNT] = { sizeof(FrameData), sizeof(LightData), sizeof(ShadowData) };
+        for (GLuint block = 0; block < UNIFORM_BLOCK_COUNT; block++)
+        {
+            offsets[block] = slotSize;
+            blockSizes[block] = sizes[block];
+            slotSize += alignUp(sizes[block]);
+        }
+        staging.resize(size_t(slotSize));
+
+        glGenBuffers(1, &buffer);
+        allocate();
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    UniformBlocks(const UniformBlocks&) = delete;
+    UniformBlocks& operator=(const UniformBlocks&) = delete;
+
+    // writes the frame's blocks and binds them for every draw that follows
+    void update(const FrameData& frame, const LightData& light, const ShadowData& shadow)
+    {
+        std::memcpy(&staging[size_t(offsets[UNIFORM_BLOCK_FRAME])], &frame, sizeof(frame));
+        std::memcpy(&staging[size_t(offsets[UNIFORM_BLOCK_LIGHT])], &light, sizeof(light));
+        std::memcpy(&staging[size_t(offsets[UNIFORM_BLOCK_SHADOW])], &shadow, sizeof(shadow));
+
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        if (cursor + slotSize > RING_SLOTS * slotSize)
+            orphan();
+        void* mapped = glMapBufferRange(GL_UNIFORM_BUFFER, cursor, slotSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        bool written = false;
+        if (mapped != nullptr)
+        {
+            std::memcpy(mapped, staging.data(), staging.size());
+            written = glUnmapBuffer(GL_UNIFORM_BUFFER) == GL_TRUE;
+        }
+        if (!written)
+        {
+            // the mapping failed or its contents were lost; start over on fresh storage
+            orphan();
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, slotSize, staging.data());
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        for (GLuint block = 0; block < UNIFORM_BLOCK_COUNT; block++)
+            glBindBufferRange(GL_UNIFORM_BUFFER, block, buffer, cursor + offsets[block], blockSizes[block]);
+        cursor += slotSize;
+        stats.updates++;
+    }
+
+    // bytes written per update, alignment padding included
+    GLsizeiptr bytesPerUpdate() const
+    {
+        return slotSize;
+    }
+
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+    void clean()
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+private:
+    GLuint buffer = 0;
+    GLsizeiptr align = 256;
+    GLsizeiptr offsets[UNIFORM_BLOCK_COUNT] = {};
+    GLsizeiptr blockSizes[UNIFORM_BLOCK_COUNT] = {};
+    GLsizeiptr slotSize = 0;
+    GLsizeiptr cursor = 0;
+    std::vector<char> staging;
+    Stats stats;
+
+    GLsizeiptr alignUp(GLsizeiptr bytes) const
+    {
+        return (bytes + align - 1) / align * align;
+    }
+
+    // storage for the whole ring, left bound to GL_UNIFORM_BUFFER
+    void allocate()
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, RING_SLOTS * slotSize, nullptr, GL_STREAM_DRAW);
+        cursor = 0;
+    }
+
+    // new storage for the ring, written from the front; the GPU keeps reading the old one until it is done with it
+    void orphan()
+    {
+        allocate();
+        stats.orphans++;
+    }
+};
+#endif
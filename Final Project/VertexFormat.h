@@ -0,0 +1,200 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Canonical vertex as produced by the importer and stored in the mesh cache.
+// What actually goes to the GPU is this vertex re-encoded in the selected VertexFormat.
+struct Vertex {
+    GLfloat x, y, z;	// Position
+    GLubyte r, g, b;    // Color (if any)
+    GLfloat u, v;		// UV coordinates
+    GLfloat nx, ny, nz; // Normal vector
+};
+
+// GPU vertex layouts. The shaders decode all of them (vertex_input.glsl):
+//   position = vertexPosition * positionScale + positionOffset
+//   normal   = OCTAHEDRAL_NORMALS ? decodeOctahedral(vertexNormal.xy) : vertexNormal, a variant per layout
+enum VertexLayout {
+    VERTEX_LAYOUT_FLOAT = 0,    // 32 bit float position/UV/normal, reference layout
+    VERTEX_LAYOUT_HALF,         // half float position relative to the mesh bounds, half float UV, octahedral normal
+    VERTEX_LAYOUT_SNORM16,      // 16 bit normalized position dequantized per mesh, half float UV, octahedral normal
+    VERTEX_LAYOUT_COUNT
+};
+
+// fixed attribute locations shared by every vertex shader
+enum VertexAttributeLocation {
+    ATTRIBUTE_POSITION = 0,
+    ATTRIBUTE_COLOR = 1,
+    ATTRIBUTE_UV = 2,
+    ATTRIBUTE_NORMAL = 3,
+    ATTRIBUTE_INSTANCE_TRANSFORM = 4,   // per-instance model matrix of the instanced shaders, one column each in locations 4 to 7
+    ATTRIBUTE_INSTANCE_INDEX = 4        // instead of the matrix, with INDIRECT_INSTANCES: the instance's index in the transforms (see GpuCulling)
+};
+
+struct VertexAttribute {
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset;
+};
+
+// Describes one vertex layout: how big a vertex is, how each attribute is stored and how to pack
+// canonical vertices into it. Attribute setup is driven entirely by this table.
+struct VertexFormat {
+    VertexLayout layout;
+    const char* name;
+    GLsizei stride;
+    std::vector<VertexAttribute> attributes;
+    bool octahedralNormals;
+    bool quantizedPositions;    // positions are normalized to the mesh bounds and need positionScale/positionOffset
+
+    static const VertexFormat& get(VertexLayout layout)
+    {
+        static const VertexFormat formats[VERTEX_LAYOUT_COUNT] = {
+            // 12 + 4 + 8 + 12 = 36 bytes
+            { VERTEX_LAYOUT_FLOAT, "float", 36, {
+                { ATTRIBUTE_POSITION, 3, GL_FLOAT, GL_FALSE, 0 },
+                { ATTRIBUTE_COLOR, 3, GL_UNSIGNED_BYTE, GL_TRUE, 12 },
+                { ATTRIBUTE_UV, 2, GL_FLOAT, GL_FALSE, 16 },
+                { ATTRIBUTE_NORMAL, 3, GL_FLOAT, GL_FALSE, 24 } }, false, false },
+            // 8 + 4 + 4 + 4 = 20 bytes
+            { VERTEX_LAYOUT_HALF, "half", 20, {
+                { ATTRIBUTE_POSITION, 3, GL_HALF_FLOAT, GL_FALSE, 0 },
+                { ATTRIBUTE_COLOR, 3, GL_UNSIGNED_BYTE, GL_TRUE, 8 },
+                { ATTRIBUTE_UV, 2, GL_HALF_FLOAT, GL_FALSE, 12 },
+                { ATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE, 16 } }, true, true },
+            // 8 + 4 + 4 + 4 = 20 bytes
+            { VERTEX_LAYOUT_SNORM16, "snorm16", 20, {
+                { ATTRIBUTE_POSITION, 3, GL_SHORT, GL_TRUE, 0 },
+                { ATTRIBUTE_COLOR, 3, GL_UNSIGNED_BYTE, GL_TRUE, 8 },
+                { ATTRIBUTE_UV, 2, GL_HALF_FLOAT, GL_FALSE, 12 },
+                { ATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE, 16 } }, true, true }
+        };
+        return formats[layout];
+    }
+
+    // layout used for new meshes, chosen at startup
+    static VertexLayout& defaultLayout()
+    {
+        static VertexLayout layout = VERTEX_LAYOUT_FLOAT;
+        return layout;
+    }
+
+    static bool parseLayout(const std::string& name, VertexLayout& layout)
+    {
+        for (int i = 0; i < VERTEX_LAYOUT_COUNT; i++)
+        {
+            if (name == get(VertexLayout(i)).name)
+            {
+                layout = VertexLayout(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // enables and points every attribute of the layout at the currently bound GL_ARRAY_BUFFER
+    void setupAttributes() const
+    {
+        for (const VertexAttribute& attribute : attributes)
+        {
+            glEnableVertexAttribArray(attribute.location);
+            glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, stride, (void*)(uintptr_t)attribute.offset);
+        }
+    }
+
+    // packs canonical vertices into this layout. For quantized positions the mesh bounds are mapped to
+    // [-1, 1]; the returned scale/offset turn the normalized value back into the model space position.
+    // Half floats are most precise near zero, so centering the mesh on the origin helps them too.
+    std::vector<unsigned char> encode(const std::vector<Vertex>& vertices, glm::vec3& positionScale, glm::vec3& positionOffset) const
+    {
+        positionScale = glm::vec3(1.0f);
+        positionOffset = glm::vec3(0.0f);
+        if (quantizedPositions && !vertices.empty())
+        {
+            glm::vec3 lower(vertices[0].x, vertices[0].y, vertices[0].z), upper = lower;
+            for (const Vertex& vertex : vertices)
+            {
+                lower = glm::min(lower, glm::vec3(vertex.x, vertex.y, vertex.z));
+                upper = glm::max(upper, glm::vec3(vertex.x, vertex.y, vertex.z));
+            }
+            positionOffset = (lower + upper) * 0.5f;
+            positionScale = glm::max((upper - lower) * 0.5f, glm::vec3(1e-8f));
+        }
+
+        std::vector<unsigned char> packed(vertices.size() * stride);
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const Vertex& vertex = vertices[i];
+            unsigned char* out = &packed[i * stride];
+            const unsigned char color[4] = { vertex.r, vertex.g, vertex.b, 255 };
+            if (layout == VERTEX_LAYOUT_FLOAT)
+            {
+                const float position[3] = { vertex.x, vertex.y, vertex.z };
+                const float uv[2] = { vertex.u, vertex.v };
+                const float normal[3] = { vertex.nx, vertex.ny, vertex.nz };
+                std::memcpy(out + 0, position, 12);
+                std::memcpy(out + 12, color, 4);
+                std::memcpy(out + 16, uv, 8);
+                std::memcpy(out + 24, normal, 12);
+                continue;
+            }
+
+            uint16_t position[4] = { 0, 0, 0, 0 };
+            glm::vec3 normalized = (glm::vec3(vertex.x, vertex.y, vertex.z) - positionOffset) / positionScale;
+            for (int c = 0; c < 3; c++)
+                position[c] = layout == VERTEX_LAYOUT_HALF ? glm::packHalf1x16(normalized[c]) : uint16_t(packSnorm16(normalized[c]));
+            const uint16_t uv[2] = { glm::packHalf1x16(vertex.u), glm::packHalf1x16(vertex.v) };
+            int16_t normal[2];
+            encodeOctahedral(glm::vec3(vertex.nx, vertex.ny, vertex.nz), normal);
+
+            std::memcpy(out + 0, position, 8);
+            std::memcpy(out + 8, color, 4);
+            std::memcpy(out + 12, uv, 4);
+            std::memcpy(out + 16, normal, 4);
+        }
+        return packed;
+    }
+
+    static int16_t packSnorm16(float value)
+    {
+        return int16_t(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+    }
+
+    // octahedral normal encoding: project onto the octahedron |x| + |y| + |z| = 1 and fold the lower
+    // half over the upper one, giving two values in [-1, 1]
+    static void encodeOctahedral(glm::vec3 normal, int16_t out[2])
+    {
+        float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+        if (length < 1e-8f)
+        {
+            out[0] = 0;
+            out[1] = 0;
+            return;
+        }
+        float x = normal.x / length, y = normal.y / length;
+        if (normal.z < 0.0f)
+        {
+            float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = foldedX;
+            y = foldedY;
+        }
+        out[0] = packSnorm16(x);
+        out[1] = packSnorm16(y);
+    }
+};
+#endif
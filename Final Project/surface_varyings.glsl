@@ -0,0 +1,19 @@
+// What the vertex shaders of the lit and light programs pass to their fragment shaders
+// (interpolated by the rasterization stage)
+#ifdef VERTEX_SHADER
+#define SURFACE_VARYING out
+#else
+#define SURFACE_VARYING in
+#endif
+
+// UV coordinate
+SURFACE_VARYING vec2 outUV;
+
+// Color
+SURFACE_VARYING vec3 outColor;
+
+// World space normal
+SURFACE_VARYING vec3 fragNormal;
+
+// World space position
+SURFACE_VARYING vec3 FragPos;
@@ -0,0 +1,38 @@
+// Per-frame uniform blocks, written once a frame and shared by every program (see UniformBlocks.h, whose
+// structs must keep the same layout)
+
+// Camera of the main pass
+layout(std140) uniform FrameData
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+	vec3 eyePos;
+};
+
+struct PointLight
+{
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+	vec3 position;
+};
+
+// The shadowed point light and the lookup of the clustered lights (see LightClusters.h)
+layout(std140) uniform LightData
+{
+	PointLight pointLight;
+	vec2 clusterTileScale;      // tiles per pixel
+	float clusterSliceScale;    // slices / log(far / near)
+	float clusterNear;
+	float clusterFar;
+};
+
+// Shadow cube map: view projection of every face, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, and the light
+// distance that maps to depth 1
+layout(std140) uniform ShadowData
+{
+	mat4 shadowMatrices[6];
+	vec3 lightPos;
+	float farPlane;
+};
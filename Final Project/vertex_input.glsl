@@ -0,0 +1,61 @@
+// Vertex attributes and their decoding, shared by the vertex shaders (see VertexFormat.h)
+
+// Vertex position
+layout(location = 0) in vec3 vertexPosition;
+
+// Vertex color
+layout(location = 1) in vec3 vertexColor;
+
+// Vertex UV coordinate
+layout(location = 2) in vec2 vertexUV;
+
+// Vertex Normal (xy hold the octahedral encoding in the compact layouts)
+layout(location = 3) in vec3 vertexNormal;
+
+#ifdef INSTANCED
+#ifdef INDIRECT_INSTANCES
+// Index of the instance in the instance buffer, from the list the culling shader left visible (see GpuCulling.h)
+layout(location = 4) in uint instanceIndex;
+
+// The instance buffer, read as a buffer texture: four texels per model matrix
+uniform samplerBuffer instanceTransforms;
+
+mat4 fetchInstanceModelMatrix()
+{
+	int texel = int(instanceIndex) * 4;
+	return mat4(texelFetch(instanceTransforms, texel), texelFetch(instanceTransforms, texel + 1),
+		texelFetch(instanceTransforms, texel + 2), texelFetch(instanceTransforms, texel + 3));
+}
+
+#define instanceModelMatrix fetchInstanceModelMatrix()
+#else
+// Per-instance model matrix (see InstanceBuffer.h)
+layout(location = 4) in mat4 instanceModelMatrix;
+#endif
+#endif
+
+// Vertex layout decoding
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
+// Model space position of the vertex in homogeneous coordinates
+vec4 decodePosition()
+{
+	return vec4(vertexPosition * positionScale + positionOffset, 1.0);
+}
+
+// Model space normal of the vertex; OCTAHEDRAL_NORMALS unfolds the octahedral encoding
+vec3 decodeNormal()
+{
+#ifdef OCTAHEDRAL_NORMALS
+	vec2 e = vertexNormal.xy;
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+#else
+	return vertexNormal;
+#endif
+}